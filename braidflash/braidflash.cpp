@@ -37,13 +37,15 @@ $ braidflash [QASM_FILE] [OPTIONS]
 #include <list>       //std::list
 #include <algorithm>  //std::erase, std::find, std::sort
 #include <numeric>    //std::accumulate
-#include <queue>      //std::queue
+#include <queue>      //std::queue, std::priority_queue
+#include <functional> //std::greater
 #include <stdlib.h>   //system
 #include <cstdlib>
 #include <cmath>      //sqrt, pow 
 #include <time.h>     //clock
 #include <sstream>    //std::stringstream
 #include <map>
+#include <tuple>      //std::tuple
 #include <unordered_map>
 #include <stack>
 #include <cstring>    //strcmp
@@ -51,6 +53,10 @@ $ braidflash [QASM_FILE] [OPTIONS]
 #include <limits.h>
 #include <limits>     //std::numeric_limits
 #include <unistd.h>
+#include <stdint.h>
+#include <fcntl.h>    //open
+#include <sys/mman.h> //mmap
+#include <sys/stat.h> //fstat
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/reverse_graph.hpp>
 #include <boost/graph/copy.hpp>
@@ -67,6 +73,7 @@ using namespace std;
 
 //#define _DEBUG    // optional: debug flag
 #define _PROGRESS   // optional: progress flag
+//#define _GRAPH_MESH // optional: boost graph mesh instead of the dense grid
 
 
 /*******************************************************************************
@@ -236,12 +243,35 @@ struct Link {
   unsigned owner;
   Link() : owner(0) {}
 };
+#ifdef _GRAPH_MESH
 typedef boost::adjacency_list<boost::setS, boost::vecS, boost::undirectedS, 
                               Node, Link> mesh_t;
 typedef mesh_t::vertex_descriptor node_descriptor;
 typedef mesh_t::edge_descriptor link_descriptor;
 map<unsigned, node_descriptor> node_map;
+#else
+// dense grid: nodes are numbered row by row, r*(num_cols+1)+c. 
+// links holds the horizontal links (east of each node, r*num_cols+c) 
+// followed by the vertical links (south of each node, indexed by its node)
+struct node_descriptor {
+  unsigned id;
+  node_descriptor(unsigned id=0) : id(id) {}
+};
+struct link_descriptor {
+  unsigned id;
+  link_descriptor(unsigned id=0) : id(id) {}
+};
+struct mesh_t {
+  vector<Node> nodes;
+  vector<Link> links;
+  Node &operator[](node_descriptor n) { return nodes[n.id]; }
+  Link &operator[](link_descriptor l) { return links[l.id]; }
+  void clear() { nodes.clear(); links.clear(); }
+};
+#endif
 mesh_t mesh; 
+unsigned busy_nodes;   // mesh nodes with an owner
+unsigned busy_links;   // mesh links with an owner
 
 // Braid: generic type, specifies engaged nodes and links
 struct Braid {
@@ -251,6 +281,7 @@ struct Braid {
     nodes(nodes), links(links) {}
 };
 Braid operator+( Braid const& lhs, Braid const& rhs);
+map<unsigned, Braid> owned_braids;  // nodes/links opened by each gate (seq)
 
 // Gate: operation and list of operands
 struct Gate {
@@ -272,89 +303,27 @@ typedef dag_t::edge_descriptor dependency_descriptor;
 map<unsigned, gate_descriptor> gate_map;
 dag_t dag;
 int highest_criticality;
+vector<unsigned> criticality_counts;  // gates with dependencies left, per criticality
 
 // Event: which braids should be opened/closed at which time.
 enum event_type {cnot1, cnot2, cnot3, cnot4, cnot5, cnot6, cnot7, h1, h2, t1};
 map<event_type, int> event_timers;
+typedef tuple<int, int, int> priority_t;  // smaller goes first
 struct Event {
   Braid braid;            // which nodes/links does it contain  
   bool close_open;        // 0: close, 1: open
   gate_descriptor gate;   // gate to which this event belongs
   event_type type;        // type of event
-  int timer;              // -1: invalid timer. 0: ready. >0: counting down.
+  int timer;              // -1: invalid timer. >=0: cycles to wait once at queue head.
+  unsigned long long deadline; // clock cycle at which a started timer lapses
   unsigned attempts;      // number of attempts to complete event
-  unsigned policy;        // determines comparison of Events
+  priority_t priority;    // once ready: key under priority_policy
+  unsigned long long arrival; // once ready: breaks ties in priority
   
   Event(Braid braid, bool close_open, gate_descriptor gate, 
-        event_type type, int timer=-1, unsigned attempts=0, unsigned policy=6): 
+        event_type type, int timer=-1, unsigned attempts=0): 
     braid(braid), close_open(close_open), gate(gate), 
-    type(type), timer(timer), attempts(attempts){}
-
-  bool operator< (const Event &other) const { // determining event priority
-    bool res = false;
-      // 0: no priorities. in program order.    
-    switch (policy) {
-      // 1: criticality only.      
-      case 1: res = (dag[gate].criticality > dag[other.gate].criticality); break;
-      // 2: braid length only. short2long.              
-      case 2: res = (braid.links.size() < other.braid.links.size()); break;
-      // 3: braid length only. long2short.              
-      case 3: res = (braid.links.size() > other.braid.links.size()); break;
-      // 4: close2open only.              
-      case 4: res = (close_open==false && other.close_open==true); break;
-      // 5: close2open + crticiality + short2long              
-      case 5:
-              if (close_open==false && other.close_open==true)
-                res = true;
-              else if (close_open==true && other.close_open==false)
-                res = false;                
-              else {
-                if (dag[gate].criticality > dag[other.gate].criticality)
-                  res = true;
-                else if (dag[gate].criticality == dag[other.gate].criticality)
-                  if (braid.links.size() < other.braid.links.size())
-                    res = true;
-                  else
-                    res = false;
-                else
-                  res = false;
-              }
-              break; 
-      // 6: close2open + criticality + 
-      //    short2long (highest crit) + long2short (lower crit)              
-      case 6:
-              if (close_open==false && other.close_open==true)
-                res = true;
-              else if (close_open==true && other.close_open==false)
-                res = false;                
-              else {              
-                if (dag[gate].criticality > dag[other.gate].criticality)
-                  res = true;
-                else if (dag[gate].criticality == dag[other.gate].criticality) {
-                  if (dag[gate].criticality == highest_criticality) {
-                    if (braid.links.size() < other.braid.links.size())
-                      res = true;
-                    else
-                      res = false;
-                  }
-                  else {
-                    if (braid.links.size() > other.braid.links.size())
-                      res = true;
-                    else
-                      res = false;
-                  }
-                }                
-                else
-                  res = false;
-              }
-              break;
-      // invalid prioritization policy              
-      default:
-             res = false; 
-             break;
-    }
-    return res;    
-  }
+    type(type), timer(timer), deadline(0), attempts(attempts), arrival(0) {}
 };
 
 void print_event(Event &event) {
@@ -390,7 +359,17 @@ map< string, unsigned > all_q_counts;
 vector<Gate> module_gates;
 vector<gate_descriptor> ready_gates;
 map< gate_descriptor, queue<Event> > event_queues;
-vector<Event> ready_events;
+// (deadline, gate) of every started head event, earliest first
+typedef pair<unsigned long long, gate_descriptor> deadline_t;
+priority_queue< deadline_t, vector<deadline_t>, greater<deadline_t> > event_deadlines;
+// ready events live in slots of ready_pool, and are visited in order of 
+// (priority, arrival) through ready_events
+vector<Event> ready_pool;
+vector<unsigned> free_slots;
+typedef map< pair<priority_t, unsigned long long>, unsigned > ready_order_t;
+ready_order_t ready_events;
+unsigned long long ready_arrivals;    // events made ready so far
+int keyed_highest_criticality;        // highest_criticality of the keys
 map< string, unsigned long long > module_freqs;
 
 // data structures for results
@@ -575,6 +554,135 @@ vector<string> &split(const string &s, char delim, vector<string> &elems) {
     return elems;
 }
 
+// which ops parse_LPFS records, and how
+void add_LPFS_gate (vector<Gate> &module_gates, unsigned &seq, 
+                    const string &op_type, const vector<unsigned> &qid) {
+  // assume X and Z gates are done in software
+  if (op_type == "CNOT" || op_type == "H" 
+      || op_type == "T" || op_type == "Tdag"
+      || op_type == "S" || op_type == "Sdag") { 
+    // for simplicity (not having 2 factory types)
+    // replace S gates with two T gates
+    if (replaceS) {
+      if (op_type == "S") {
+        Gate tg1 = Gate(seq++, "T", qid);
+        Gate tg2 = Gate(seq++, "T", qid);
+        module_gates.push_back(tg1);
+        module_gates.push_back(tg2);
+        return;
+      }
+      if (op_type == "Sdag") {
+        Gate tg1 = Gate(seq++, "Tdag", qid);
+        Gate tg2 = Gate(seq++, "Tdag", qid);
+        module_gates.push_back(tg1);
+        module_gates.push_back(tg2);
+        return;
+      }
+    }
+    Gate g = Gate(seq++, op_type, qid); 
+    module_gates.push_back(g);
+  }
+}
+
+// binary schedules written by GenLPFSSchedule -lpfs-bin (see the layout 
+// there), mapped into memory instead of read line by line
+void parse_LPFS_bin (const string file_path, vector<string> op_strings) {
+  int fd = open(file_path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    cerr<<"Error: Unable to open file."<<endl;
+    exit(1);
+  }
+  size_t size = st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    cerr<<"Error: Unable to map file."<<endl;
+    exit(1);
+  }
+  madvise(map, size, MADV_SEQUENTIAL);
+  const char *base = (const char*)map;
+  const char *end = base + size;
+  const uint32_t NO_QUBIT = 0xffffffff;
+  // version 1 has a uint8 op column, version 2 a uint16 one
+  uint32_t version = (size < 16) ? 0 : ((const uint32_t*)base)[2];
+  bool bad = (version != 1 && version != 2);
+  const size_t op_bytes = version;
+  const char *p = base + 16;
+  while (!bad && p < end) {
+    // block header
+    if (end - p < 32) { bad = true; break; }
+    const uint32_t *header = (const uint32_t*)p;
+    uint32_t num_qubits = header[3];
+    uint32_t num_op_names = header[4];
+    uint64_t num_ops = *(const uint64_t*)(p + 24);
+    p += 32;
+    if ((size_t)(end - p) < header[0]) { bad = true; break; }
+    string leaf_func(p, header[0]);
+    p += header[0];
+    // interned names: qubits only need their count, the ops are checked 
+    // against op_strings once instead of once per gate
+    vector<string> op_names;
+    for (uint32_t i = 0; i < num_qubits + num_op_names && !bad; i++) {
+      uint32_t len = 0;
+      if (end - p < 4 || (size_t)(end - p - 4) < (len = *(const uint32_t*)p)) {
+        bad = true; 
+        break;
+      }
+      if (i >= num_qubits)
+        op_names.push_back(string(p + 4, len));
+      p += 4 + len;
+    }
+    p = base + ((p - base + 3) & ~(size_t)3);
+    if (bad || p > end || (uint64_t)(end - p) / (12 + op_bytes) < num_ops) { bad = true; break; }
+    vector<bool> listed(op_names.size());
+    for (unsigned i = 0; i < op_names.size(); i++)
+      listed[i] = (is_there(op_strings, op_names[i] + " ") != string::npos);
+    // columns
+    const uint32_t *q0 = (const uint32_t*)p + num_ops;
+    const uint32_t *q1 = q0 + num_ops;
+    const uint8_t *ops8 = (const uint8_t*)(q1 + num_ops);
+    const uint16_t *ops16 = (const uint16_t*)(q1 + num_ops);
+    p = base + (((const char*)(q1 + num_ops) + num_ops * op_bytes - base + 7) & ~(size_t)7);
+    // qubits are numbered as the text parser would, as they first appear
+    // in recorded ops
+    vector<unsigned> q_num(num_qubits, UINT_MAX);
+    unsigned long long module_q_count = 0;
+    unsigned seq = 1;
+    vector<Gate> module_gates;
+    for (uint64_t i = 0; i < num_ops; i++) {
+      unsigned op = (version == 1) ? ops8[i] : ops16[i];
+      if (op >= op_names.size() 
+          || (q0[i] != NO_QUBIT && q0[i] >= num_qubits)
+          || (q1[i] != NO_QUBIT && q1[i] >= num_qubits)) {
+        bad = true;
+        break;
+      }
+      if (!listed[op] || q0[i] == NO_QUBIT)
+        continue;
+      vector<unsigned> qid;
+      if (q_num[q0[i]] == UINT_MAX)
+        q_num[q0[i]] = module_q_count++;
+      qid.push_back(q_num[q0[i]]);
+      if (q1[i] != NO_QUBIT) {
+        if (q_num[q1[i]] == UINT_MAX)
+          q_num[q1[i]] = module_q_count++;
+        qid.push_back(q_num[q1[i]]);
+      }
+      add_LPFS_gate(module_gates, seq, op_names[op], qid);
+    }
+    if (!bad) {
+      all_gates[leaf_func] = module_gates;
+      all_q_counts[leaf_func] = module_q_count;
+    }
+  }
+  munmap(map, size);
+  if (bad) {
+    cerr<<"Error: Corrupt binary schedule "<<file_path<<endl;
+    exit(1);
+  }
+}
+
 void parse_LPFS (const string file_path) {
   ifstream LPFSfile (file_path);
   string line;
@@ -586,6 +694,15 @@ void parse_LPFS (const string file_path) {
   const char* all_ops[] = {
     "PrepZ ", "X ", "Z ", "H ", "CNOT ", "T ", "Tdag ", "S ", "Sdag ", "MeasZ "};  
   vector<string> op_strings(all_ops, endof(all_ops));  
+  // binary schedule?
+  char magic[8] = {0};
+  if (LPFSfile.read(magic, 8) && memcmp(magic, "LPFSBIN1", 8) == 0) {
+    LPFSfile.close();
+    parse_LPFS_bin(file_path, op_strings);
+    return;
+  }
+  LPFSfile.clear();
+  LPFSfile.seekg(0);
   if (LPFSfile.is_open()) {
     while ( getline (LPFSfile,line) ) {
       // FunctionHeaders
@@ -620,31 +737,7 @@ void parse_LPFS (const string file_path) {
             q_name_to_num[qid2] = module_q_count++;          
           qid.push_back(q_name_to_num[qid2]);
         }
-        // assume X and Z gates are done in software
-        if (op_type == "CNOT" || op_type == "H" 
-            || op_type == "T" || op_type == "Tdag"
-            || op_type == "S" || op_type == "Sdag") { 
-          // for simplicity (not having 2 factory types)
-          // replace S gates with two T gates
-          if (replaceS) {
-            if (op_type == "S") {
-              Gate tg1 = Gate(seq++, "T", qid);
-              Gate tg2 = Gate(seq++, "T", qid);
-              module_gates.push_back(tg1);
-              module_gates.push_back(tg2);
-              continue;
-            }
-            if (op_type == "Sdag") {
-              Gate tg1 = Gate(seq++, "Tdag", qid);
-              Gate tg2 = Gate(seq++, "Tdag", qid);
-              module_gates.push_back(tg1);
-              module_gates.push_back(tg2);
-              continue;
-            }
-          }
-          Gate g = Gate(seq++, op_type, qid); 
-          module_gates.push_back(g);
-        }
+        add_LPFS_gate(module_gates, seq, op_type, qid);
       }
     }
     // save result of last iteration
@@ -779,6 +872,86 @@ unsigned set_surface_code_cycle (tech_t tech) {
   else {cerr << "Error: Unknown tech.\n"; exit(1);}
 }
 
+// (re)build an idle mesh of (num_rows+1) x (num_cols+1) nodes
+void build_mesh () {
+#ifdef _GRAPH_MESH
+  node_map.clear();
+  mesh.clear();
+  // add all nodes
+  for (unsigned i=0; i < (num_rows+1) * (num_cols+1); i++) {
+    node_descriptor n = boost::add_vertex(mesh);
+    mesh[n].owner = 0;
+    auto t = node_map.emplace(i, n);
+    if (t.second == false)
+      cerr << "Error: reinserting a node in the mesh." << endl;
+  }
+  // add all links
+  for (unsigned i=0; i < (num_rows+1) * (num_cols+1); i++) {
+    unsigned node_row = i / (num_cols+1);
+    unsigned node_col = i % (num_cols+1);
+    link_descriptor l; bool b;
+    if (node_row != 0) {  // north
+      boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i-num_cols-1], mesh);
+      mesh[l].owner = 0;
+    }
+    if (node_row != num_rows) { // south
+      boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i+num_cols+1], mesh);
+      mesh[l].owner = 0;
+    }
+    if (node_col != num_cols) { // east
+      boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i+1], mesh);
+      mesh[l].owner = 0;
+    }
+    if (node_col != 0) {  // west
+      boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i-1], mesh);
+      mesh[l].owner = 0;
+    }
+  }
+#else
+  mesh.clear();
+  mesh.nodes.resize((num_rows+1) * (num_cols+1));
+  mesh.links.resize((num_rows+1) * num_cols + num_rows * (num_cols+1));
+#endif
+  busy_nodes = 0;
+  busy_links = 0;
+  owned_braids.clear();
+}
+
+// change the owner of a mesh node or link, counting busy ones as they go
+template<typename R>
+void set_owner (R &resource, unsigned owner, unsigned &busy_count) {
+  if (!resource.owner && owner)
+    busy_count++;
+  else if (resource.owner && !owner)
+    busy_count--;
+  resource.owner = owner;
+}
+
+// router node number -> mesh node
+node_descriptor mesh_node (unsigned node_num) {
+#ifdef _GRAPH_MESH
+  return node_map[node_num];
+#else
+  assert(node_num < mesh.nodes.size() && "Error: node outside the mesh.");
+  return node_descriptor(node_num);
+#endif
+}
+
+// the link between two neighboring router nodes
+link_descriptor mesh_link (unsigned node1, unsigned node2) {
+#ifdef _GRAPH_MESH
+  return edge(node_map[node1], node_map[node2], mesh).first;
+#else
+  unsigned lo = min(node1, node2);
+  unsigned hi = max(node1, node2);
+  assert(hi < mesh.nodes.size() && "Error: node outside the mesh.");
+  if (hi == lo+1 && lo % (num_cols+1) != num_cols)  // horizontal
+    return link_descriptor(lo - lo/(num_cols+1));
+  assert(hi == lo+num_cols+1 && "Error: link between non-adjacent nodes.");
+  return link_descriptor((num_rows+1) * num_cols + lo);  // vertical
+#endif
+}
+
 // find the diagonal node with respect to qubit_num
 unsigned find_diagonal(unsigned qubit_num, unsigned node) {
   unsigned const top_left_node = qubit_num+(qubit_num/num_cols);
@@ -885,13 +1058,14 @@ Braid braid_short_L (unsigned qubit_num, unsigned src_node) {
         (src_node == bottom_right_node) )     
       && "Error: starting position for L-shaped braid not a corner of qubit.");
   // find the 3 nodes of the 'L' and its 2 links  
-  node_descriptor n1, n2, n3;  
+  unsigned horizontal_node = find_horizontal(qubit_num, src_node);
+  unsigned diagonal_node = find_diagonal(qubit_num, src_node);
+  node_descriptor n2, n3;  
   link_descriptor l1, l2;
-  n1 = node_map[src_node];
-  n2 = node_map[find_horizontal(qubit_num, src_node)];
-  n3 = node_map[find_diagonal(qubit_num, src_node)];  
-  l1 = edge(n1, n2, mesh).first;
-  l2 = edge(n2, n3, mesh).first;
+  n2 = mesh_node(horizontal_node);
+  n3 = mesh_node(diagonal_node);  
+  l1 = mesh_link(src_node, horizontal_node);
+  l2 = mesh_link(horizontal_node, diagonal_node);
 #ifdef _DEBUG  
   if (mesh[n2].owner || mesh[n3].owner || mesh[l1].owner || mesh[l2].owner)
     cerr << "CONFLICT: opening short L: from node " << src_node 
@@ -918,12 +1092,12 @@ Braid braid_S(unsigned qubit_num, unsigned src_node) {
         (src_node == bottom_right_node) )     
       && "Error: starting position for S-shaped braid not a corner of qubit.");
   // find the 2 nodes of 'S' and its two vertical links
-  node_descriptor n1, n2;
+  unsigned diagonal_node = find_diagonal(qubit_num, src_node);
+  node_descriptor n2;
   link_descriptor l1, l2;
-  n1 = node_map[src_node];
-  n2 = node_map[find_diagonal(qubit_num, src_node)];
-  l1 = edge(n1, find_vertical(qubit_num, src_node), mesh).first;
-  l2 = edge(n2, find_horizontal(qubit_num, src_node), mesh).first;  
+  n2 = mesh_node(diagonal_node);
+  l1 = mesh_link(src_node, find_vertical(qubit_num, src_node));
+  l2 = mesh_link(diagonal_node, find_horizontal(qubit_num, src_node));  
   
   // make diagonal node busy
 #ifdef _DEBUG
@@ -953,17 +1127,15 @@ Braid braid_dor (unsigned src_node, unsigned dest_node, bool YX) {
     while (src_col != dest_col) {
       src_col += col_dir; // move 1 col closer
       unsigned src_node_next = src_row*(num_cols+1)+src_col; // update src_node
-      dor_route.nodes.push_back( node_map[src_node_next] );
-      auto e1 = edge(node_map[src_node], node_map[src_node_next], mesh);
-      dor_route.links.push_back(e1.first);
+      dor_route.nodes.push_back( mesh_node(src_node_next) );
+      dor_route.links.push_back( mesh_link(src_node, src_node_next) );
       src_node = src_node_next;    
     }
     while (src_row != dest_row) {
       src_row += row_dir; // move 1 row closer
       unsigned src_node_next = src_row*(num_cols+1)+src_col; // update src_node
-      dor_route.nodes.push_back( node_map[src_node_next] ); 
-      auto e1 = edge(node_map[src_node], node_map[src_node_next], mesh);
-      dor_route.links.push_back(e1.first);
+      dor_route.nodes.push_back( mesh_node(src_node_next) ); 
+      dor_route.links.push_back( mesh_link(src_node, src_node_next) );
       src_node = src_node_next;
     }    
   }
@@ -972,17 +1144,15 @@ Braid braid_dor (unsigned src_node, unsigned dest_node, bool YX) {
     while (src_row != dest_row) {
       src_row += row_dir; // move 1 row closer
       unsigned src_node_next = src_row*(num_cols+1)+src_col; // update src_node
-      dor_route.nodes.push_back( node_map[src_node_next] ); 
-      auto e1 = edge(node_map[src_node], node_map[src_node_next], mesh);
-      dor_route.links.push_back(e1.first);
+      dor_route.nodes.push_back( mesh_node(src_node_next) ); 
+      dor_route.links.push_back( mesh_link(src_node, src_node_next) );
       src_node = src_node_next;
     }
     while (src_col != dest_col) {
       src_col += col_dir; // move 1 col closer
       unsigned src_node_next = src_row*(num_cols+1)+src_col; // update src_node
-      dor_route.nodes.push_back( node_map[src_node_next] );
-      auto e1 = edge(node_map[src_node], node_map[src_node_next], mesh);
-      dor_route.links.push_back(e1.first);
+      dor_route.nodes.push_back( mesh_node(src_node_next) );
+      dor_route.links.push_back( mesh_link(src_node, src_node_next) );
       src_node = src_node_next;        
     }
   }
@@ -1037,18 +1207,18 @@ pair<Braid,Braid> cnot_routes (unsigned src_qubit, unsigned dest_qubit, unsigned
     unsigned dest_bottom = find_horizontal(dest_qubit, middle_bottom);
 
     // cnot_route_1
-    link_descriptor l1 = edge(node_map[anc1], node_map[find_vertical(src_qubit, anc1)], mesh).first;
-    link_descriptor l2 = edge(node_map[middle_top], node_map[middle_bottom], mesh).first;
-    link_descriptor l3 = edge(node_map[dest_bottom], node_map[find_vertical(dest_qubit, dest_bottom)], mesh).first;
-    cnot_route_1.nodes.push_back(node_map[dest_bottom]);
+    link_descriptor l1 = mesh_link(anc1, find_vertical(src_qubit, anc1));
+    link_descriptor l2 = mesh_link(middle_top, middle_bottom);
+    link_descriptor l3 = mesh_link(dest_bottom, find_vertical(dest_qubit, dest_bottom));
+    cnot_route_1.nodes.push_back(mesh_node(dest_bottom));
     cnot_route_1.links.push_back(l1);
     cnot_route_1.links.push_back(l2);
     cnot_route_1.links.push_back(l3);    
 
     // cnot_route_2
-    link_descriptor l4 = edge(node_map[dest_bottom], node_map[middle_bottom], mesh).first;
-    cnot_route_2.nodes.push_back(node_map[middle_bottom]);
-    cnot_route_2.nodes.push_back(node_map[find_vertical(src_qubit, anc1)]);
+    link_descriptor l4 = mesh_link(dest_bottom, middle_bottom);
+    cnot_route_2.nodes.push_back(mesh_node(middle_bottom));
+    cnot_route_2.nodes.push_back(mesh_node(find_vertical(src_qubit, anc1)));
     cnot_route_2.links.push_back(l4);
     cnot_route_2.links.push_back(l2); 
     cnot_route_2.links.push_back(l1);     
@@ -1098,9 +1268,9 @@ queue<Event> events_cnot(unsigned src_qubit, unsigned dest_qubit, gate_descripto
   anc1 = anc1_anc2.first;
   anc2 = anc1_anc2.second;    
   // cnot_anc_route
-  link_descriptor anc_link = edge(node_map[anc1], node_map[anc2], mesh).first;
-  cnot_anc_route.nodes.push_back(node_map[anc2]);    
-  cnot_anc_route.nodes.push_back(node_map[anc1]);
+  link_descriptor anc_link = mesh_link(anc1, anc2);
+  cnot_anc_route.nodes.push_back(mesh_node(anc2));    
+  cnot_anc_route.nodes.push_back(mesh_node(anc1));
   cnot_anc_route.links.push_back(anc_link);  
   // cnot_route_1, cnot_route_2
   pair<Braid,Braid> cnot_route1_route2 = cnot_routes(src_qubit, dest_qubit, anc1);
@@ -1108,42 +1278,42 @@ queue<Event> events_cnot(unsigned src_qubit, unsigned dest_qubit, gate_descripto
   cnot_route_2 = cnot_route1_route2.second;
   
   // queue event cnot1: opening ancilla nodes/link immediately
-  cnot_events.push( Event(cnot_anc_route, 1, gate, cnot1, 1, 0, priority_policy) );
+  cnot_events.push( Event(cnot_anc_route, 1, gate, cnot1, 1, 0) );
 
   // queue event cnot2: closing ancilla link after 1 cycle
   node_descriptor n_anc1 = cnot_anc_route.nodes.back();
   //cnot_anc_route.nodes.pop_back();                       //del
   //node_descriptor n_anc2 = cnot_anc_route.nodes.back();
   //cnot_anc_route.nodes.pop_back();  
-  cnot_events.push( Event(cnot_anc_route, 0, gate, cnot2, -1, 0, priority_policy) );  
+  cnot_events.push( Event(cnot_anc_route, 0, gate, cnot2, -1, 0) );  
 
   // queue event cnot3: opening route_1 after 1 cycle
   cnot_route_1.nodes.push_back(n_anc1);                    //add
-  cnot_events.push( Event(cnot_route_1, 1, gate, cnot3, -1, 0, priority_policy) );  
+  cnot_events.push( Event(cnot_route_1, 1, gate, cnot3, -1, 0) );  
   
   // queue event cnot4: closing route_1 after 1 cycle
   cnot_route_1.nodes.pop_back();                           //add
   node_descriptor n_last = cnot_route_1.nodes.back();      //del
   //cnot_route_1.nodes.pop_back();                         //del
   cnot_route_1.nodes.push_back(n_anc1);                    //del
-  cnot_events.push( Event(cnot_route_1, 0, gate, cnot4, -1, 0, priority_policy) );
+  cnot_events.push( Event(cnot_route_1, 0, gate, cnot4, -1, 0) );
   
   // queue event cnot5: opening route_2 after minimum d-1 cycles
   cnot_route_2.nodes.push_back(n_last);                    //add
   //cnot_route_2.nodes.pop_back();                         //del
-  cnot_events.push( Event(cnot_route_2, 1, gate, cnot5, -1, 0, priority_policy) );    
+  cnot_events.push( Event(cnot_route_2, 1, gate, cnot5, -1, 0) );    
   
   // queue event cnot6: closing route_2 after 1 cycle
   //cnot_route_2.nodes.push_back(n_last);                  //del
   link_descriptor l_anc = cnot_route_2.links.back();
   cnot_route_2.links.pop_back();
-  cnot_events.push( Event(cnot_route_2, 0, gate, cnot6, -1, 0, priority_policy) ); 
+  cnot_events.push( Event(cnot_route_2, 0, gate, cnot6, -1, 0) ); 
   
   // queue event cnot7: closing ancillas after minimum d-1 cycles
   cnot_anc_route.links.pop_back();
   cnot_anc_route.links.push_back(l_anc);
   //cnot_anc_route.nodes.push_back(n_anc2);
-  cnot_events.push( Event(cnot_anc_route, 0, gate, cnot7, -1, 0, priority_policy) );  
+  cnot_events.push( Event(cnot_anc_route, 0, gate, cnot7, -1, 0) );  
   // return events queue
   return cnot_events;
 }
@@ -1160,8 +1330,8 @@ queue<Event> events_h(unsigned src_qubit, gate_descriptor gate) {
   unsigned src_bottom_left = src_qubit+(src_qubit/num_cols)+num_cols+1;
   unsigned src_bottom_right = src_qubit+(src_qubit/num_cols)+num_cols+2;
   // right link
-  link_descriptor left_link = edge(node_map[src_top_left], node_map[src_bottom_left], mesh).first;
-  link_descriptor right_link = edge(node_map[src_top_right], node_map[src_bottom_right], mesh).first;
+  link_descriptor left_link = mesh_link(src_top_left, src_bottom_left);
+  link_descriptor right_link = mesh_link(src_top_right, src_bottom_right);
   // merge the braid segments
   h_route.links.push_back(left_link);
   h_route.links.push_back(right_link);
@@ -1195,11 +1365,11 @@ void print_2d_mesh(unsigned max_rows, unsigned max_cols) {
   for (unsigned r=0; r<max_rows; r++) {
     for (unsigned c=0; c<max_cols; c++) {
       unsigned node_num = r*(num_cols+1)+c;
-      vis_file << node_num << '(' << ( (mesh[node_map[node_num]].owner)?'*':' ' ) << ')' << "\t\t";
+      vis_file << node_num << '(' << ( (mesh[mesh_node(node_num)].owner)?'*':' ' ) << ')' << "\t\t";
       // horizontal links
       if (c != max_cols-1) {
-        auto e = edge(node_map[node_num], node_map[node_num+1], mesh);
-        vis_file << "--(" << ( (mesh[e.first].owner)?'*':' ' ) << ")" << "\t\t\t";
+        link_descriptor l = mesh_link(node_num, node_num+1);
+        vis_file << "--(" << ( (mesh[l].owner)?'*':' ' ) << ")" << "\t\t\t";
       }
     }
     vis_file << "\n\n\n";
@@ -1207,8 +1377,8 @@ void print_2d_mesh(unsigned max_rows, unsigned max_cols) {
     for (unsigned c=0; c<max_cols; c++) {
       unsigned node_num = r*(num_cols+1)+c;
       if (r != max_rows-1) {
-        auto e = edge(node_map[node_num], node_map[node_num+num_cols+1], mesh);
-        vis_file << "||(" << ( (mesh[e.first].owner)?'*':' ' ) << ")" << "\t\t\t";        
+        link_descriptor l = mesh_link(node_num, node_num+num_cols+1);
+        vis_file << "||(" << ( (mesh[l].owner)?'*':' ' ) << ")" << "\t\t\t";        
         if (c != max_cols-1) {
           vis_file << "Q" << node_num-r << "\t\t\t";
         }
@@ -1221,35 +1391,9 @@ void print_2d_mesh(unsigned max_rows, unsigned max_cols) {
 
 // what percent of the mesh is busy
 double get_mesh_util() {
-  int max_rows = num_rows+1;
-  int max_cols = num_cols+1;
-  int busy_links=0; int busy_nodes=0; int node_count=0; int link_count=0;  
-  for (unsigned r = 0; r<max_rows; r++) {
-    for (unsigned c = 0; c<max_cols; c++) {
-      unsigned node_num = r*(num_cols+1)+c;
-      node_count++;
-      if (mesh[node_map[node_num]].owner)
-        busy_nodes++;
-      // horizontal links
-      if (c != max_cols-1) {
-        auto e = edge(node_map[node_num], node_map[node_num+1], mesh);
-        link_count++;
-        if (mesh[e.first].owner)
-          busy_links++;
-      }
-    }
-    // vertical links
-    for (unsigned c=0; c<max_cols; c++) {
-      unsigned node_num = r*(num_cols+1)+c;
-      if (r != max_rows-1) {
-        auto e = edge(node_map[node_num], node_map[node_num+num_cols+1], mesh);
-        link_count++;
-        if (mesh[e.first].owner)
-          busy_links++;
-      }      
-    }
-  }
- 
+  // busy_nodes/busy_links are kept up to date by do_event and purges
+  int node_count = (num_rows+1) * (num_cols+1);
+  //int link_count = (num_rows+1) * num_cols + num_rows * (num_cols+1);
   // return ((double)busy_nodes/(double)node_count + (double)busy_links/(double)link_count); 
   return (double)(busy_nodes/*+busy_links*/)/(double)(node_count/* + link_count*/);
 }
@@ -1540,7 +1684,7 @@ pair<double, double> get_footprint_latency (factory_design_t &factory_design, co
 *******************************************************************************/
 
 // close or open the given braid
-bool do_event(Event event) {
+bool do_event(const Event &event) {
 #ifdef _DEBUG
   cout << "doing event " << (int)event.type+1 << " for gate " << dag[event.gate].seq << ":\t";
 #endif
@@ -1567,11 +1711,18 @@ bool do_event(Event event) {
   }
 
   // do it if no conflict
+  unsigned owner = (event.close_open)? dag[event.gate].seq : 0;
   for (auto const &n : event.braid.nodes) {
-    mesh[n].owner = (event.close_open)? dag[event.gate].seq : 0;
+    set_owner(mesh[n], owner, busy_nodes);
   }
   for (auto const &l : event.braid.links) {
-    mesh[l].owner = (event.close_open)? dag[event.gate].seq : 0;
+    set_owner(mesh[l], owner, busy_links);
+  }
+  // remember what was opened, in case the gate gets purged
+  if (event.close_open) {
+    Braid &owned = owned_braids[owner];
+    owned.nodes.insert(owned.nodes.end(), event.braid.nodes.begin(), event.braid.nodes.end());
+    owned.links.insert(owned.links.end(), event.braid.links.begin(), event.braid.links.end());
   }
 #ifdef _DEBUG
   cout << "SUCCESS." << endl;
@@ -1594,7 +1745,7 @@ void resolve_cnot (Event &event) {
     Braid cnot_route_1 =  cnot_routes(src_qubit, dest_qubit, anc1, 1).first;  // calculate new route
     event.braid = cnot_route_1;                                               // update route for cnot3
     cnot_route_1.nodes.pop_back();                                            // exclude last node of cnot3 braid
-    cnot_route_1.nodes.push_back(node_map[anc1]);                             // include anc1 node
+    cnot_route_1.nodes.push_back(mesh_node(anc1));                             // include anc1 node
     event_queues[event.gate].front().braid = cnot_route_1;                    // update route for cnot4
   }
   else if (event.type == cnot5) {
@@ -1610,41 +1761,23 @@ void resolve_cnot (Event &event) {
 }
 
 void purge_gate_from_mesh (unsigned gate_seq) {
-  // purge nodes row by row
-  for (unsigned r=0; r<num_rows+1; r++) {
-    for (unsigned c=0; c<num_cols+1; c++) {
-      unsigned node_num = r*(num_cols+1)+c;
-      if ( mesh[node_map[node_num]].owner == gate_seq ) {
+  // only what the gate has opened can still be its own
+  auto it = owned_braids.find(gate_seq);
+  if (it == owned_braids.end())
+    return;
 #ifdef _DEBUG
-        cout << "\t\tpurging node " << node_num << endl;
-#endif        
-        mesh[node_map[node_num]].owner = 0;
-      }
-      // horizontal links
-      if (c != num_cols) {
-        auto e = edge(node_map[node_num], node_map[node_num+1], mesh);
-        if ( mesh[e.first].owner == gate_seq ) {
-#ifdef _DEBUG          
-          cout << "\t\tpurging link " << node_num << " == " << node_num+1 << endl;
-#endif          
-          mesh[e.first].owner = 0;
-        }
-      } 
-    }
-    // vertical links 
-    for (unsigned c=0; c<num_cols+1; c++) {
-      unsigned node_num = r*(num_cols+1)+c;
-      if (r != num_rows) {
-        auto e = edge(node_map[node_num], node_map[node_num+num_cols+1], mesh);
-        if ( mesh[e.first].owner == gate_seq ) {
-#ifdef _DEBUG          
-          cout << "\t\tpurging link " << node_num << " == " << node_num+num_cols+1 << endl;
+  cout << "\t\tpurging " << it->second.nodes.size() << " nodes, " 
+    << it->second.links.size() << " links" << endl;
 #endif
-          mesh[e.first].owner = 0;
-        }
-      }
-    }
-  }    
+  for (auto const &n : it->second.nodes) {
+    if ( mesh[n].owner == gate_seq )
+      set_owner(mesh[n], 0, busy_nodes);
+  }
+  for (auto const &l : it->second.links) {
+    if ( mesh[l].owner == gate_seq )
+      set_owner(mesh[l], 0, busy_links);
+  }
+  owned_braids.erase(it);
 }
 
 // find total module critical path
@@ -1735,16 +1868,45 @@ void assign_criticality () {
   }
 }
 
-void update_highest_criticality () {
-  highest_criticality = 0;
+// count the gates that are not completed (still have dependencies) 
+// at each criticality, and find the highest one
+void count_criticalities () {
+  criticality_counts.assign(1, 0);
   for (auto g_it_range = vertices(dag); g_it_range.first != g_it_range.second; ++g_it_range.first){
     gate_descriptor g = *(g_it_range.first);
     if (boost::in_degree(g, dag)!=0 || boost::out_degree(g,dag)!=0) { // don't look at completed gates.
       int crit = dag[g].criticality;
-      if (crit > highest_criticality)
-        highest_criticality = crit;
+      if (crit < 0)
+        continue;
+      if (crit >= (int)criticality_counts.size())
+        criticality_counts.resize(crit+1, 0);
+      criticality_counts[crit]++;
     }
   }    
+  highest_criticality = criticality_counts.size()-1;
+  while (highest_criticality > 0 && criticality_counts[highest_criticality] == 0)
+    highest_criticality--;
+}
+
+// gate g is about to lose its out-edges: uncount it and any successor 
+// left without dependencies. highest_criticality only ever goes down.
+void update_highest_criticality (gate_descriptor g) {
+  vector<gate_descriptor> retired;
+  if (boost::in_degree(g, dag)!=0 || boost::out_degree(g,dag)!=0)
+    retired.push_back(g);
+  dag_t::adjacency_iterator neighborIt, neighborEnd;
+  boost::tie(neighborIt, neighborEnd) = adjacent_vertices(g, dag);
+  for (; neighborIt != neighborEnd; ++neighborIt) {
+    if (boost::in_degree(*neighborIt, dag) == 1 && boost::out_degree(*neighborIt, dag) == 0)
+      retired.push_back(*neighborIt);
+  }
+  for (auto &r : retired) {
+    int crit = dag[r].criticality;
+    if (crit >= 0)
+      criticality_counts[crit]--;
+  }
+  while (highest_criticality > 0 && criticality_counts[highest_criticality] == 0)
+    highest_criticality--;
 }
 
 void initialize_ready_list () {
@@ -1756,6 +1918,108 @@ void initialize_ready_list () {
   }   
 }
 
+// start the timer of the event at the head of a gate's queue: 
+// it lapses after max(timer,1) cycles
+void start_timer (gate_descriptor gate, int timer) {
+  Event &head_event = event_queues[gate].front();
+  head_event.timer = timer;
+  if (timer < 0)                    // predecessor hasn't finished yet
+    return;
+  head_event.deadline = clk + max(timer, 1);
+  event_deadlines.push(make_pair(head_event.deadline, gate));
+}
+
+// how many of the coming cycles can pass without any event lapsing
+unsigned long long idle_cycles () {
+  if (event_deadlines.empty())
+    return 0;
+  return event_deadlines.top().first - clk - 1;
+}
+
+// advance the clock over idle cycles: the mesh does not change, 
+// so its utilization is weighted by the number of cycles skipped
+void skip_clock (unsigned long long cycles) {
+  if (cycles == 0)
+    return;
+  double mu = get_mesh_util();
+  avg_module_mesh_utility = ((double)clk*avg_module_mesh_utility + (double)cycles*mu)
+                            /(double)(clk+cycles);
+  clk += cycles;
+}
+
+// priority of an event under priority_policy: computed once it is ready, 
+// instead of comparing events while sorting them
+priority_t event_priority (const Event &event) {
+  int open = event.close_open;
+  int crit = dag[event.gate].criticality;
+  int len = event.braid.links.size();
+  switch (priority_policy) {
+    // 1: criticality only.      
+    case 1: return make_tuple(-crit, 0, 0);
+    // 2: braid length only. short2long.              
+    case 2: return make_tuple(len, 0, 0);
+    // 3: braid length only. long2short.              
+    case 3: return make_tuple(-len, 0, 0);
+    // 4: close2open only.              
+    case 4: return make_tuple(open, 0, 0);
+    // 5: close2open + crticiality + short2long              
+    case 5: return make_tuple(open, -crit, len);
+    // 6: close2open + criticality + 
+    //    short2long (highest crit) + long2short (lower crit)              
+    case 6: return make_tuple(open, -crit, (crit == highest_criticality) ? len : -len);
+    // 0: no priorities. in program order.    
+    default: return make_tuple(0, 0, 0);
+  }
+}
+
+// move an event into the ready set
+void add_ready_event (Event event) {
+  unsigned slot;
+  if (free_slots.empty()) {
+    slot = ready_pool.size();
+    ready_pool.push_back(std::move(event));
+  }
+  else {
+    slot = free_slots.back();
+    free_slots.pop_back();
+    ready_pool[slot] = std::move(event);
+  }
+  Event &ready_event = ready_pool[slot];
+  ready_event.arrival = ready_arrivals++;
+  ready_event.priority = event_priority(ready_event);
+  ready_events.emplace(make_pair(ready_event.priority, ready_event.arrival), slot);
+}
+
+// drop an event from the ready set, returning the one after it
+ready_order_t::iterator remove_ready_event (ready_order_t::iterator it) {
+  free_slots.push_back(it->second);
+  return ready_events.erase(it);
+}
+
+// recompute the priority of a ready event (e.g. its braid changed)
+void rekey_ready_event (unsigned slot) {
+  Event &ready_event = ready_pool[slot];
+  ready_events.erase(make_pair(ready_event.priority, ready_event.arrival));
+  ready_event.priority = event_priority(ready_event);
+  ready_events.emplace(make_pair(ready_event.priority, ready_event.arrival), slot);
+}
+
+// under policy 6 equally critical events are ordered by whether they are 
+// the most critical ones: rekey those affected by a new highest_criticality
+void update_ready_priorities () {
+  if (priority_policy != 6 || keyed_highest_criticality == highest_criticality)
+    return;
+  vector<unsigned> slots;
+  for (auto const &r : ready_events) {
+    int crit = dag[ready_pool[r.second].gate].criticality;
+    if (crit == keyed_highest_criticality || crit == highest_criticality)
+      slots.push_back(r.second);
+  }
+  keyed_highest_criticality = highest_criticality;
+  for (auto slot : slots)
+    rekey_ready_event(slot);
+}
+
 void increment_clock() {
   if (visualize_mesh) {
     print_2d_mesh(num_rows+1, num_cols+1);
@@ -1764,30 +2028,24 @@ void increment_clock() {
   // record mesh utilization
   double mu = get_mesh_util();  
   avg_module_mesh_utility = ((double)(clk-1)*avg_module_mesh_utility + mu)/(double)clk;
-  // decrement event timers for all head events
-  // whose predecessor event has finished (timer => 0)
-  vector<gate_descriptor> to_delete_key;
-  for (auto i = event_queues.begin(); i!=event_queues.end(); ++i) { // is this too slow?
-    Event &head_event = (*i).second.front();
-    if (head_event.timer < 0)       // predecessor hasn't finished yet
-      continue;
-    if (head_event.timer != 0)
-      head_event.timer--;
-#ifdef _DEBUG
-    cout << "gate " << dag[(*i).first].seq << ", head_event.timer: " << head_event.timer << endl;        
-#endif
-    if(head_event.timer == 0) {     // lapsed event
+  // move head events whose deadline is now to ready_events, 
+  // in gate order (ties in the deadline heap are broken by gate)
+  while (!event_deadlines.empty() && event_deadlines.top().first <= clk) {
+    gate_descriptor g = event_deadlines.top().second;
+    unsigned long long deadline = event_deadlines.top().first;
+    event_deadlines.pop();
+    auto i = event_queues.find(g);
+    if (i == event_queues.end() || i->second.empty() 
+        || i->second.front().timer < 0 || i->second.front().deadline != deadline)
+      continue;                     // stale: gate was dropped meanwhile
 #ifdef _DEBUG
-      cout << "\tevent lapsed: popping from queue." << endl;
+    cout << "gate " << dag[g].seq << ": event lapsed, popping from queue." << endl;
 #endif
-      ready_events.push_back(head_event);
-      (*i).second.pop();
-      if ((*i).second.empty())
-        to_delete_key.push_back((*i).first);
-    }
+    add_ready_event(std::move(i->second.front()));
+    i->second.pop();
+    if (i->second.empty())
+      event_queues.erase(i);
   }
-  for (auto &k : to_delete_key)
-    event_queues.erase(k);
 }
 
 
@@ -1809,6 +2067,9 @@ int main (int argc, char *argv[]) {
   string benchmark_dir = benchmark_path.substr(0, benchmark_path.find_last_of('/'));  
   string benchmark_name = benchmark_path.substr(benchmark_path.find_last_of('/')+1, benchmark_path.length());  
   string LPFS_path = benchmark_path+".lpfs";
+  // binary schedule (GenLPFSSchedule -lpfs-bin) if there is one
+  if (access((LPFS_path+".bin").c_str(), R_OK) == 0)
+    LPFS_path += ".bin";
   string profile_freq_path = benchmark_path+".freq";
   parse_LPFS(LPFS_path);
   parse_freq(profile_freq_path);
@@ -2017,7 +2278,6 @@ int main (int argc, char *argv[]) {
   for (auto const &map_it : all_gates) {
     // reset clock, mesh and dag
     clk = 0;
-    node_map.clear();
     gate_map.clear();
     mesh.clear();
     dag.clear();
@@ -2027,6 +2287,8 @@ int main (int argc, char *argv[]) {
     total_dropped_gates.clear();
     unique_dropped_gates.clear();
     attempts_hist.clear();
+    ready_pool.clear();
+    free_slots.clear();
     avg_module_mesh_utility = 0.0;
     gate_complete_count = 0;
 
@@ -2203,39 +2465,10 @@ int main (int argc, char *argv[]) {
           }), module_gates.end() );
 
     // build mesh
-    // add all nodes   
 #ifdef _PROGRESS
     cout << "Building mesh..." << endl;
 #endif 
-    for (unsigned i=0; i < (num_rows+1) * (num_cols+1); i++) {
-      node_descriptor n = boost::add_vertex(mesh);
-      mesh[n].owner = 0;
-      auto t = node_map.emplace(i, n);
-      if (t.second == false)
-        cerr << "Error: reinserting a node in the mesh." << endl;
-    }
-    // add all links
-    for (unsigned i=0; i < (num_rows+1) * (num_cols+1); i++) {
-      unsigned node_row = i / (num_cols+1);
-      unsigned node_col = i % (num_cols+1);
-      link_descriptor l; bool b;
-      if (node_row != 0) {  // north
-        boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i-num_cols-1], mesh);  
-        mesh[l].owner = 0;
-      }
-      if (node_row != num_rows) { // south
-        boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i+num_cols+1], mesh);  
-        mesh[l].owner = 0;      
-      }
-      if (node_col != num_cols) { // east
-        boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i+1], mesh);  
-        mesh[l].owner = 0; 
-      }
-      if (node_col != 0) {  // west
-        boost::tie(l,b) = boost::add_edge(node_map[i], node_map[i-1], mesh);    
-        mesh[l].owner = 0;      
-      }
-    } 
+    build_mesh();
 
     // build dag
     // add all gates 
@@ -2291,7 +2524,8 @@ int main (int argc, char *argv[]) {
     else
       all_dags_opt[module_name] = dag;
 
-    update_highest_criticality();
+    count_criticalities();
+    keyed_highest_criticality = highest_criticality;
 
     // find serial completion time
 #ifdef _PROGRESS
@@ -2365,30 +2599,42 @@ int main (int argc, char *argv[]) {
           queue<Event> t_events = events_t(dag[*it_g].qid[0], *it_g);
           event_queues[*it_g] = t_events;
         }            
+        if (!event_queues[*it_g].empty())
+          start_timer(*it_g, event_queues[*it_g].front().timer);
         it_g = ready_gates.erase(it_g);
       }
 
-      // decrements timer on all events
-      // when timer=0, moves from event_queues to ready_events
+      // nothing to retry: jump ahead to the cycle of the next deadline
+      // (stopping at every progress report, which may also bail out)
+      if (ready_events.empty() && !visualize_mesh) {
+        unsigned long long idle = idle_cycles();
+#ifdef _PROGRESS
+        idle = min(idle, 10000 - clk % 10000 - 1);
+#endif
+        skip_clock(idle);
+      }
+
+      // moves events whose deadline has come from event_queues to ready_events
       increment_clock();
       
       // do any lapsed event 
       bool YX_flag = false;
       bool drop_flag = false;
-      if (priority_policy != 0)
-        sort(ready_events.begin(), ready_events.end()); // sort by events' priorities
+      int resolved_slot = -1;
+      update_ready_priorities();
       auto it_e = ready_events.begin();
-      while (it_e != ready_events.end()) {
-        bool success = do_event(*it_e);
+      while (it_e != ready_events.end()) {  // in order of events' priorities
+        Event &event = ready_pool[it_e->second];
+        bool success = do_event(event);
         if (success) {       
-          if ( attempts_hist.find((*it_e).attempts) != attempts_hist.end() )
-            attempts_hist[(*it_e).attempts]++;
+          if ( attempts_hist.find(event.attempts) != attempts_hist.end() )
+            attempts_hist[event.attempts]++;
           else
-            attempts_hist[(*it_e).attempts] = 1;
-          success_events.push_back( make_pair((*it_e).gate,(*it_e).type) );
+            attempts_hist[event.attempts] = 1;
+          success_events.push_back( make_pair(event.gate,event.type) );
           // remove it_e from ready_events
-          gate_descriptor g = (*it_e).gate;        
-          it_e = ready_events.erase(it_e);
+          gate_descriptor g = event.gate;        
+          it_e = remove_ready_event(it_e);
           // was last event in its queue: remove node and edge to children        
           if ( event_queues[g].empty() ) {   // slow? 
 #ifdef _DEBUG
@@ -2401,6 +2647,7 @@ int main (int argc, char *argv[]) {
               cout << gate_complete_count << " gates completed." << endl;
 #endif            
             event_queues.erase(g);
+            owned_braids.erase(dag[g].seq);
             dag_t::adjacency_iterator neighborIt, neighborEnd;
             boost::tie(neighborIt, neighborEnd) = adjacent_vertices(g, dag);
             for (; neighborIt != neighborEnd; ++neighborIt) {
@@ -2415,9 +2662,9 @@ int main (int argc, char *argv[]) {
                 ready_gates.push_back(g_out);
               }
             }                   
+            update_highest_criticality(g);
             boost::clear_out_edges(g, dag);          
             assert(in_degree(g,dag) == 0 && out_degree(g,dag) == 0 && "removing gate prematurely from dag.");
-            update_highest_criticality();
 #ifdef _DEBUG
             cout << "\t\thighest_criticality: " << highest_criticality << endl;            
 #endif            
@@ -2428,22 +2675,23 @@ int main (int argc, char *argv[]) {
             cout << "\tsetting timer of next event in queue." << endl;
 #endif
             event_type t = event_queues[g].front().type;      
-            event_queues[g].front().timer = event_timers[t];
+            start_timer(g, event_timers[t]);
           }
         }
         else {
-          (*it_e).attempts++;
-          if ( (*it_e).attempts > attempt_th_yx && !YX_flag) {
+          event.attempts++;
+          if ( event.attempts > attempt_th_yx && !YX_flag) {
             // deadlock: change route by substituting YX DOR for XY DOR
             // for maximum one event per clock cycle
 #ifdef _DEBUG
-            print_event(*it_e);
+            print_event(event);
 #endif
-            if ( (*it_e).type == cnot3 || (*it_e).type == cnot5 ) {
+            if ( event.type == cnot3 || event.type == cnot5 ) {
 #ifdef _DEBUG              
               cout << "\tYX DOR for above event..." << endl;
 #endif
-              resolve_cnot(*it_e);
+              resolve_cnot(event);
+              resolved_slot = it_e->second;   // rekeyed after this cycle
               YX_flag = true;
             }
 #ifdef _DEBUG            
@@ -2451,31 +2699,35 @@ int main (int argc, char *argv[]) {
               cout << "\twaiting for above event to resolve itself..." << endl;
 #endif
           }
-          if ( (*it_e).attempts > attempt_th_drop && !drop_flag ) {
+          if ( event.attempts > attempt_th_drop && !drop_flag ) {
             // deadlock: drop and reinject the entire gate
             // for maximum one event per clock cycle            
-            gate_descriptor g = (*it_e).gate;                                    
+            gate_descriptor g = event.gate;                                    
 #ifdef _DEBUG
             cout << "\tdropping gate..." << dag[g].seq << endl;
 #endif
-            gate_descriptor dropped_gate = (*it_e).gate;
+            gate_descriptor dropped_gate = event.gate;
             total_dropped_gates.push_back( dropped_gate );
             if ( find(unique_dropped_gates.begin(), unique_dropped_gates.end(), dropped_gate) == unique_dropped_gates.end() )
               unique_dropped_gates.push_back( dropped_gate );
             purge_gate_from_mesh( dag[g].seq );
             ready_gates.push_back(g);
             event_queues.erase(g);
-            it_e = ready_events.erase(it_e);
+            if (resolved_slot == (int)it_e->second)
+              resolved_slot = -1;
+            it_e = remove_ready_event(it_e);
             drop_flag = true;
             continue;
           }
-          pair<gate_descriptor, event_type> conflict_event = make_pair( (*it_e).gate,(*it_e).type );         
+          pair<gate_descriptor, event_type> conflict_event = make_pair( event.gate,event.type );         
           total_conflict_events.push_back( conflict_event );
           if ( find(unique_conflict_events.begin(), unique_conflict_events.end(), conflict_event) == unique_conflict_events.end() )
             unique_conflict_events.push_back( conflict_event );          
           ++it_e;
         }
       }
+      if (resolved_slot >= 0)
+        rekey_ready_event(resolved_slot);
     }
  
     // print results
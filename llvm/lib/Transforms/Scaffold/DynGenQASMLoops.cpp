@@ -18,6 +18,7 @@
 #include "llvm/Analysis/CallGraph.h"
 #include "llvm/Support/InstIterator.h"
 #include "llvm/Support/CFG.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/ilist.h"
@@ -54,6 +55,12 @@ using namespace std;
 
 bool debugDynGenQASMLoops = false;
 
+// Print Rz gates through qasm_print_rot_ct (scripts/rotation-runtime.cpp),
+// which decomposes angles only known at run time into Clifford+T gates
+static cl::opt<bool>
+DYN_ROTATIONS("dyn-rotations", cl::init(false), cl::Hidden,
+    cl::desc("Decompose Rz gates into Clifford+T at run time"));
+
 namespace {
 
   struct qGateArg{ //arguments to qgate calls
@@ -120,6 +127,7 @@ namespace {
     Function* qasmGate2;
     Function* qasmGate3;
     Function* qasmRot;
+    Function* qasmRotCT;
     Function* qasmCallInstIntArg;
     Function* qasmCallInstDoubleArg;
 
@@ -605,7 +613,10 @@ void DynGenQASMLoops::instrumentIntrinsicInst(CallInst* CI, int id, map<unsigned
       Value* qbitArg1 = CI->getArgOperand(1); //double or const double
       call_args.push_back(qbitArg1);      
 
-      CallInst::Create(qasmRot,call_args,"",CI);            
+      if(DYN_ROTATIONS && id==_Rz)
+	CallInst::Create(qasmRotCT,call_args,"",CI);
+      else
+	CallInst::Create(qasmRot,call_args,"",CI);            
       break;    
     }
 
@@ -1330,6 +1341,8 @@ bool DynGenQASMLoops::runOnModule(Module &M) {
       qasmGate3 = cast<Function>(M.getOrInsertFunction("qasm_print_qgate3", Type::getVoidTy(M.getContext()), Type::getInt32Ty(M.getContext()), Type::getInt8Ty(M.getContext())->getPointerTo(),Type::getInt8Ty(M.getContext())->getPointerTo(),Type::getInt8Ty(M.getContext())->getPointerTo(),  Type::getInt16Ty(M.getContext()), Type::getInt16Ty(M.getContext()), Type::getInt16Ty(M.getContext()),  (Type*)0));
 
       qasmRot = cast<Function>(M.getOrInsertFunction("qasm_print_rot", Type::getVoidTy(M.getContext()), Type::getInt32Ty(M.getContext()),  Type::getInt8Ty(M.getContext())->getPointerTo(), Type::getInt16Ty(M.getContext()), Type::getDoubleTy(M.getContext()),(Type*)0));
+
+      qasmRotCT = cast<Function>(M.getOrInsertFunction("qasm_print_rot_ct", Type::getVoidTy(M.getContext()), Type::getInt32Ty(M.getContext()),  Type::getInt8Ty(M.getContext())->getPointerTo(), Type::getInt16Ty(M.getContext()), Type::getDoubleTy(M.getContext()),(Type*)0));
       
       qasmCallInstIntArg = cast<Function>(M.getOrInsertFunction("qasm_print_call_int_arg", Type::getVoidTy(M.getContext()), Type::getInt32Ty(M.getContext()),(Type*)0));
 
@@ -8,14 +8,32 @@
 // Coarse-grained scheduling for non-leaf modules
 // Get T gate proportion within schedule length
 // Cleaned up the code
+// Leaf modules can be scheduled on several threads (-lpfs-threads)
+// Several (k, d) configurations can share one dependency graph (-lpfs-sweep)
+// RCP, ALAP and ACAP policies from scripts/sched.pl (-lpfs-policy)
+// Leaf metrics are handed to GenCGSIMDSchedule in memory (LeafSchedule.h)
+// Full schedules can also be written in a binary format (-lpfs-bin)
+// Leaf schedules can be kept across runs, keyed by a hash of the body (-lpfs-cache)
 //===----------------------------------------------------------------------===//
 
 #include <vector>
 #include <iostream> 
 #include <limits>
 #include <map>
+#include <set>
+#include <queue>
+#include <functional>
 #include <string>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "llvm/Pass.h"
 #include "llvm/Function.h"
 #include "llvm/Module.h"
@@ -34,6 +52,12 @@
 #include "llvm/Constants.h"
 #include "llvm/IntrinsicInst.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Assembly/Writer.h"
+#include "LeafSchedule.h"
+#include "HashStream.h"
+#include "LeafPool.h"
 //#include "llvm/ScheduleDAG.h"
 
 //#define _DEBUG_LPFS // Optional: debug flag
@@ -89,6 +113,53 @@ static cl::opt<unsigned>
 LOCAL_MOVES_SCHED("local_moves_sched", cl::init(0), cl::Hidden,
     cl::desc("Print Schedule of Local Move Instructions"));
 
+enum LPFSPolicy { POLICY_LPFS, POLICY_RCP, POLICY_ALAP, POLICY_ACAP };
+
+static cl::opt<LPFSPolicy>
+LPFS_POLICY("lpfs-policy", cl::init(POLICY_LPFS), cl::Hidden,
+    cl::desc("Scheduling policy for leaf modules"),
+    cl::values(clEnumValN(POLICY_LPFS, "lpfs", "longest path first (default)"),
+               clEnumValN(POLICY_RCP, "rcp", "ready list, region to the highest weighted gate type"),
+               clEnumValN(POLICY_ALAP, "alap", "as late as possible, then as the k regions allow"),
+               clEnumValN(POLICY_ACAP, "acap", "as centered as possible, then as the k regions allow"),
+               clEnumValEnd));
+
+static cl::opt<int>
+RCP_W_OP("rcp_w_op", cl::init(1), cl::Hidden,
+    cl::desc("rcp weight of each ready op"));
+
+static cl::opt<int>
+RCP_W_DIST("rcp_w_dist", cl::init(-1), cl::Hidden,
+    cl::desc("rcp weight of an op whose qubits are all in the region"));
+
+static cl::opt<int>
+RCP_W_SLACK("rcp_w_slack", cl::init(1), cl::Hidden,
+    cl::desc("rcp weight of each timestep of slack of an op"));
+
+static cl::opt<std::string>
+LPFS_SWEEP("lpfs-sweep", cl::init(""), cl::Hidden,
+    cl::desc("Schedule for each k:d in this comma separated list, e.g. 2:1024,4:1024"));
+
+static cl::opt<std::string>
+LPFS_OUT("lpfs-out", cl::init(""), cl::Hidden,
+    cl::desc("Write the schedules to this file instead of stderr"));
+
+static cl::opt<std::string>
+LPFS_BIN("lpfs-bin", cl::init(""), cl::Hidden,
+    cl::desc("Also write the full leaf schedules to this file in binary, %k and %d are replaced by k and d"));
+
+static cl::opt<std::string>
+LPFS_CACHE("lpfs-cache", cl::init(""), cl::Hidden,
+    cl::desc("Reuse the leaf schedules kept in this file and add the new ones to it"));
+
+static cl::opt<unsigned>
+LPFS_CACHE_MB("lpfs-cache-mb", cl::init(256), cl::Hidden,
+    cl::desc("Keep at most this many MB in -lpfs-cache, dropping the least recently used leaves (0: no limit)"));
+
+static cl::opt<unsigned>
+LPFS_THREADS("lpfs-threads", cl::init(1), cl::Hidden,
+    cl::desc("Threads scheduling leaf modules (0: one per core)"));
+
 
 
 #define MAX_RES_CONSTRAINT 2000 
@@ -119,7 +190,7 @@ LOCAL_MOVES_SCHED("local_moves_sched", cl::init(0), cl::Hidden,
 
 namespace {
 
-  typedef pair<Instruction*, uint64_t> InstPri; //instpriority
+  typedef pair<int, uint64_t> InstPri; //op index, priority
 
   struct CompareInstPriByValue {
     bool operator() (const InstPri& a, const InstPri& b) const {
@@ -213,6 +284,59 @@ namespace {
     uint64_t numGates[MAX_RES_CONSTRAINT];
   };
 
+  // A leaf module scheduled ahead of the call graph walk by a worker thread
+  struct LeafJob{
+    Function* F;
+    bool isLeaf;
+    vector<string> out; //everything printed while scheduling F, per (k, d)
+    vector<string> bin; //its binary schedule (-lpfs-bin), per (k, d)
+    vector<LeafMetrics> metrics; //and its metrics, per (k, d)
+    LeafJob(Function* f):F(f),isLeaf(false),out(),bin(),metrics() { }
+  };
+
+  // What scheduling a leaf for one (k, d) produced, less its header
+  struct CachedLeaf{
+    LeafMetrics metrics;
+    string text; //printed after the "Function:" header
+    string bin;  //binary schedule block, if -lpfs-bin was given
+  };
+
+  // Leaf schedules of -lpfs-cache, shared by the scheduling threads
+  struct LeafCache{
+    map<string, CachedLeaf> entries;
+    map<string, unsigned> used; //keys found or added by this run, with the tick of their last use
+    unsigned ticks;
+    pthread_mutex_t lock;
+    unsigned hits;
+    unsigned misses;
+
+    LeafCache(): ticks(0), hits(0), misses(0) { pthread_mutex_init(&lock, NULL); }
+    ~LeafCache() { pthread_mutex_destroy(&lock); }
+
+    bool find(const string& key, CachedLeaf& leaf){
+      pthread_mutex_lock(&lock);
+      map<string, CachedLeaf>::iterator it = entries.find(key);
+      bool found = (it != entries.end());
+      if(found){
+        leaf = (*it).second;
+        used[key] = ++ticks;
+      }
+      found ? hits++ : misses++;
+      pthread_mutex_unlock(&lock);
+      return found;
+    }
+
+    void insert(const string& key, const CachedLeaf& leaf){
+      pthread_mutex_lock(&lock);
+      entries[key] = leaf;
+      used[key] = ++ticks;
+      pthread_mutex_unlock(&lock);
+    }
+
+    bool load(const string& path);
+    bool save(const string& path, uint64_t maxBytes);
+  };
+
   struct GenLPFSSched : public ModulePass {
     static char ID; // Pass identification
 
@@ -240,17 +364,51 @@ namespace {
     map<Instruction*, qGate> mapInstSet;
     vector<InstPri> priorityVector;
 
-    map<Instruction*, op> mapCalls; //map between the instruction label and the operation attributes of each inst
-    vector<Instruction*> longPath;      //longest path to be returned by find_lp
     vector<Instruction*> callList;  
-    map<int, multimap<int, op> > schedule; //all the instructions in a given simd region
+
+    // Per-operation scheduling state of the current function, in dense arrays
+    // indexed by the position of the operation in callList
+    DenseMap<Instruction*, int> opIndex;
+    vector<Function*> opFunc;       //gate or function called, NULL if not a quantum op
+    vector<unsigned> opArgStart;    //args of op n: opArgs[opArgStart[n] .. +opNumArgs[n]]
+    vector<int> opNumArgs;
+    vector<qArgInfo> opArgs;
+    vector<int> opId;
+    vector<int> opTs;
+    vector<int> opDist;
+    vector<int> opSimd;
+    vector<int> opPath;
+    vector<char> opFollowed;
+    vector<unsigned> inStart;       //CSR dependency edges: in_edges of op n are
+    vector<int> inEdges;            //inEdges[inStart[n] .. inStart[n+1]], same for out
+    vector<unsigned> outStart;
+    vector<int> outEdges;
+    int lastByAddr;                 //op with the highest Instruction* (see find_lp)
+    vector<int> opArgQbit;          //interned qubit of each entry of opArgs
+    vector<int> opAsap;             //unconstrained as soon/late/centered as
+    vector<int> opAlap;             //possible timesteps
+    vector<int> opAcap;
+    vector<char> dagFollowed;       //opFollowed and qubitMap as build_dag left them
+    map<string, qArgInfo> dagQubits;
+
+    unsigned simdK; //k and d of the schedule being generated
+    unsigned simdD;
+    vector<pair<unsigned, unsigned> > sweep; //(k, d) of each schedule to generate
+
+    // Occupancy of each simd region: regionBusy[simd] has bit ts set when an
+    // op runs at ts, regionFirst[simd][ts] is the first op scheduled there
+    vector<vector<uint64_t> > regionBusy;
+    vector<vector<int> > regionFirst;
+
+    vector<int> longPath;      //longest path to be returned by find_lp
+    map<int, multimap<int, int> > schedule; //all the ops (indices) in a given simd region
     int ots; //operating time steps
     int simds;
     int tgates_cnt; //tgates
     multimap<int, move> move_schedule; //all the instructions in a given simd region
     multimap<int, move> local_move_schedule; //all the instructions in a given simd region
     int mts; //move time steps
-    map<int, vector<Instruction*> > longestPathList; //all the instructions in a given simd region
+    map<int, vector<int> > longestPathList; //all the instructions in a given simd region
 
     vector<qArgInfo> active_qubits;
     map<string, qArgInfo> qubitMap;
@@ -263,7 +421,12 @@ namespace {
 
     bool isFirstMeas;
 
-    GenLPFSSched() : ModulePass(ID) {}
+    raw_ostream* outStream; //where schedules are printed, errs() if NULL
+    LeafCache* cache; //-lpfs-cache, NULL if not used
+
+    GenLPFSSched() : ModulePass(ID), simdK(0), simdD(0), outStream(NULL), cache(NULL) {}
+
+    raw_ostream& out() { return outStream ? *outStream : errs(); }
 
     // Get arguments from operation
     bool backtraceOperand(Value* opd, int opOrIndex);
@@ -281,10 +444,17 @@ namespace {
     bool checkIfIntrinsic(Function* CF);
 
     void find_lp(Function* F, int pathNum);
+    void build_dag(Function* F, int simd_l);
     void lpfs(Function* F, int ts, int simd_l, int refill, int opp_simd);
-    void take_path(Instruction* CI, int path);
-    void sched_op(Instruction* currentOp, int timeStep, int simd);
-    bool depsMet(Instruction* currentOp, int currentTime);
+    void rcp(Function* F);
+    void target_sched(Function* F, const vector<int>& target);
+    void restore_dag();
+    void take_path(int n, int path);
+    void sched_op(int n, int timeStep, int simd);
+    int ready_time(int n);
+    int first_free(int simd, int timeStep);
+    void init_op_state();
+    void clear_op_state();
     void update_moves(int moves, int ts );
 
 
@@ -297,6 +467,9 @@ namespace {
     void print_priorityVector();
     void print_longPath();
     void print_schedule(Function* F, int op_count);
+    bool write_bin_schedule(Function* F, int op_count, string& buf);
+    string op_name(int n);
+    string leaf_key(Function* F);
     void print_moves_schedule(Function* F, int op_count);
     void print_local_moves_schedule(Function* F, int op_count);
     void print_schedule_metrics(Function* F, int op_count);
@@ -364,9 +537,9 @@ namespace {
 
     void print_qgateArg(qGateArg qg)
     {
-      errs()<< "Printing QGate Argument:\n";
-      if(qg.argPtr) errs() << "  Name: "<<qg.argPtr->getName()<<"\n";
-      errs() << "  Arg Num: "<<qg.argNum<<"\n"
+      out()<< "Printing QGate Argument:\n";
+      if(qg.argPtr) out() << "  Name: "<<qg.argPtr->getName()<<"\n";
+      out() << "  Arg Num: "<<qg.argNum<<"\n"
         << "  isUndef: "<<qg.isUndef
         << "  isQbit: "<<qg.isQbit
         << "  isCbit: "<<qg.isCbit
@@ -384,14 +557,209 @@ namespace {
 
     void CountCriticalFunctionResources (Function *F);
 
+    void schedule_function(Function *F, vector<string>& outs, vector<string>& bins, vector<LeafMetrics>& metrics);
+    void get_leaf_metrics(LeafMetrics& m);
+    GenLPFSSched* new_leaf_worker();
+    void run_leaf(LeafJob& job);
+
     bool runOnModule (Module &M);    
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesAll();  
       AU.addRequired<CallGraph>();
+      AU.addRequired<LeafScheduleInfo>();
     }
 
   }; // End of struct GenLPFSSched
+
+  // -lpfs-bin file of the schedules for k and d
+  string binPath(const string& pattern, unsigned k, unsigned d){
+    string path;
+    for(unsigned i = 0; i < pattern.size(); i++){
+      if(pattern[i] == '%' && i+1 < pattern.size() && (pattern[i+1] == 'k' || pattern[i+1] == 'd')){
+        stringstream ss;
+        ss << (pattern[++i] == 'k' ? k : d);
+        path += ss.str();
+      }
+      else
+        path += pattern[i];
+    }
+    return path;
+  }
+
+  // Binary schedule block (see write_bin_schedule) with its module name
+  // replaced, the columns are padded again for the new name length
+  string renameBinBlock(const string& block, const string& name){
+    if(block.empty())
+      return block;
+    uint32_t header[6];
+    uint64_t numOps;
+    memcpy(header, block.data(), sizeof(header));
+    memcpy(&numOps, block.data() + sizeof(header), sizeof(numOps));
+    size_t tables = 32 + header[0];
+    if(block.compare(32, header[0], name) == 0)
+      return block;
+    size_t p = tables;
+    for(uint32_t i = 0; i < header[3] + header[4]; i++){
+      uint32_t len;
+      memcpy(&len, block.data() + p, sizeof(len));
+      p += sizeof(len) + len;
+    }
+    size_t columns = (p + 3) & ~(size_t) 3;
+
+    string renamed = block.substr(0, 32);
+    header[0] = name.size();
+    memcpy(&renamed[0], header, sizeof(uint32_t));
+    renamed += name;
+    renamed.append(block, tables, p - tables);
+    renamed.append((4 - renamed.size() % 4) % 4, '\0');
+    renamed.append(block, columns, numOps * 14);
+    renamed.append((8 - renamed.size() % 8) % 8, '\0');
+    return renamed;
+  }
+
+  // -lpfs-cache file: "LPFSCACHE2" then, for each entry, its key, the
+  // LeafMetrics fields, mlist, text and bin, sizes as uint64 before each
+  // string and list. Caches of version 1 hold version 1 binary blocks and
+  // are dropped.
+  void putU64(string& buf, uint64_t v){
+    buf.append((const char*) &v, sizeof(v));
+  }
+
+  void putString(string& buf, const string& str){
+    putU64(buf, str.size());
+    buf += str;
+  }
+
+  bool getU64(const string& buf, size_t& pos, uint64_t& v){
+    if(buf.size() - pos < sizeof(v))
+      return false;
+    memcpy(&v, buf.data() + pos, sizeof(v));
+    pos += sizeof(v);
+    return true;
+  }
+
+  bool getString(const string& buf, size_t& pos, string& str){
+    uint64_t len;
+    if(!getU64(buf, pos, len) || buf.size() - pos < len)
+      return false;
+    str.assign(buf, pos, len);
+    pos += len;
+    return true;
+  }
+
+  // Entries of a -lpfs-cache file, and their keys in file order; false if
+  // path is not a cache
+  bool readLeafCache(const string& path, map<string, CachedLeaf>& entries, vector<string>& order){
+    ifstream in(path.c_str(), ios::in | ios::binary);
+    if(!in)
+      return true; //nothing kept yet
+    stringstream ss;
+    ss << in.rdbuf();
+    string buf = ss.str();
+    if(buf.compare(0, 10, "LPFSCACHE1") == 0)
+      return true;
+    if(buf.compare(0, 10, "LPFSCACHE2") != 0)
+      return false;
+    size_t pos = 10;
+    while(pos < buf.size()){
+      string key;
+      CachedLeaf leaf;
+      LeafMetrics& m = leaf.metrics;
+      uint64_t listSize;
+      if(!getString(buf, pos, key) || !getU64(buf, pos, m.width) || !getU64(buf, pos, m.ots)
+         || !getU64(buf, pos, m.mts) || !getU64(buf, pos, m.moves) || !getU64(buf, pos, m.tgates)
+         || !getU64(buf, pos, listSize) || (buf.size() - pos) / sizeof(uint64_t) < listSize)
+        return false;
+      m.mlist.resize(listSize);
+      for(uint64_t i = 0; i < listSize; i++)
+        getU64(buf, pos, m.mlist[i]);
+      if(!getString(buf, pos, leaf.text) || !getString(buf, pos, leaf.bin))
+        return false;
+      if(entries.insert(make_pair(key, leaf)).second)
+        order.push_back(key);
+    }
+    return true;
+  }
+
+  void putLeaf(string& buf, const string& key, const CachedLeaf& leaf){
+    const LeafMetrics& m = leaf.metrics;
+    putString(buf, key);
+    putU64(buf, m.width);
+    putU64(buf, m.ots);
+    putU64(buf, m.mts);
+    putU64(buf, m.moves);
+    putU64(buf, m.tgates);
+    putU64(buf, m.mlist.size());
+    for(unsigned i = 0; i < m.mlist.size(); i++)
+      putU64(buf, m.mlist[i]);
+    putString(buf, leaf.text);
+    putString(buf, leaf.bin);
+  }
+
+  bool LeafCache::load(const string& path){
+    vector<string> order;
+    return readLeafCache(path, entries, order);
+  }
+
+  // Runs sharing path take turns under an flock of path.lock: the entries
+  // this run used go first, last used first, then those on disk (other runs may have added
+  // some since load) in their order, so the file is kept most recently used
+  // first and what does not fit in maxBytes is dropped. It is written to a
+  // temporary file of this run and renamed over path, so readers never see
+  // half a file.
+  bool LeafCache::save(const string& path, uint64_t maxBytes){
+    string lockPath = path + ".lock";
+    int lockFd = open(lockPath.c_str(), O_RDWR | O_CREAT, 0664);
+    if(lockFd < 0)
+      return false;
+    flock(lockFd, LOCK_EX);
+
+    map<string, CachedLeaf> disk;
+    vector<string> diskOrder;
+    if(!readLeafCache(path, disk, diskOrder))
+      diskOrder.clear(); //unreadable, replaced
+
+    string tmpPath = path + ".XXXXXX";
+    int fd = mkstemp(&tmpPath[0]);
+    bool ok = (fd >= 0);
+    if(ok){
+      fchmod(fd, 0664);
+      raw_fd_ostream file(fd, true);
+      file << "LPFSCACHE2";
+      uint64_t size = 10;
+      vector<pair<unsigned, const string*> > byUse;
+      for(map<string, unsigned>::iterator it = used.begin(); it != used.end(); ++it)
+        byUse.push_back(make_pair((*it).second, &(*it).first));
+      sort(byUse.begin(), byUse.end(), greater<pair<unsigned, const string*> >());
+      vector<pair<const string*, const CachedLeaf*> > keep;
+      for(unsigned i = 0; i < byUse.size(); i++)
+        keep.push_back(make_pair(byUse[i].second, &entries[*byUse[i].second]));
+      for(vector<string>::iterator it = diskOrder.begin(); it != diskOrder.end(); ++it)
+        if(!used.count(*it))
+          keep.push_back(make_pair(&*it, &disk[*it]));
+      for(unsigned i = 0; i < keep.size(); i++){
+        string buf;
+        putLeaf(buf, *keep[i].first, *keep[i].second);
+        if(maxBytes && size + buf.size() > maxBytes)
+          break;
+        file << buf;
+        size += buf.size();
+      }
+      file.close();
+      if(file.has_error()){
+        file.clear_error();
+        ok = false;
+      }
+      ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+      if(!ok)
+        unlink(tmpPath.c_str());
+    }
+
+    flock(lockFd, LOCK_UN);
+    close(lockFd);
+    return ok;
+  }
 } // End of anonymous namespace
 
 
@@ -399,72 +767,120 @@ namespace {
 char GenLPFSSched::ID = 0;
 static RegisterPass<GenLPFSSched> X("GenLPFSSchedule", "Generate LPFS Schedule");
 
+char LeafScheduleInfo::ID = 0;
+static RegisterPass<LeafScheduleInfo> Y("leaf-schedule-info", "Leaf module schedules for coarse-grained scheduling", false, true);
+
 //LPFS: Longest Path First Scheduling
 
 vector<Instruction*> longestPathList;
 
-void GenLPFSSched::lpfs(Function* F, int ts, int simd_l, int refill_simd, int opp_simd){
+// Dependency graph and longest paths of F; they do not depend on k or d,
+// so with -lpfs-sweep they are found once and scheduled for each (k, d)
+void GenLPFSSched::build_dag(Function* F, int simd_l){
   //----------------Build Dependency Tree--------------------//
-  int op_count = priorityVector.size();
-  int sched_ops = 0;
-  int moves = 0;
   int id_to_apply = 0;
   int qbit_id = 0;
 
   //Building Dependency Graph  
-  int counter = 0;
-  for(vector<Instruction*>::iterator fp1 = callList.begin(); fp1 != callList.end(); ++fp1){
-    counter++;
+  //Qubits are interned to dense ids, then a reverse sweep records for every
+  //argument the next operation using the same qubit. Edges are then added
+  //in program order, the same order a forward scan from each op would give.
+  int numOps = callList.size();
+  vector<int>& argQbit = opArgQbit;
+  argQbit.assign(opArgs.size(), -1);
+  map<pair<string,int>, int> qbitIntern;
+  for(int n = 0; n < numOps; ++n){
+    for(int i=0; i < opNumArgs[n]; ++i) {
+      qArgInfo& arg = opArgs[opArgStart[n] + i];
+      pair<string,int> key(arg.name, arg.index);
+      map<pair<string,int>, int>::iterator qi = qbitIntern.find(key);
+      if(qi == qbitIntern.end())
+        qi = qbitIntern.insert(make_pair(key, (int)qbitIntern.size())).first;
+      argQbit[opArgStart[n] + i] = (*qi).second;
+    }
+  }
+
+  vector<int> nextUser(qbitIntern.size(), -1); //next op using each qubit
+  vector<int> argNext(opArgs.size(), -1);
+  for(int n = numOps - 1; n >= 0; --n){
+    for(int i=0; i < opNumArgs[n]; ++i)
+      argNext[opArgStart[n] + i] = nextUser[argQbit[opArgStart[n] + i]];
+    for(int i=0; i < opNumArgs[n]; ++i)
+      nextUser[argQbit[opArgStart[n] + i]] = n;
+  }
+
+  vector<pair<int,int> > edges; //(from, to) in the order they are found
+  for(int n = 0; n < numOps; ++n){
 #ifdef _DEBUG_LPFS
-    if (counter % 1000 == 0)
-      errs() << "Got up to instruction " << counter << "\n";
+    if ((n+1) % 1000 == 0)
+      out() << "Got up to instruction " << n+1 << "\n";
 #endif
-    bool found_one = false;
-    map<Instruction*, op>::iterator mp1 = mapCalls.find(*fp1);
-    (*mp1).second.id = id_to_apply++;
-    for(int i=0; i < (*mp1).second.name.numArgs; ++i) {
-      vector<Instruction*>::iterator fp2 = fp1;
-      if((*mp1).second.name.args[i].id == -1) {
-        (*mp1).second.name.args[i].id = qbit_id++;
-        qArgInfo arg = (*mp1).second.name.args[i];
+    opId[n] = id_to_apply++;
+    for(int i=0; i < opNumArgs[n]; ++i) {
+      qArgInfo& arg = opArgs[opArgStart[n] + i];
+      if(arg.id == -1) {
+        arg.id = qbit_id++;
         stringstream ss;
         ss << arg.index;
         string name = arg.name + ss.str();
         qubitMap.insert(make_pair(name, arg));
       }
-      if(fp1 != callList.end()) ++fp2;
-      int counter2 = 0;
-      while(fp2 != callList.end()){
-        counter2++;  
-        map<Instruction*, op>::iterator mp2 = mapCalls.find(*fp2);
-        found_one = false;
-        for(int j = 0; j < (*mp2).second.name.numArgs; ++j){
-          if((*mp1).second.name.args[i].id == -1) {
-            (*mp1).second.name.args[i].id = qbit_id++;
-            qArgInfo arg = (*mp1).second.name.args[i];
-            stringstream ss;
-            ss << arg.index;
-            string name = arg.name + ss.str();
-            qubitMap.insert(make_pair(name, arg));
-          }
-          if((*mp1).second.name.args[i] == (*mp2).second.name.args[j]){
-            string zz = (*mp1).second.name.args[i].name;             
-            (*mp1).second.out_edges.push_back((*mp2).first);
-            (*mp2).second.in_edges.push_back((*mp1).first);
-            found_one = true;
-          }
-        }
-        if(found_one){ 
-          break;
-        }
-        ++fp2;
-      }
+      int next = argNext[opArgStart[n] + i];
+      if(next == -1)
+        continue;
+      int q = argQbit[opArgStart[n] + i];
+      for(int j = 0; j < opNumArgs[next]; ++j)
+        if(argQbit[opArgStart[next] + j] == q)
+          edges.push_back(make_pair(n, next));
     }
   }
+
+  //CSR edge lists; a stable counting sort keeps every op's in_edges in the
+  //order they were found
+  outStart.assign(numOps + 1, 0);
+  inStart.assign(numOps + 1, 0);
+  for(unsigned e = 0; e < edges.size(); ++e){
+    outStart[edges[e].first + 1]++;
+    inStart[edges[e].second + 1]++;
+  }
+  for(int n = 0; n < numOps; ++n){
+    outStart[n + 1] += outStart[n];
+    inStart[n + 1] += inStart[n];
+  }
+  outEdges.resize(edges.size());
+  inEdges.resize(edges.size());
+  vector<unsigned> outFill(outStart.begin(), outStart.end() - 1);
+  vector<unsigned> inFill(inStart.begin(), inStart.end() - 1);
+  for(unsigned e = 0; e < edges.size(); ++e){
+    outEdges[outFill[edges[e].first]++] = edges[e].second;
+    inEdges[inFill[edges[e].second]++] = edges[e].first;
+  }
 #ifdef _DEBUG_LPFS
-  errs() << "Finished Building Dependency Graph" << "\n";
+  out() << "Finished Building Dependency Graph" << "\n";
 #endif
 
+  //----Unconstrained ASAP, ALAP and ACAP timesteps (as in sched.pl)----//
+  //ACAP keeps the second half of the ASAP schedule and packs the ops of
+  //the first half against it, as late as their children allow
+  opAsap.assign(numOps, 0);
+  int length = 0;
+  for(int n = 0; n < numOps; ++n){
+    for(unsigned e = inStart[n]; e < inStart[n + 1]; e++)
+      opAsap[n] = max(opAsap[n], opAsap[inEdges[e]] + 1);
+    length = max(length, opAsap[n] + 1);
+  }
+  int mid = length >> 1;
+  opAlap.assign(numOps, length - 1);
+  opAcap.assign(numOps, length - 1);
+  for(int n = numOps - 1; n >= 0; --n){
+    for(unsigned e = outStart[n]; e < outStart[n + 1]; e++){
+      opAlap[n] = min(opAlap[n], opAlap[outEdges[e]] - 1);
+      opAcap[n] = min(opAcap[n], opAcap[outEdges[e]] - 1);
+    }
+    if(opAsap[n] >= mid)
+      opAcap[n] = opAsap[n];
+  }
+
   //-----Find the longest paths required for the simd_l constraint-----//
   longestPathList.clear();
   for(int i = 1; i <= simd_l; i++){
@@ -473,85 +889,82 @@ void GenLPFSSched::lpfs(Function* F, int ts, int simd_l, int refill_simd, int op
     longPath.clear();
   } 
 #ifdef _DEBUG_LPFS
-  errs() << "Finished Finding Longest Path(s)" << "\n";    
+  out() << "Finished Finding Longest Path(s)" << "\n";    
 #endif
+  dagFollowed = opFollowed;
+  dagQubits = qubitMap;
+}
+
+void GenLPFSSched::lpfs(Function* F, int ts, int simd_l, int refill_simd, int opp_simd){
+  int op_count = priorityVector.size();
+  int sched_ops = 0;
+  int moves = 0;
+
+  restore_dag();
 
   //-------Assign the longest paths-------//
-  for(map<int, vector<Instruction*> >::iterator pathNumber = longestPathList.begin(); pathNumber != longestPathList.end(); pathNumber++){
-    for(vector<Instruction*>::reverse_iterator inst = (*pathNumber).second.rbegin(); inst != (*pathNumber).second.rend(); inst++){
-      Instruction* myInst = (*inst);
-      if(((*mapCalls.find(myInst)).second.simd) == -1)
-        sched_op(myInst, ts++, (*pathNumber).first);
+  for(map<int, vector<int> >::iterator pathNumber = longestPathList.begin(); pathNumber != longestPathList.end(); pathNumber++){
+    for(vector<int>::reverse_iterator inst = (*pathNumber).second.rbegin(); inst != (*pathNumber).second.rend(); inst++){
+      int n = (*inst);
+      if(opSimd[n] == -1)
+        sched_op(n, ts++, (*pathNumber).first);
       sched_ops++;
     }   
   }
   ts = 0;
 
+  //Ops are taken in priority order. An op starts at the first timestep
+  //after all its parents have finished; with opp_simd it joins a region
+  //already running the same gate then, or else goes to the region that
+  //frees up first.
   while(sched_ops < op_count){ 
 #ifdef _DEBUG_LPFS    
-    errs() << "sched op = " << sched_ops << " op count = " << op_count << "\n";
+    out() << "sched op = " << sched_ops << " op count = " << op_count << "\n";
 #endif
     for(vector<InstPri>::reverse_iterator vit = priorityVector.rbegin(); vit!=priorityVector.rend(); ++vit){
-      Instruction* myInst = (*vit).first;
-      op myOp = (*mapCalls.find(myInst)).second;
-      bool scheduled = false;
-      //#ifdef _DEBUG_LPFS      
-      //      errs() << "scheduling op " << myOp.name.qFunc->getName() << " containing " << myOp.name.numArgs << " args\n";
-      //      errs() << "ts = " << ts << " Checking op: " << myOp.id << " ";
-      //      print_qgate(myOp.name);      
-      //#endif
-      while((*mapCalls.find(myInst)).second.simd == -1) {
-        int simdToSched = 1;
-        if(depsMet(myInst, ts)) {
-          if(opp_simd == 1) {
-            while(simdToSched <= (int) RES_CONSTRAINT) { 
-              map<int, multimap<int, op> >::iterator it = schedule.find(simdToSched);
-              if(!(it == schedule.end())) {
-                multimap<int, op> map = (*it).second;
-                multimap<int, op>::iterator mit = map.find(ts);
-                if(mit != map.end()) {
-                  op curOp = (*mit).second;
-                  /*------Add Data Constraint---*/        
-                  if(myOp.name.qFunc == curOp.name.qFunc){
-                    sched_op(myInst, ts, simdToSched);
-                    scheduled = true;
-                    sched_ops++;
-                    break;
-                  }
-                }
-              }
-              simdToSched++;
-            }
-            if(!scheduled){
-              int lowTS = std::numeric_limits<int>::max();
-              int lowSD = 0;
-              for(simdToSched = (int) RES_CONSTRAINT; simdToSched > 0; simdToSched--){
-                int tempTS = ts;
-                while(schedule[simdToSched].count(tempTS)) {
-                  tempTS++;
-                }
-                if(tempTS <= lowTS){
-                  lowTS = tempTS;
-                  lowSD = simdToSched;
-                }
-              }
-              sched_op(myInst, lowTS, lowSD);
+      int n = (*vit).first;
+      if(opSimd[n] != -1)
+        continue;
+      ts = ready_time(n);
+      if(ts == -1)
+        continue; //a parent is still unscheduled, retry on the next pass
+      int simdToSched = 1;
+      if(opp_simd == 1) {
+        bool scheduled = false;
+        while(simdToSched <= (int) simdK) { 
+          if(simdToSched < (int) regionFirst.size() && ts < (int) regionFirst[simdToSched].size()) {
+            int first = regionFirst[simdToSched][ts];
+            /*------Add Data Constraint---*/        
+            if(first != -1 && opFunc[n] == opFunc[first]){
+              sched_op(n, ts, simdToSched);
               scheduled = true;
-              sched_ops++;  
+              sched_ops++;
+              break;
             }
           }
-          else{
-            //while(!schedule[simdToSched].count(ts)) ts++; // FIXME: bug, causes infinite loop.
-            sched_op(myInst, ts, simdToSched);
-            scheduled = true;
-            sched_ops++;
-            break;
+          simdToSched++;
+        }
+        if(!scheduled){
+          int lowTS = std::numeric_limits<int>::max();
+          int lowSD = 0;
+          for(simdToSched = (int) simdK; simdToSched > 0; simdToSched--){
+            int tempTS = first_free(simdToSched, ts);
+            if(tempTS <= lowTS){
+              lowTS = tempTS;
+              lowSD = simdToSched;
+            }
           }
+          sched_op(n, lowTS, lowSD);
+          sched_ops++;  
         }
-        ts++;
       }
-      ts = 0;
+      else{
+        //while(!schedule[simdToSched].count(ts)) ts++; // FIXME: bug, causes infinite loop.
+        sched_op(n, ts, simdToSched);
+        sched_ops++;
+      }
     }
+    ts = 0;
   }
   while(schedule[1].count(ts)){
     update_moves(moves, ts++);   
@@ -559,6 +972,181 @@ void GenLPFSSched::lpfs(Function* F, int ts, int simd_l, int refill_simd, int op
   ots = ts;  
 }
 
+// Start a schedule from the state left by build_dag
+void GenLPFSSched::restore_dag(){
+  opTs.assign(callList.size(), -1);
+  opSimd.assign(callList.size(), -1);
+  opFollowed = dagFollowed;
+  qubitMap = dagQubits;
+  regionBusy.clear();
+  regionFirst.clear();
+}
+
+//RCP: Ready Critical Path scheduling (new_rcp and rcp in scripts/sched.pl)
+//
+//Every timestep, each free simd region in turn goes to the gate type with the
+//highest total weight among the ready ops, where an op weighs
+//  w_op + w_slack * slack + w_dist * (all its qubits are in the region)
+//and takes ready ops of that type, least slack first, up to d qubits. Moves
+//are updated every timestep so the qubit locations are current.
+void GenLPFSSched::rcp(Function* F){
+  int numOps = callList.size();
+  restore_dag();
+
+  //qubitMap entry of each op argument, for the qubit locations
+  vector<qArgInfo*> argInfo(opArgs.size(), (qArgInfo*) NULL);
+  for(unsigned a = 0; a < opArgs.size(); a++){
+    stringstream ss;
+    ss << opArgs[a].index;
+    argInfo[a] = &(*qubitMap.find(opArgs[a].name + ss.str())).second;
+  }
+
+  vector<int> pending(numOps); //unscheduled parents of each op
+  vector<int> ready;
+  for(int n = 0; n < numOps; n++){
+    pending[n] = inStart[n + 1] - inStart[n];
+    if(pending[n] == 0)
+      ready.push_back(n);
+  }
+
+  int ts = 0;
+  int sched_ops = 0;
+  vector<int> home(numOps, 0);       //region holding all qubits of a ready op, 0 if none
+  vector<int> done;
+  while(sched_ops < numOps){
+    //least slack first, then in program order
+    vector<pair<int, int> > order;
+    for(unsigned i = 0; i < ready.size(); i++)
+      order.push_back(make_pair(opAlap[ready[i]] - opAsap[ready[i]], ready[i]));
+    sort(order.begin(), order.end());
+    for(unsigned i = 0; i < order.size(); i++)
+      ready[i] = order[i].second;
+
+    for(unsigned i = 0; i < ready.size(); i++){
+      int n = ready[i];
+      home[n] = opNumArgs[n] ? argInfo[opArgStart[n]]->loc : 0;
+      for(int j = 1; j < opNumArgs[n]; j++)
+        if(argInfo[opArgStart[n] + j]->loc != home[n])
+          home[n] = 0;
+    }
+
+    vector<char> regionFree(simdK + 1, 1);
+    done.clear();
+    for(unsigned r = 0; r < simdK && !ready.empty(); r++){
+      map<Function*, long long> base; //weight of each gate type without w_dist
+      for(unsigned i = 0; i < ready.size(); i++){
+        int n = ready[i];
+        base[opFunc[n]] += RCP_W_OP + (long long) RCP_W_SLACK * (opAlap[n] - opAsap[n]);
+      }
+      long long bestWeight = 0;
+      int bestSimd = 0;
+      Function* bestGate = NULL;
+      for(int simd = 1; simd <= (int) simdK; simd++){
+        if(!regionFree[simd])
+          continue;
+        map<Function*, long long> weight = base;
+        for(unsigned i = 0; i < ready.size(); i++)
+          if(home[ready[i]] == simd)
+            weight[opFunc[ready[i]]] += RCP_W_DIST;
+        for(unsigned i = 0; i < ready.size(); i++){
+          long long w = weight[opFunc[ready[i]]];
+          if(bestSimd == 0 || w > bestWeight){
+            bestWeight = w;
+            bestSimd = simd;
+            bestGate = opFunc[ready[i]];
+          }
+        }
+      }
+
+      //ops of the chosen gate type, up to d qubits
+      unsigned qubits = 0;
+      vector<int> left;
+      for(unsigned i = 0; i < ready.size(); i++){
+        int n = ready[i];
+        if(opFunc[n] == bestGate && (qubits == 0 || qubits + opNumArgs[n] <= simdD)){
+          qubits += opNumArgs[n];
+          sched_op(n, ts, bestSimd);
+          done.push_back(n);
+          sched_ops++;
+        }
+        else
+          left.push_back(n);
+      }
+      ready.swap(left);
+      regionFree[bestSimd] = 0;
+    }
+    update_moves(0, ts++);
+
+    for(unsigned i = 0; i < done.size(); i++){
+      int n = done[i];
+      for(unsigned e = outStart[n]; e < outStart[n + 1]; e++)
+        if(--pending[outEdges[e]] == 0)
+          ready.push_back(outEdges[e]);
+    }
+  }
+  ots = ts;
+}
+
+//ALAP and ACAP (alap and acap in scripts/sched.pl), with resources
+//
+//No op starts before its target timestep. Every timestep, each simd region
+//in turn takes the gate type of the earliest target among the ops that may
+//start, and as many of those ops as fit in d qubits. With enough regions
+//every op runs at its target.
+void GenLPFSSched::target_sched(Function* F, const vector<int>& target){
+  int numOps = callList.size();
+  restore_dag();
+
+  //(first timestep, op) of the ops whose parents are all scheduled; at that
+  //timestep they move to the (target, op) ordered list of ops that may start
+  priority_queue<pair<int, int>, vector<pair<int, int> >, greater<pair<int, int> > > waiting;
+  set<pair<int, int> > startable;
+  vector<int> pending(numOps);
+  for(int n = 0; n < numOps; n++){
+    pending[n] = inStart[n + 1] - inStart[n];
+    if(pending[n] == 0)
+      waiting.push(make_pair(target[n], n));
+  }
+
+  int ts = 0;
+  int sched_ops = 0;
+  vector<int> done;
+  while(sched_ops < numOps){
+    while(!waiting.empty() && waiting.top().first <= ts){
+      int n = waiting.top().second;
+      startable.insert(make_pair(target[n], n));
+      waiting.pop();
+    }
+    done.clear();
+    for(int simd = 1; simd <= (int) simdK && !startable.empty(); simd++){
+      Function* gate = opFunc[(*startable.begin()).second];
+      unsigned qubits = 0;
+      for(set<pair<int, int> >::iterator sit = startable.begin(); sit != startable.end(); ){
+        int n = (*sit).second;
+        if(opFunc[n] == gate && (qubits == 0 || qubits + opNumArgs[n] <= simdD)){
+          qubits += opNumArgs[n];
+          sched_op(n, ts, simd);
+          done.push_back(n);
+          sched_ops++;
+          startable.erase(sit++);
+        }
+        else
+          ++sit;
+      }
+    }
+    for(unsigned i = 0; i < done.size(); i++){
+      int n = done[i];
+      for(unsigned e = outStart[n]; e < outStart[n + 1]; e++)
+        if(--pending[outEdges[e]] == 0)
+          waiting.push(make_pair(max(target[outEdges[e]], ts + 1), outEdges[e]));
+    }
+    ts++;
+  }
+  for(int t = 0; t < ts; t++)
+    update_moves(0, t);
+  ots = ts;
+}
+
 void GenLPFSSched::update_moves(int moves, int ts ){
   vector<qArgInfo> current;
   vector<qArgInfo> next; 
@@ -566,24 +1154,25 @@ void GenLPFSSched::update_moves(int moves, int ts ){
   bool added_move = false;
 
   //----Get Current Qubits-----//
-  for(int simd = 1; simd <= (int) RES_CONSTRAINT; simd++){
-    map<int, multimap<int, op> >::iterator it = schedule.find(simd);
+  for(int simd = 1; simd <= (int) simdK; simd++){
+    map<int, multimap<int, int> >::iterator it = schedule.find(simd);
     simd_active[simd] = 0;
     if(it != schedule.end()){
-      multimap<int, op>::iterator mit = schedule[simd].find(ts);
+      multimap<int, int>::iterator mit = schedule[simd].find(ts);
       if(mit != (*it).second.end()) {
         simd_active[simd] = 1;
         simds = max(simds, simd); 
       }
       while(mit != (*it).second.end() && (*mit).first == ts){
-        op myOp = (*mit).second;
-        for(int i = 0; i < myOp.name.numArgs; i++){
+        int myOp = (*mit).second;
+        for(int i = 0; i < opNumArgs[myOp]; i++){
+          const qArgInfo& opArg = opArgs[opArgStart[myOp] + i];
           stringstream ss;
-          ss << myOp.name.args[i].index;
-          string name = myOp.name.args[i].name + ss.str();
+          ss << opArg.index;
+          string name = opArg.name + ss.str();
           qArgInfo arg = (*qubitMap.find(name)).second; 
-          arg.simd = myOp.simd;
-          arg.last_inst = myOp.label;
+          arg.simd = opSimd[myOp];
+          arg.last_inst = callList[myOp];
           vector<qArgInfo>::iterator vit = current.begin();
           while(vit != current.end()) { 
             if((*vit) == arg){
@@ -603,12 +1192,12 @@ void GenLPFSSched::update_moves(int moves, int ts ){
   }
 
 #ifdef _DEBUG_LPFS
-  errs() << "# AT TIMESTEP: " << ts << "\n";
+  out() << "# AT TIMESTEP: " << ts << "\n";
 #endif
 
   for(vector<qArgInfo>::iterator mapit = active_qubits.begin(); mapit != active_qubits.end(); mapit++){
 #ifdef _DEBUG_LPFS
-    errs() << "Currently examining: " << (*mapit).name << (*mapit).index << "\n";
+    out() << "Currently examining: " << (*mapit).name << (*mapit).index << "\n";
 #endif
     stringstream ss;
     ss << (*mapit).index;
@@ -664,21 +1253,18 @@ void GenLPFSSched::update_moves(int moves, int ts ){
       if(!(dest) && (simd_active[src])){
         int lowNextTS = std::numeric_limits<int>::max();
         int nextOpLoc = -1;
-        op myOp = (*mapCalls.find(thisQbit.last_inst)).second;
-        if(!myOp.out_edges.empty()){
-          for(int i = 0; i < (int) myOp.out_edges.size(); i++){
-            op nextOp = (*mapCalls.find(myOp.out_edges[i])).second;
-            for(int j = 0; j < nextOp.name.numArgs; j++){
-              qArgInfo arg = nextOp.name.args[j];
-              if(arg == thisQbit){
-                lowNextTS = nextOp.ts;
-                nextOpLoc = nextOp.simd;
-              }
+        int myOp = opIndex.lookup(thisQbit.last_inst);
+        for(unsigned e = outStart[myOp]; e < outStart[myOp + 1]; e++){
+          int nextOp = outEdges[e];
+          for(int j = 0; j < opNumArgs[nextOp]; j++){
+            if(opArgs[opArgStart[nextOp] + j] == thisQbit){
+              lowNextTS = opTs[nextOp];
+              nextOpLoc = opSimd[nextOp];
             }
           }
         }
         (*qubitMap.find(name)).second.nextTS = lowNextTS;
-        if((lowNextTS <= ts + (int) LOCAL_WINDOW) && (myOp.ts != ts) && (nextOpLoc == myOp.simd)  && ((*qubitMap.find(name)).second.loc % 10 != 0)){
+        if((lowNextTS <= ts + (int) LOCAL_WINDOW) && (opTs[myOp] != ts) && (nextOpLoc == opSimd[myOp])  && ((*qubitMap.find(name)).second.loc % 10 != 0)){
           if( (src) && (localMemSizeMap[src*10] >= (int) LOCAL_Q)){
             int maxTS = 0;
             string maxName;
@@ -715,7 +1301,7 @@ void GenLPFSSched::update_moves(int moves, int ts ){
           localMemSizeMap[newMove.dest]++;
           //errs() << "TS: " << ts << " Added local mem: " << name <<" : " << (*qubitMap.find(name)).second.loc << "\n";
         }
-        else if(myOp.ts != ts) {
+        else if(opTs[myOp] != ts) {
           move newMove;
           newMove.src = src;
           newMove.dest = dest;
@@ -730,9 +1316,9 @@ void GenLPFSSched::update_moves(int moves, int ts ){
   }
 
   /*  
-      errs() << "Current qubits after deletion: " << current.size() << "TIME: " << ts <<  "\n";
+      out() << "Current qubits after deletion: " << current.size() << "TIME: " << ts <<  "\n";
       for(vector<qArgInfo>::iterator mit = current.begin(); mit != current.end(); mit++){
-      errs() << (*mit).name << (*mit).index << " DEST: " << (*mit).simd << " ID: " << (*mit).id <<  "\n";
+      out() << (*mit).name << (*mit).index << " DEST: " << (*mit).simd << " ID: " << (*mit).id <<  "\n";
       }
    */
 
@@ -769,29 +1355,53 @@ void GenLPFSSched::update_moves(int moves, int ts ){
   active_qubits = next;
 }
 
-bool GenLPFSSched::depsMet(Instruction* currentOp, int currentTime){
-  op myOp = (*mapCalls.find(currentOp)).second;
-  bool answer = true;
-  if(!(myOp.in_edges.empty())){
-    for(vector<Instruction*>::iterator parent = myOp.in_edges.begin(); parent != myOp.in_edges.end(); parent++){
-      if(((*mapCalls.find(*parent))).second.simd == -1) answer = false;
-      if(((*mapCalls.find(*parent))).second.ts >= currentTime) answer = false;
-      //            errs() << "Current timestep: " << currentTime << " Parent's timestep: " << ((*mapCalls.find(*parent))).second.ts << "\n"; 
-    }
+// Earliest timestep op n can start at, -1 if a parent is unscheduled
+int GenLPFSSched::ready_time(int n){
+  int readyTS = 0;
+  for(unsigned e = inStart[n]; e < inStart[n + 1]; e++){
+    int parent = inEdges[e];
+    if(opSimd[parent] == -1) return -1;
+    readyTS = max(readyTS, opTs[parent] + 1);
+  }
+  return readyTS;
+}
+
+// First timestep at or after timeStep with nothing running in simd region
+int GenLPFSSched::first_free(int simd, int timeStep){
+  if(simd >= (int) regionBusy.size()) return timeStep;
+  const vector<uint64_t>& busy = regionBusy[simd];
+  unsigned w = timeStep / 64;
+  if(w >= busy.size()) return timeStep;
+  uint64_t bits = busy[w] | ((1ULL << (timeStep % 64)) - 1);
+  while(bits == ~0ULL){
+    if(++w == busy.size()) return w * 64;
+    bits = busy[w];
   }
-  return answer;
+  return w * 64 + CountTrailingOnes_64(bits);
 }
 
 // Schedule at given timestep and simd region
-void GenLPFSSched::sched_op(Instruction* currentOp, int timeStep, int simd){
-  if((*mapCalls.find(currentOp)).second.simd == -1){
-    (*mapCalls.find(currentOp)).second.ts = timeStep;
-    (*mapCalls.find(currentOp)).second.simd = simd;
-    (*mapCalls.find(currentOp)).second.followed = 1;
-    (*mapCalls.find(currentOp)).second.label = currentOp;
-    schedule[simd].insert(make_pair(timeStep, ((*mapCalls.find(currentOp)).second)));
+void GenLPFSSched::sched_op(int n, int timeStep, int simd){
+  if(opSimd[n] == -1){
+    opTs[n] = timeStep;
+    opSimd[n] = simd;
+    opFollowed[n] = 1;
+    schedule[simd].insert(make_pair(timeStep, n));
+    if(simd >= (int) regionFirst.size()){
+      regionFirst.resize(simd + 1);
+      regionBusy.resize(simd + 1);
+    }
+    vector<int>& first = regionFirst[simd];
+    if(timeStep >= (int) first.size()){
+      first.resize(max(2 * first.size(), (size_t) timeStep + 1), -1);
+      regionBusy[simd].resize(first.size() / 64 + 1, 0);
+    }
+    if(first[timeStep] == -1){
+      first[timeStep] = n;
+      regionBusy[simd][timeStep / 64] |= 1ULL << (timeStep % 64);
+    }
     regionSizeMap[simd]++;
-    if(((*mapCalls.find(currentOp)).second.name.qFunc->getName().find("llvm.T") != std::string::npos)||((*mapCalls.find(currentOp)).second.name.qFunc->getName().find("llvm.Tdag") != std::string::npos )) { 
+    if((opFunc[n]->getName().find("llvm.T") != std::string::npos)||(opFunc[n]->getName().find("llvm.Tdag") != std::string::npos )) { 
       tgates_cnt++;
     }
   }
@@ -801,45 +1411,41 @@ void GenLPFSSched::sched_op(Instruction* currentOp, int timeStep, int simd){
 
 void GenLPFSSched::find_lp(Function* F, int pathNum){
   //----------------Find Longest Path----------------------------//
-  longPath.push_back(*callList.begin());
-
-  for(map<Instruction*, op>::iterator mp1 = mapCalls.begin(); mp1 != (--mapCalls.end()); ++mp1){
-    if(!(*mp1).second.followed) (*mp1).second.dist = 1;
+  int numOps = callList.size();
+  if(numOps == 0) return;
+  longPath.push_back(0);
+
+  //mapCalls used to be visited in Instruction* order here, leaving out the
+  //op with the highest address; lastByAddr keeps the schedules identical
+  for(int n = 0; n < numOps; ++n){
+    if(n != lastByAddr && !opFollowed[n]) opDist[n] = 1;
   }
-  //	for(map<Instruction*, op>::iterator mp1 = mapCalls.begin(); mp1 != (--mapCalls.end()); ++mp1){
-  for(vector<Instruction*>::iterator fp1 = callList.begin(); fp1 != (--callList.end()); ++fp1){
-    map<Instruction*, op>:: iterator mp1 = mapCalls.find(*fp1);
-    if((*mp1).second.followed){
-      (*mp1).second.dist = 0;
+  for(int n = 0; n < numOps - 1; ++n){
+    if(opFollowed[n]){
+      opDist[n] = 0;
     }
     else{ 
-      op thisOp = (*mp1).second;
-
-      if(!(thisOp.out_edges.empty())){
-        for(vector<Instruction*>::iterator child = thisOp.out_edges.begin(); child != thisOp.out_edges.end(); child++){
-          op childOp = (*mapCalls.find(*child)).second;
-          childOp.dist = max(childOp.dist, thisOp.dist + 1);
-          mapCalls[*child] = childOp; 
-        }
+      for(unsigned e = outStart[n]; e < outStart[n + 1]; e++){
+        int child = outEdges[e];
+        opDist[child] = max(opDist[child], opDist[n] + 1);
       }
-      if((!thisOp.followed) && (!(longPath.empty()))){
-        if(thisOp.dist >= (*mapCalls.find(longPath[0])).second.dist){
-          longPath[0] = (*mp1).first;
+      if(!(longPath.empty())){
+        if(opDist[n] >= opDist[longPath[0]]){
+          longPath[0] = n;
         }
       }
     }
-    //        errs() << "INST: " << (*mp1).first << " Dist: " << (*mp1).second.dist << "\n";
   }
 
   if(!(longPath.empty())){ 
-    //        for(int i = 0; i < (int)longPath.size(); i++){ 
-    while((*mapCalls.find(longPath[longPath.size() - 1])).second.dist > 1){ 
-      op botOp = (*mapCalls.find(longPath[longPath.size()-1])).second;
-      int currDist = botOp.dist - 1;
-      take_path(longPath[longPath.size() - 1], pathNum); 
-      for(vector<Instruction*>::iterator parent = botOp.in_edges.begin(); parent != botOp.in_edges.end(); ++parent){
-        if(((*mapCalls.find(*parent)).second.dist == currDist) && (!(*mapCalls.find(*parent)).second.followed)){
-          longPath.push_back(*parent); //next operation is appended to the path, so path vector is in reverse
+    while(opDist[longPath[longPath.size() - 1]] > 1){ 
+      int botOp = longPath[longPath.size() - 1];
+      int currDist = opDist[botOp] - 1;
+      take_path(botOp, pathNum); 
+      for(unsigned e = inStart[botOp]; e < inStart[botOp + 1]; e++){
+        int parent = inEdges[e];
+        if((opDist[parent] == currDist) && (!opFollowed[parent])){
+          longPath.push_back(parent); //next operation is appended to the path, so path vector is in reverse
           break;
         } 
       }
@@ -847,14 +1453,43 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
   }
   }                         
 
-  void GenLPFSSched::take_path(Instruction* CI, int path){
-    op currentOp = (*mapCalls.find(CI)).second;
-    //    print_qgate(currentOp.name);
-    currentOp.dist = 0;
-    currentOp.path = path;
-    //    currentOp.simd = path;
-    currentOp.followed = 1;
-    mapCalls[CI] = currentOp; 
+  void GenLPFSSched::take_path(int n, int path){
+    opDist[n] = 0;
+    opPath[n] = path;
+    opFollowed[n] = 1;
+  }
+
+  // Allocate the dense per-op state for the ops in callList
+  void GenLPFSSched::init_op_state(){
+    int numOps = callList.size();
+    opIndex.clear();
+    lastByAddr = -1;
+    for(int n = 0; n < numOps; ++n){
+      opIndex[callList[n]] = n;
+      if(lastByAddr == -1 || callList[n] > callList[lastByAddr])
+        lastByAddr = n;
+    }
+    opFunc.assign(numOps, NULL);
+    opArgStart.assign(numOps, 0);
+    opNumArgs.assign(numOps, 0);
+    opArgs.clear();
+    opId.assign(numOps, -1);
+    opTs.assign(numOps, -1);
+    opDist.assign(numOps, -1);
+    opSimd.assign(numOps, -1);
+    opPath.assign(numOps, 0);
+    opFollowed.assign(numOps, 0);
+    inStart.assign(numOps + 1, 0);
+    outStart.assign(numOps + 1, 0);
+    inEdges.clear();
+    outEdges.clear();
+    regionBusy.clear();
+    regionFirst.clear();
+  }
+
+  void GenLPFSSched::clear_op_state(){
+    callList.clear();
+    init_op_state();
   }
 
 
@@ -1087,32 +1722,32 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
 
   void GenLPFSSched::print_funcQbits(){
     for(map<string, map<int,uint64_t> >::iterator mIter = funcQbits.begin(); mIter!=funcQbits.end(); ++mIter){
-      errs() << "Var "<< (*mIter).first << " ---> ";
+      out() << "Var "<< (*mIter).first << " ---> ";
       for(map<int,uint64_t>::iterator indexIter  = (*mIter).second.begin(); indexIter!=(*mIter).second.end(); ++indexIter){
-        errs() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
+        out() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
       }
-      errs() << "\n";
+      out() << "\n";
     }
   }
 
   void GenLPFSSched::print_ArrParGates(){
-    errs() << "Printing ArrParGate Vector \n";
+    out() << "Printing ArrParGate Vector \n";
     int j = 0;
     for(vector<ArrParGates>::iterator vit = currArrParGates.begin(); vit!=currArrParGates.end(); ++vit, j++){
-      errs() << j << " -- ";
-      for(unsigned int i=0;i<RES_CONSTRAINT;i++)
-        errs() << (*vit).typeOfGate[i] << " : " << (*vit).numGates[i] << " ; ";
-      errs() << "\n";
+      out() << j << " -- ";
+      for(unsigned int i=0;i<simdK;i++)
+        out() << (*vit).typeOfGate[i] << " : " << (*vit).numGates[i] << " ; ";
+      out() << "\n";
     }
 
   }
 
   void GenLPFSSched::print_qgate(qGate qg){
-    errs() << qg.qFunc->getName() << " : ";
+    out() << qg.qFunc->getName() << " : ";
     for(int i=0;i<qg.numArgs;i++){
-      errs() << qg.args[i].name << qg.args[i].index << ", "  ;
+      out() << qg.args[i].name << qg.args[i].index << ", "  ;
     }
-    errs() << "\n";
+    out() << "\n";
   }
 
   uint64_t GenLPFSSched::get_ts_to_schedule(Function* F, uint64_t ts, Function* funcToSched, uint64_t& first_step){
@@ -1169,7 +1804,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
 
 
     if(ts < totalSched.length+currSched.length){ //might be able to parallelize  
-      if((Win + currSched.width) <= RES_CONSTRAINT) //Hooray, can be parallelized
+      if((Win + currSched.width) <= simdK) //Hooray, can be parallelized
       {
         //first_step = totalSched.length; //where the func got scheduled
         first_step = max(ts,totalSched.length); //where the func got scheduled
@@ -1261,10 +1896,10 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
       int searchFuncIndex = funcIndex+c*20;
 
       for(uint64_t i = ts; (i<currArrParGates.size() && !foundEntry); i++){
-        for(unsigned int j = 0; (j<RES_CONSTRAINT && !foundEntry); j++){
-          //if((currArrParGates[i].typeOfGate[j] == searchFuncIndex) && (currArrParGates[i].numGates[j] < DATA_CONSTRAINT)){
-          if((currArrParGates[i].typeOfGate[j] == searchFuncIndex) && ((searchFuncIndex == _CNOT && 2*currArrParGates[i].numGates[j] < DATA_CONSTRAINT)
-                || (searchFuncIndex != _CNOT && currArrParGates[i].numGates[j]< DATA_CONSTRAINT))){
+        for(unsigned int j = 0; (j<simdK && !foundEntry); j++){
+          //if((currArrParGates[i].typeOfGate[j] == searchFuncIndex) && (currArrParGates[i].numGates[j] < simdD)){
+          if((currArrParGates[i].typeOfGate[j] == searchFuncIndex) && ((searchFuncIndex == _CNOT && 2*currArrParGates[i].numGates[j] < simdD)
+                || (searchFuncIndex != _CNOT && currArrParGates[i].numGates[j]< simdD))){
             currArrParGates[i].numGates[j] += 1;
             if(!FirstEntrySched){
               first_step = i;
@@ -1300,7 +1935,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
               //errs() << "Found T or Tdag \n";
 
               bool prevTgateFound = false;
-              for(unsigned int jcheck=0; jcheck<RES_CONSTRAINT; jcheck++){
+              for(unsigned int jcheck=0; jcheck<simdK; jcheck++){
                 if(currArrParGates[i].typeOfGate[jcheck] == _T
                     || currArrParGates[i].typeOfGate[jcheck] == _Tdag)
                   prevTgateFound = true;
@@ -1330,7 +1965,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
           //add entry to vectArrParGates
 
           ArrParGates tmpArrPar; //initialize
-          for(unsigned int k=0;k<RES_CONSTRAINT; k++){
+          for(unsigned int k=0;k<simdK; k++){
             tmpArrPar.typeOfGate[k] = -1;
             tmpArrPar.numGates[k] = 0;
           }
@@ -1409,19 +2044,19 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
       if(vit==isLeaf.end()) //not a leaf
         funcIsLeaf=false;
 
-      //errs() << "SIMD k="<<RES_CONSTRAINT<<" d=" << DATA_CONSTRAINT << " " << F->getName() << " " << tmpMod.width << " " << tmpMod.length << " " <<tmpMod.tgates << " " << tmpMod.tgates_ub << " " << tmpMod.tgates_par<< " " << tmpMod.tgates_par_ub << " leaf=" << funcIsLeaf << "\n";
+      //errs() << "SIMD k="<<simdK<<" d=" << simdD << " " << F->getName() << " " << tmpMod.width << " " << tmpMod.length << " " <<tmpMod.tgates << " " << tmpMod.tgates_ub << " " << tmpMod.tgates_par<< " " << tmpMod.tgates_par_ub << " leaf=" << funcIsLeaf << "\n";
 
     }
 
 
     void GenLPFSSched::print_critical_info(){
-      errs() << "Timesteps = " << currArrParGates.size() << "\n";
+      out() << "Timesteps = " << currArrParGates.size() << "\n";
       for(unsigned int i = 0; i<currArrParGates.size(); i++){
-        errs() << i << " :";
-        for(unsigned int k=0;k<RES_CONSTRAINT;k++){      
-          errs() << currArrParGates[i].typeOfGate[k] << " : " << currArrParGates[i].numGates[k] << " / ";
+        out() << i << " :";
+        for(unsigned int k=0;k<simdK;k++){      
+          out() << currArrParGates[i].typeOfGate[k] << " : " << currArrParGates[i].numGates[k] << " / ";
         }
-        errs() << "\n";
+        out() << "\n";
       }
     }
 
@@ -1431,14 +2066,14 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
         maxGates[k] = 0;
 
       for(vector<ArrParGates>::iterator vit = currArrParGates.begin(); vit!=currArrParGates.end(); ++vit){
-        for(unsigned int i = 0; i<RES_CONSTRAINT; i++)
+        for(unsigned int i = 0; i<simdK; i++)
           if((*vit).numGates[i] > maxGates[(*vit).typeOfGate[i]])
             maxGates[(*vit).typeOfGate[i]] = (*vit).numGates[i];
       }
 
-      errs() << "\nMax Parallelism Factors: \n";
+      out() << "\nMax Parallelism Factors: \n";
       for(int k = 0; k<NUM_QGATES-1; k++){ //do not print 'All'
-        errs() << gate_name[k] << " : " << maxGates[k] << "\n";
+        out() << gate_name[k] << " : " << maxGates[k] << "\n";
       }  
     }
 
@@ -1467,36 +2102,36 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
       string tmpGateName = qg.qFunc->getName();
       if(tmpGateName.find("llvm.")!=std::string::npos)
         tmpGateName = tmpGateName.substr(5);
-      errs() << ts << " " << tmpGateName;
+      out() << ts << " " << tmpGateName;
       for(int i = 0; i<qg.numArgs; i++){
-        errs() << " " << qg.args[i].name;
+        out() << " " << qg.args[i].name;
         if(qg.args[i].index != -1)
-          errs() << qg.args[i].index;
+          out() << qg.args[i].index;
       }
 
       /*
          if(tmpGateName == "PrepX" || tmpGateName == "PrepZ"){
          if(qg.angle > 0)
-         errs() << " 1";
+         out() << " 1";
          else
-         errs() << " 0";
+         out() << " 0";
          }
          else if(tmpGateName == "Rz" || tmpGateName == "Ry" || tmpGateName == "Rx")
-         errs() << " "<<qg.angle;
+         out() << " "<<qg.angle;
        */
 
-      errs() << "\n";
+      out() << "\n";
     }
 
     void GenLPFSSched::print_tableFuncQbits(){
       for(map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator m1 = tableFuncQbits.begin(); m1!=tableFuncQbits.end(); ++m1){
-        errs() << "Function " << (*m1).first->getName() << " \n  ";
+        out() << "Function " << (*m1).first->getName() << " \n  ";
         for(map<unsigned int, map<int, uint64_t> >::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
-          errs() << "\tArg# "<< (*m2).first << " -- ";
+          out() << "\tArg# "<< (*m2).first << " -- ";
           for(map<int, uint64_t>::iterator m3 = (*m2).second.begin(); m3!=(*m2).second.end(); ++m3){
-            errs() << " ; " << (*m3).first << " : " << (*m3).second;
+            out() << " ; " << (*m3).first << " : " << (*m3).second;
           }
-          errs() << "\n";
+          out() << "\n";
         }
       }
     }
@@ -1504,14 +2139,14 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
     /*
        void GenLPFSSched::print_ready_queue(){
        for(vector<op>::iterator r1 = readyQueue.begin(); r1!=readyQueue.end(); ++r1){
-       errs() << "READY QUEUE ENTRY " << (*r1).name.qFunc->getName() << "\n";
+       out() << "READY QUEUE ENTRY " << (*r1).name.qFunc->getName() << "\n";
        }
        }
      */
     void GenLPFSSched::print_funcList(){
       if(!(funcList.empty())){
         for(vector<pair<Instruction*, op > >::iterator f1 = funcList.begin(); f1 != funcList.end(); ++f1){
-          errs() << "\n #Function List Entry: " << (*f1).first; 
+          out() << "\n #Function List Entry: " << (*f1).first; 
           print_qgate((*f1).second.name); 
         }      
       }
@@ -1519,27 +2154,29 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
     /*
        void GenLPFSSched::print_vectQbit(){
        for(vector<Value*>::iterator vq1 = vectQbit.begin(); vq1!=vectQbit.end(); ++vq1){
-       errs() << "#Vector Qubit Entry: " << (*vq1) << "\n";
+       out() << "#Vector Qubit Entry: " << (*vq1) << "\n";
        }
        }  
      */
     void GenLPFSSched::print_mapCalls(){
-      for(map<Instruction*, op>::iterator mp = mapCalls.begin(); mp!=mapCalls.end(); ++mp){
-        errs() << "INSTRUCTION: " << (*mp).first << " timestep " << mapCalls[(*mp).first].ts << " Dist: " << mapCalls[(*mp).first].dist << " | Followed: " << mapCalls[(*mp).first].followed << " qGate: ";
-        print_qgate(mapCalls[(*mp).first].name);
-        //    errs() << " Followed? " << (*mp).second.followed << "\n"; 
+      for(int n = 0; n < (int)callList.size(); ++n){
+        out() << "INSTRUCTION: " << callList[n] << " timestep " << opTs[n] << " Dist: " << opDist[n] << " | Followed: " << (bool)opFollowed[n] << " qGate: ";
+        if(opFunc[n]) out() << opFunc[n]->getName();
+        for(int i = 0; i < opNumArgs[n]; i++)
+          out() << " " << opArgs[opArgStart[n] + i].name << opArgs[opArgStart[n] + i].index;
+        out() << "\n";
       }
     }
 
     void GenLPFSSched::print_mapCallsEdges(){
-      for(map<Instruction*, op>::iterator mp = mapCalls.begin(); mp!=mapCalls.end(); ++mp){
-        errs() << "INST_LABEL: " << (*mp).first << "\n In_Edges: ";
-        for(int i = 0; i < (int)(*mp).second.in_edges.size(); ++i)
-          errs() <<  (*mp).second.in_edges[i] << " ";
-        errs() << "\n Out_Edges: ";
-        for(int i = 0; i < (int)(*mp).second.out_edges.size(); ++i)
-          errs() << (*mp).second.out_edges[i] << " ";
-        errs() << "\n";
+      for(int n = 0; n < (int)callList.size(); ++n){
+        out() << "INST_LABEL: " << callList[n] << "\n In_Edges: ";
+        for(unsigned e = inStart[n]; e < inStart[n + 1]; ++e)
+          out() <<  callList[inEdges[e]] << " ";
+        out() << "\n Out_Edges: ";
+        for(unsigned e = outStart[n]; e < outStart[n + 1]; ++e)
+          out() << callList[outEdges[e]] << " ";
+        out() << "\n";
       }
     }
 
@@ -1548,17 +2185,156 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
     void GenLPFSSched::print_priorityVector(){
       for(vector<InstPri>::iterator pvit = priorityVector.begin(); pvit != priorityVector.end(); ++pvit) 
         //    errs() << "#PRIORITY VECTOR ENTRY: " << (*pvit).second << " " << (*pvit).second << "\n";
-        errs() << "#PRIORITY VECTOR ENTRY: " << (*mapCalls.find((*pvit).first)).second.name.qFunc->getName() << "\n";
+        out() << "#PRIORITY VECTOR ENTRY: " << opFunc[(*pvit).first]->getName() << "\n";
     }
 
     void GenLPFSSched::print_longPath(){
-      errs() << "\n Longest Path: \n";
+      out() << "\n Longest Path: \n";
       int i = 1;
-      for(vector<Instruction*>::reverse_iterator rlp = longPath.rbegin(); rlp != longPath.rend(); ++rlp){
-        errs() << i++ << " - " << (*mapCalls.find(*rlp)).second.id << " "; 
-        print_qgate((*mapCalls.find(*rlp)).second.name);
+      for(vector<int>::reverse_iterator rlp = longPath.rbegin(); rlp != longPath.rend(); ++rlp){
+        out() << i++ << " - " << opId[*rlp] << " " << opFunc[*rlp]->getName() << "\n"; 
+      }
+    }
 
+    // Name of the gate or function op n calls, without the llvm. prefix
+    string GenLPFSSched::op_name(int n){
+      string tmpName = opFunc[n]->getName();
+      if( tmpName.find("llvm.") != std::string::npos) {
+        unsigned firstDotPos = tmpName.find('.');
+        unsigned secondDotPos = tmpName.find('.', firstDotPos+1);
+        if (firstDotPos == secondDotPos)
+          return tmpName.substr(firstDotPos+1, std::string::npos);
+        else
+          return tmpName.substr(firstDotPos+1, secondDotPos-firstDotPos-1);
       }
+      return tmpName;
+    }
+
+    // -lpfs-cache key of F's body: a hash of its instructions with values
+    // numbered in order instead of named, so the key does not change with
+    // F's name or value names. Names of arguments and allocas are kept, as
+    // the schedules print them. Debug info is left out.
+    string GenLPFSSched::leaf_key(Function* F){
+      DenseMap<const Value*, unsigned> num;
+      unsigned n = 0;
+      for(Function::iterator bb = F->begin(); bb != F->end(); ++bb){
+        num[bb] = n++;
+        for(BasicBlock::iterator I = bb->begin(); I != bb->end(); ++I)
+          num[I] = n++;
+      }
+      hash_ostream hs;
+      unsigned insts = 0;
+      for(Function::arg_iterator A = F->arg_begin(); A != F->arg_end(); ++A)
+        hs << *A->getType() << " " << A->getName() << ",";
+      for(inst_iterator I = inst_begin(*F), E = inst_end(*F); I != E; ++I){
+        if(isa<DbgInfoIntrinsic>(&*I))
+          continue;
+        insts++;
+        hs << ";" << I->getOpcodeName() << " " << *I->getType();
+        if(isa<AllocaInst>(&*I))
+          hs << " " << I->getName();
+        if(CmpInst* CI = dyn_cast<CmpInst>(&*I))
+          hs << " " << (unsigned) CI->getPredicate();
+        for(User::op_iterator O = I->op_begin(); O != I->op_end(); ++O){
+          const Value* V = *O;
+          if(const Argument* A = dyn_cast<Argument>(V))
+            hs << " a" << A->getArgNo();
+          else if(isa<Instruction>(V) || isa<BasicBlock>(V))
+            hs << " %" << num[V];
+          else if(isa<MDNode>(V))
+            hs << " md";
+          else{
+            //the type is printed apart: WriteAsOperand with PrintType set
+            //walks every type of the module on each call
+            hs << " " << *V->getType() << " ";
+            WriteAsOperand(hs, V, false);
+          }
+        }
+      }
+      stringstream key;
+      key << hex << hs.hash() << dec << "/" << insts;
+      return key.str();
+    }
+
+    // Binary schedule (-lpfs-bin), read by braidflash. Native byte order.
+    // The file starts with the magic "LPFSBIN1", uint32 version 2 and a
+    // uint32 0, followed by one block per leaf module and (k, d):
+    //   uint32 nameLen, k, d, numQubits, numOpNames, 0; uint64 numOps
+    //   module name; numQubits then numOpNames x (uint32 len, chars)
+    //   zero padding to a multiple of 4 bytes
+    //   uint32 ts[numOps], q0[numOps], q1[numOps]; uint16 op[numOps]
+    //   zero padding to a multiple of 8 bytes
+    // (version 1 had a uint8 op column). A module with more op names than
+    // the op column can number is not written; false is returned.
+    // Ops are in the order print_schedule prints them, moves are left out.
+    // Qubits and op names are numbered in the order they first appear, q1
+    // (and q0) is 0xffffffff when the op has no second (first) qubit.
+    bool GenLPFSSched::write_bin_schedule(Function* F, int op_count, string& buf){
+      vector<uint32_t> ts, q0, q1;
+      vector<uint16_t> ops;
+      map<string, uint32_t> qubitIds, opIds;
+      vector<string> qubitNames, opNames;
+      for(int t = 0; t < op_count; t++){
+        for(map<int, multimap<int, int> >::iterator pit = schedule.begin(); pit != schedule.end(); pit++){
+          multimap<int, int>::iterator oper = (*pit).second.find(t);
+          while(oper != (*pit).second.end() && (*oper).first == t){
+            int n = (*oper).second;
+            string name = op_name(n);
+            map<string, uint32_t>::iterator oit = opIds.find(name);
+            if(oit == opIds.end()){
+              oit = opIds.insert(make_pair(name, (uint32_t) opNames.size())).first;
+              opNames.push_back(name);
+            }
+            uint32_t q[2] = {0xffffffff, 0xffffffff};
+            for(int i = 0; i < opNumArgs[n] && i < 2; i++){
+              const qArgInfo& arg = opArgs[opArgStart[n] + i];
+              stringstream qs;
+              qs << arg.name;
+              if(arg.index != -1) qs << arg.index;
+              map<string, uint32_t>::iterator qit = qubitIds.find(qs.str());
+              if(qit == qubitIds.end()){
+                qit = qubitIds.insert(make_pair(qs.str(), (uint32_t) qubitNames.size())).first;
+                qubitNames.push_back(qs.str());
+              }
+              q[i] = (*qit).second;
+            }
+            ts.push_back(t);
+            ops.push_back((*oit).second);
+            q0.push_back(q[0]);
+            q1.push_back(q[1]);
+            oper++;
+          }
+        }
+      }
+      if(opNames.size() > 65536){
+        errs() << "Error: more than 65536 op names in " << F->getName() << ", leaving it out of the binary schedule\n";
+        return false;
+      }
+
+      string name = F->getName();
+      uint32_t header[6] = {(uint32_t) name.size(), simdK, simdD,
+        (uint32_t) qubitNames.size(), (uint32_t) opNames.size(), 0};
+      uint64_t numOps = ts.size();
+      buf.append((const char*) header, sizeof(header));
+      buf.append((const char*) &numOps, sizeof(numOps));
+      buf += name;
+      for(int table = 0; table < 2; table++){
+        vector<string>& names = table ? opNames : qubitNames;
+        for(unsigned i = 0; i < names.size(); i++){
+          uint32_t len = names[i].size();
+          buf.append((const char*) &len, sizeof(len));
+          buf += names[i];
+        }
+      }
+      buf.append((4 - buf.size() % 4) % 4, '\0');
+      if(numOps){
+        buf.append((const char*) &ts[0], numOps * sizeof(uint32_t));
+        buf.append((const char*) &q0[0], numOps * sizeof(uint32_t));
+        buf.append((const char*) &q1[0], numOps * sizeof(uint32_t));
+        buf.append((const char*) &ops[0], numOps * sizeof(uint16_t));
+      }
+      buf.append((8 - buf.size() % 8) % 8, '\0');
+      return true;
     }
 
     void GenLPFSSched::print_schedule(Function* F, int op_count){
@@ -1567,36 +2343,27 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
         multimap<int, move>::iterator moveOper = move_schedule.find(ts); 
         multimap<int, move>::iterator bmoveOper = local_move_schedule.find(ts); 
         while((moveOper != move_schedule.end()) && ((*moveOper).first == ts)){
-          errs() << (*moveOper).first << ",0 TMOV " << (*moveOper).second.dest << " " << (*moveOper).second.src << " " <<  (*moveOper).second.arg.name << (*moveOper).second.arg.index << "\n";
+          out() << (*moveOper).first << ",0 TMOV " << (*moveOper).second.dest << " " << (*moveOper).second.src << " " <<  (*moveOper).second.arg.name << (*moveOper).second.arg.index << "\n";
           moveOper++;
         }
         while((bmoveOper != local_move_schedule.end()) && ((*bmoveOper).first == ts)){
-          errs() << (*bmoveOper).first << ",0 BMOV " << (*bmoveOper).second.dest << " " << (*bmoveOper).second.src << " " <<  (*bmoveOper).second.arg.name << (*bmoveOper).second.arg.index << "\n";
+          out() << (*bmoveOper).first << ",0 BMOV " << (*bmoveOper).second.dest << " " << (*bmoveOper).second.src << " " <<  (*bmoveOper).second.arg.name << (*bmoveOper).second.arg.index << "\n";
           bmoveOper++;
         }
-        for(map<int, multimap<int, op> >::iterator pit = schedule.begin(); pit != schedule.end(); pit++){
+        for(map<int, multimap<int, int> >::iterator pit = schedule.begin(); pit != schedule.end(); pit++){
           if(!(*pit).second.empty()){
-            multimap<int, op>::iterator oper = (*pit).second.find(ts);
+            multimap<int, int>::iterator oper = (*pit).second.find(ts);
             while(oper != (*pit).second.end() && (*oper).first == ts){
-              errs() << (*oper).first << "," << (*oper).second.simd << " ";
-              string tmpName = (*oper).second.name.qFunc->getName();
-              if( tmpName.find("llvm.") != std::string::npos) {
-                unsigned firstDotPos = tmpName.find('.');
-                unsigned secondDotPos = tmpName.find('.', firstDotPos+1);
-                if (firstDotPos == secondDotPos)
-                  errs() << tmpName.substr(firstDotPos+1, std::string::npos);
-                else
-                  errs() << tmpName.substr(firstDotPos+1, secondDotPos-firstDotPos-1);
-              }
-              else 
-                errs() << tmpName;
+              int n = (*oper).second;
+              out() << (*oper).first << "," << opSimd[n] << " " << op_name(n);
               //                    errs() << "Args of this function: " << (*oper).second.name.numArgs << "\n";
-              for(int i = 0; i<(*oper).second.name.numArgs; i++){
-                errs() << " " << (*oper).second.name.args[i].name;
-                if((*oper).second.name.args[i].index != -1) errs() << (*oper).second.name.args[i].index;
+              for(int i = 0; i<opNumArgs[n]; i++){
+                const qArgInfo& arg = opArgs[opArgStart[n] + i];
+                out() << " " << arg.name;
+                if(arg.index != -1) out() << arg.index;
               }
-              //                    errs() << " : Path = " << (*oper).second.path << " : ID = " << (*oper).second.id;
-              errs() << "\n";
+              //                    errs() << " : Path = " << opPath[n] << " : ID = " << opId[n];
+              out() << "\n";
               oper++; 
 
             }
@@ -1608,10 +2375,10 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
 
     void GenLPFSSched::print_moves_schedule(Function* F, int op_count){
       int ts = 0;
-      errs() << "MOVE LIST SIZE: " << move_schedule.size() << "\n";
+      out() << "MOVE LIST SIZE: " << move_schedule.size() << "\n";
       for(multimap<int, move>::iterator mit = move_schedule.begin(); mit != move_schedule.end(); mit++){
         while((*mit).first == ts){
-          errs() << (*mit).first << ",0 TMOV " << (*mit).second.dest << " " << (*mit).second.src << " " << (*mit).second.arg.name << (*mit).second.arg.index << "\n";
+          out() << (*mit).first << ",0 TMOV " << (*mit).second.dest << " " << (*mit).second.src << " " << (*mit).second.arg.name << (*mit).second.arg.index << "\n";
           mit++;
         }
         ts++;
@@ -1624,7 +2391,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
       multimap<int, move>::iterator mit;
       for(mit = local_move_schedule.begin(); mit != local_move_schedule.end(); mit++){
         while((*mit).first == ts){
-          errs() << (*mit).first << ",0 BMOV " << (*mit).second.dest << " " << (*mit).second.src << " " << (*mit).second.arg.name << (*mit).second.arg.index << "\n";
+          out() << (*mit).first << ",0 BMOV " << (*mit).second.dest << " " << (*mit).second.src << " " << (*mit).second.arg.name << (*mit).second.arg.index << "\n";
           mit++;
         }
         ts++;
@@ -1638,14 +2405,14 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
         mts++;
       }
 
-      errs() << "ops = " << op_count << "\n";
-      errs() << "tmoves = " << moves_count << "\n";
-      errs() << "bmoves = " << bmoves_count << "\n";
-      errs() << "ots = " << ots << "\n";
-      errs() << "mts = " << mts << "\n";
-      errs() << "ts = " << (ots - mts) + (mts * 5) << "\n";
-      errs() << "SIMDs = " << simds << "\n";
-      errs() << "tgates = " << tgates_cnt << "\n";
+      out() << "ops = " << op_count << "\n";
+      out() << "tmoves = " << moves_count << "\n";
+      out() << "bmoves = " << bmoves_count << "\n";
+      out() << "ots = " << ots << "\n";
+      out() << "mts = " << mts << "\n";
+      out() << "ts = " << (ots - mts) + (mts * 5) << "\n";
+      out() << "SIMDs = " << simds << "\n";
+      out() << "tgates = " << tgates_cnt << "\n";
 
     }
 
@@ -1894,7 +2661,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
 
 
           if(isa<UndefValue>(CI->getArgOperand(iop))){
-            errs() << "WARNING: LLVM IR code has UNDEF values. \n";
+            out() << "WARNING: LLVM IR code has UNDEF values. \n";
             tmpQGateArg.isUndef = true;   
             //exit(1);
           }
@@ -1974,15 +2741,15 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
           //       errs() << "Calc Crit Times\n";
           uint64_t thisTS = calc_critical_time_unbounded(F,thisGate);       
           //update priorityVector
-          priorityVector.push_back(make_pair(pInst,thisTS));
-
+          int n = opIndex[pInst];
+          priorityVector.push_back(make_pair(n,thisTS));
 
-          //add to mapInstSet
-          mapCalls[pInst].name = thisGate;
 
-          op newOp;
-          newOp.name = thisGate;
-          //funcList.push_back(make_pair(pInst,newOp));
+          //add to the per-op state
+          opFunc[n] = thisGate.qFunc;
+          opArgStart[n] = opArgs.size();
+          opNumArgs[n] = thisGate.numArgs;
+          opArgs.insert(opArgs.end(), thisGate.args, thisGate.args + thisGate.numArgs);
 
 
         }    
@@ -2057,9 +2824,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
         for (inst_iterator I = inst_begin(*F), E = inst_end(*F); I != E; ++I) {
           Instruction *Inst = &*I;
           if(CallInst *CI = dyn_cast<CallInst>(Inst)){
-            op newOp;
             string called_func_name = CI->getCalledFunction()->getName();
-            mapCalls.insert(make_pair(Inst, newOp));
             callList.push_back(Inst);
             // errs() << "Added instruction: " << Inst << ": " << called_func_name << "\n";
             if(F->getName() == "measure") {
@@ -2067,11 +2832,12 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
             }
           }
         } 
+        init_op_state();
 
         //traverse in reverse sequence
         //  errs() << "Beginning analysis" << "\n";
         for(vector<Instruction*>::reverse_iterator rit = callList.rbegin(); rit!=callList.rend(); ++rit){
-          //        errs() << "Analyzing: " << mapCalls.find(*rit)->second.name.qFunc->getName() << "\n";
+          //        errs() << "Analyzing: " << opFunc[opIndex[*rit]]->getName() << "\n";
           //        errs() << "Analyzing: " << dyn_cast<CallInst>(*rit)->getCalledFunction()->getName() << "\n";
           analyzeCallInst(F,(*rit));  
         }
@@ -2090,9 +2856,7 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
         for(vector<InstPri>::reverse_iterator vit = priorityVector.rbegin(); vit!=priorityVector.rend(); ++vit){
           //get qgate
           //    errs() << "priority scheduling..." << "\n";
-          map<Instruction*, op>::iterator mit = mapCalls.find((*vit).first);
-          assert(mit!=mapCalls.end() && "Instruction Not Found in MapInstSet.");
-          qGate thisGate = (*mit).second.name;
+          assert((*vit).first < (int)callList.size() && "Instruction Not Found in callList.");
           //    if(!(F->getName() == "main")) { 
           //        errs() << "CHECK: " << thisGate.qFunc->getName() << "\n";
           //      if(hasPrimitivesOnly)
@@ -2114,80 +2878,315 @@ void GenLPFSSched::find_lp(Function* F, int pathNum){
       }
 
 
+      // Metrics of the schedule just generated, for GenCGSIMDSchedule
+      void GenLPFSSched::get_leaf_metrics(LeafMetrics& m){
+        m.width = simds;
+        m.ots = ots;
+        m.mts = 0;
+        m.moves = move_schedule.size();
+        m.tgates = tgates_cnt;
+        m.mlist.assign(ots, 0);
+        int lastTS = -1;
+        for(multimap<int, move>::iterator mit = move_schedule.begin(); mit != move_schedule.end(); mit++){
+          if((*mit).first != lastTS)
+            m.mts++;
+          lastTS = (*mit).first;
+          if((*mit).first < ots)
+            m.mlist[(*mit).first]++;
+        }
+      }
+
+      // Schedule F for every (k, d) of the sweep; what is printed for the
+      // c-th one is left in outs[c], its binary schedule in bins[c] and its
+      // metrics in metrics[c] if F is a leaf
+      void GenLPFSSched::schedule_function(Function *F, vector<string>& outs, vector<string>& bins, vector<LeafMetrics>& metrics) {
+        funcQbits.clear();
+        funcArgs.clear();
+        funcList.clear();
+        mapInstSet.clear();
+        priorityVector.clear();
+        longPath.clear();
+        clear_op_state();
+        qubitMap.clear();
+
+        getFunctionArguments(F);
+
+        // count the critical resources for this function
+        if (DetermineLeafFunction(F)){
+          CountCriticalFunctionResources(F);
+        }
+        vector<Function*>::iterator vit = find(isLeaf.begin(), isLeaf.end(), F);
+        bool leaf = (vit != isLeaf.end());
+
+        // schedules of this body with the same parameters kept by an
+        // earlier run (-lpfs-cache) are reused, the dependency graph is only
+        // built if one of the sweep is not
+        vector<string> keys(sweep.size());
+        vector<CachedLeaf> cached(sweep.size());
+        vector<char> hit(sweep.size(), 0);
+        bool allHit = leaf && cache;
+        if(leaf && cache){
+          string body = leaf_key(F);
+          for(unsigned c = 0; c < sweep.size(); c++){
+            stringstream key;
+            key << body << "/" << LPFS_POLICY << "," << sweep[c].first << "," << sweep[c].second
+              << "," << SIMD_L << "," << REFILL << "," << OPP_SIMD
+              << "," << LOCAL_MEM << "," << LOCAL_Q << "," << LOCAL_WINDOW
+              << "," << RCP_W_OP << "," << RCP_W_DIST << "," << RCP_W_SLACK
+              << "/" << METRICS << FULL_SCHED << MOVES_SCHED << LOCAL_MOVES_SCHED << !LPFS_BIN.empty();
+            keys[c] = key.str();
+            hit[c] = cache->find(keys[c], cached[c]);
+            allHit = allHit && hit[c];
+          }
+        }
+        if(leaf && !allHit)
+          build_dag(F, LPFS_POLICY == POLICY_LPFS ? (int) SIMD_L : 0);
+
+        raw_ostream* prevOut = outStream;
+        outs.assign(sweep.size(), string());
+        bins.assign(sweep.size(), string());
+        metrics.assign(sweep.size(), LeafMetrics());
+        for(unsigned c = 0; c < sweep.size(); c++){
+          simdK = sweep[c].first;
+          simdD = sweep[c].second;
+          raw_string_ostream os(outs[c]);
+          outStream = &os;
+
+          localMemSizeMap.clear();
+          regionSizeMap.clear();
+          for(int k = 1; k <= (int) simdK; k++){
+            localMemSizeMap.insert(make_pair(k*10, 0));
+            regionSizeMap.insert(make_pair(k, 0));
+          }
+          mts = 0;    
+          ots = 0;    
+          simds = 0; 
+          tgates_cnt = 0;   
+
+          if(leaf && LPFS_POLICY == POLICY_LPFS){
+            out() << "\nLPFS:\n";
+            out() << "Function: " << F->getName() 
+              << " (sched: lpfs, k: " << simdK 
+              << ", d: " << simdD 
+              << " l: " << SIMD_L 
+              << ", opp: " << OPP_SIMD 
+              << ", refill: " << REFILL 
+              << ") \n"; 
+            out() << "==================================================================\n";
+            if(!hit[c])
+              lpfs(F, 0, SIMD_L, REFILL, OPP_SIMD);
+          }
+          else if(leaf && LPFS_POLICY == POLICY_RCP){
+            out() << "\nRCP:\n";
+            out() << "Function: " << F->getName() 
+              << " (sched: rcp, k: " << simdK 
+              << ", d: " << simdD 
+              << ", w_op: " << RCP_W_OP 
+              << ", w_dist: " << RCP_W_DIST 
+              << ", w_slack: " << RCP_W_SLACK 
+              << ") \n"; 
+            out() << "==================================================================\n";
+            if(!hit[c])
+              rcp(F);
+          }
+          else if(leaf){
+            bool late = (LPFS_POLICY == POLICY_ALAP);
+            out() << (late ? "\nALAP:\n" : "\nACAP:\n");
+            out() << "Function: " << F->getName() 
+              << " (sched: " << (late ? "alap" : "acap") << ", k: " << simdK 
+              << ", d: " << simdD 
+              << ") \n"; 
+            out() << "==================================================================\n";
+            if(!hit[c])
+              target_sched(F, late ? opAlap : opAcap);
+          }
+          os.flush();
+          size_t header = outs[c].size();
+
+          int op_count = callList.size();
+          if(hit[c]){
+            out() << cached[c].text;
+            metrics[c] = cached[c].metrics;
+            if(!LPFS_BIN.empty())
+              bins[c] = renameBinBlock(cached[c].bin, F->getName());
+          }
+          else if(leaf){
+            get_leaf_metrics(metrics[c]);
+            if(!LPFS_BIN.empty())
+              write_bin_schedule(F, op_count, bins[c]);
+          }
+
+          if(!(schedule.empty())) {
+            if(METRICS)
+              print_schedule_metrics(F,op_count);
+            if(FULL_SCHED)
+              print_schedule(F,op_count);
+            if(MOVES_SCHED)
+              print_moves_schedule(F,op_count);
+            if(LOCAL_MOVES_SCHED)
+              print_local_moves_schedule(F, op_count);
+          }
+          os.flush();
+          if(leaf && cache && !hit[c]){
+            CachedLeaf entry;
+            entry.metrics = metrics[c];
+            entry.text = outs[c].substr(header);
+            entry.bin = bins[c];
+            cache->insert(keys[c], entry);
+          }
+          schedule.clear();
+          move_schedule.clear();
+          local_move_schedule.clear();
+          active_qubits.clear();
+          os.flush();
+        }
+        outStream = prevOut;
+        cleanupCurrArrParGates();
+      }
+
+      // A scheduler of its own for each leaf worker
+      GenLPFSSched* GenLPFSSched::new_leaf_worker(){
+        GenLPFSSched* sched = new GenLPFSSched();
+        sched->sweep = sweep;
+        sched->cache = cache;
+        sched->init_gate_names();
+        sched->init_gates_as_functions();
+        return sched;
+      }
+
+      void GenLPFSSched::run_leaf(LeafJob& job){
+        schedule_function(job.F, job.out, job.bin, job.metrics);
+        job.isLeaf = (find(isLeaf.begin(), isLeaf.end(), job.F) != isLeaf.end());
+      }
+
+
       bool GenLPFSSched::runOnModule (Module &M) {
         init_gate_names();
         init_gates_as_functions();
-        int timeStep = 0; 
-        errs() << "M: $::SIMD_K=" << RES_CONSTRAINT <<"; $::SIMD_D=" << DATA_CONSTRAINT << "; $::SIMD_L=" << SIMD_L << "\n"; 
+
+        string errorInfo;
+        raw_fd_ostream* outFile = NULL;
+        if(!LPFS_OUT.empty()){
+          outFile = new raw_fd_ostream(LPFS_OUT.c_str(), errorInfo);
+          if(errorInfo.empty())
+            outStream = outFile;
+          else
+            errs() << "Error: Could not open " << LPFS_OUT << ": " << errorInfo << "\n";
+        }
+        LeafScheduleInfo& leafInfo = getAnalysis<LeafScheduleInfo>();
+
+        LeafCache leafCache;
+        if(!LPFS_CACHE.empty()){
+          cache = &leafCache;
+          if(!leafCache.load(LPFS_CACHE)){
+            errs() << "Warning: Ignoring unreadable leaf schedule cache " << LPFS_CACHE << "\n";
+            leafCache.entries.clear();
+          }
+        }
+
+        // -lpfs-sweep=k1:d1,k2:d2,... or else the single k and d given
+        sweep.clear();
+        stringstream sweepList(LPFS_SWEEP);
+        string entry;
+        while(getline(sweepList, entry, ',')){
+          stringstream es(entry);
+          unsigned k, d;
+          char colon;
+          if(!(es >> k >> colon >> d) || colon != ':' || k == 0)
+            errs() << "Ignoring -lpfs-sweep entry '" << entry << "'\n";
+          else if(k > MAX_RES_CONSTRAINT)
+            errs() << "Ignoring -lpfs-sweep entry '" << entry << "', k is at most " << MAX_RES_CONSTRAINT << "\n";
+          else
+            sweep.push_back(make_pair(k, d));
+        }
+        if(sweep.empty())
+          sweep.push_back(make_pair((unsigned) RES_CONSTRAINT, (unsigned) DATA_CONSTRAINT));
+
+        //binary schedules of configs whose -lpfs-bin paths are the same
+        //share a file
+        vector<raw_fd_ostream*> binFiles(sweep.size(), (raw_fd_ostream*) NULL);
+        map<string, raw_fd_ostream*> binByPath;
+        for(unsigned c = 0; c < sweep.size() && !LPFS_BIN.empty(); c++){
+          string path = binPath(LPFS_BIN, sweep[c].first, sweep[c].second);
+          map<string, raw_fd_ostream*>::iterator bit = binByPath.find(path);
+          if(bit != binByPath.end()){
+            binFiles[c] = (*bit).second;
+            continue;
+          }
+          string binError;
+          raw_fd_ostream* binFile = new raw_fd_ostream(path.c_str(), binError, raw_fd_ostream::F_Binary);
+          if(!binError.empty()){
+            errs() << "Error: Could not open " << path << ": " << binError << "\n";
+            delete binFile;
+            binFile = NULL;
+          }
+          else{
+            uint32_t version[2] = {2, 0};
+            binFile->write("LPFSBIN1", 8);
+            binFile->write((const char*) version, sizeof(version));
+          }
+          binByPath[path] = binFiles[c] = binFile;
+        }
+
+        //the first schedule is printed as functions are scheduled, the others
+        //are kept and printed after it, each with its own header
+        vector<string> sweepOut(sweep.size());
+        out() << "M: $::SIMD_K=" << sweep[0].first <<"; $::SIMD_D=" << sweep[0].second << "; $::SIMD_L=" << SIMD_L << "\n"; 
+
+        unsigned threads = LPFS_THREADS;
+        if(threads == 0)
+          threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
 
         // iterate over all functions, and over all instructions in those functions
         CallGraphNode* rootNode = getAnalysis<CallGraph>().getRoot();
+        vector<Function*> funcs;
+        vector<LeafJob> jobs;
+        map<Function*, unsigned> jobIndex;
         //Post-order
-        for (scc_iterator<CallGraphNode*> sccIb = scc_begin(rootNode), E = scc_end(rootNode); sccIb != E; ++sccIb) {
-          const std::vector<CallGraphNode*> &nextSCC = *sccIb;
-          for (std::vector<CallGraphNode*>::const_iterator nsccI = nextSCC.begin(), E = nextSCC.end(); nsccI != E; ++nsccI) {
-            Function *F = (*nsccI)->getFunction();      
-            if(F && !F->isDeclaration()){
-
-              funcQbits.clear();
-              funcArgs.clear();
-              mapCalls.clear();
-              funcList.clear();
-              mapInstSet.clear();
-              priorityVector.clear();
-              longPath.clear();
-              callList.clear();
-              qubitMap.clear();
-              localMemSizeMap.clear();
-              regionSizeMap.clear();
-              mts = 0;    
-              ots = 0;    
-              simds = 0; 
-              tgates_cnt = 0;   
-
-              getFunctionArguments(F);
-
-              for(int k = 1; k <= (int) RES_CONSTRAINT; k++){
-                localMemSizeMap.insert(make_pair(k*10, 0));
-                regionSizeMap.insert(make_pair(k, 0));
-              }
-
-              // count the critical resources for this function
-              if (DetermineLeafFunction(F)){
-                CountCriticalFunctionResources(F);
-              }
-              vector<Function*>::iterator vit = find(isLeaf.begin(), isLeaf.end(), F);
-              if(vit != isLeaf.end()){
-                errs() << "\nLPFS:\n";
-                errs() << "Function: " << F->getName() 
-                  << " (sched: lpfs, k: " << RES_CONSTRAINT 
-                  << ", d: " << DATA_CONSTRAINT 
-                  << " l: " << SIMD_L 
-                  << ", opp: " << OPP_SIMD 
-                  << ", refill: " << REFILL 
-                  << ") \n"; 
-                errs() << "==================================================================\n";
-                lpfs(F, timeStep, SIMD_L, REFILL, OPP_SIMD);
-              }
-
-              int op_count = callList.size();
-              if(!(schedule.empty())) {
-                if(METRICS)
-                  print_schedule_metrics(F,op_count);
-                if(FULL_SCHED)
-                  print_schedule(F,op_count);
-                if(MOVES_SCHED)
-                  print_moves_schedule(F,op_count);
-                if(LOCAL_MOVES_SCHED)
-                  print_local_moves_schedule(F, op_count);
-              }
-              schedule.clear();
-              move_schedule.clear();
-              local_move_schedule.clear();
-              active_qubits.clear();
-              cleanupCurrArrParGates();
-            }
+        collect_leaves(rootNode, threads, funcs, jobs, jobIndex);
+
+        //Leaf modules are independent of each other and are scheduled
+        //concurrently; their schedules are printed in call graph order
+        if(!jobs.empty())
+          run_leaves(*this, jobs, min(threads, (unsigned) jobs.size()));
+
+        for(vector<Function*>::iterator fit = funcs.begin(); fit != funcs.end(); ++fit){
+          Function *F = *fit;
+          vector<string> outs;
+          vector<string> bins;
+          vector<LeafMetrics> metrics;
+          map<Function*, unsigned>::iterator jit = jobIndex.find(F);
+          if(jit != jobIndex.end()){
+            LeafJob& job = jobs[(*jit).second];
+            outs.swap(job.out);
+            bins.swap(job.bin);
+            metrics.swap(job.metrics);
+            if(job.isLeaf)
+              isLeaf.push_back(F);
           }
+          else
+            schedule_function(F, outs, bins, metrics);
+          if(find(isLeaf.begin(), isLeaf.end(), F) != isLeaf.end())
+            for(unsigned c = 0; c < sweep.size(); c++)
+              leafInfo.config(sweep[c].first, sweep[c].second)[F->getName()] = metrics[c];
+          out() << outs[0];
+          for(unsigned c = 1; c < sweep.size(); c++)
+            sweepOut[c] += outs[c];
+          for(unsigned c = 0; c < sweep.size(); c++)
+            if(binFiles[c])
+              binFiles[c]->write(bins[c].data(), bins[c].size());
+        }
+        for(unsigned c = 1; c < sweep.size(); c++)
+          out() << "M: $::SIMD_K=" << sweep[c].first <<"; $::SIMD_D=" << sweep[c].second << "; $::SIMD_L=" << SIMD_L << "\n" << sweepOut[c]; 
+        outStream = NULL;
+        delete outFile;
+        if(cache){
+          errs() << "Leaf schedule cache: " << leafCache.hits << " reused, " << leafCache.misses << " generated\n";
+          if(!leafCache.used.empty() && !leafCache.save(LPFS_CACHE, (uint64_t) LPFS_CACHE_MB << 20))
+            errs() << "Error: Could not write " << LPFS_CACHE << "\n";
+          cache = NULL;
         }
+        for(map<string, raw_fd_ostream*>::iterator bit = binByPath.begin(); bit != binByPath.end(); ++bit)
+          delete (*bit).second;
         return false;
       } // End runOnModule
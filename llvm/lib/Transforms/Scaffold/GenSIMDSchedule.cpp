@@ -8,11 +8,13 @@
 // Coarse-grained scheduling for non-leaf modules
 // Get T gate proportion within schedule length
 // Cleaned up the code
+// Leaf modules can be scheduled on several threads (-simd-threads)
 //===----------------------------------------------------------------------===//
 
 #define DEBUG_TYPE "GenSIMDSched"
 #include <vector>
 #include <limits>
+#include <unistd.h>
 #include "llvm/Pass.h"
 #include "llvm/Function.h"
 #include "llvm/Module.h"
@@ -31,6 +33,7 @@
 #include "llvm/Constants.h"
 #include "llvm/IntrinsicInst.h"
 #include "llvm/Support/CommandLine.h"
+#include "LeafPool.h"
 
 
 using namespace llvm;
@@ -45,6 +48,10 @@ static cl::opt<unsigned>
 DATA_CONSTRAINT("simd-dconstraint", cl::init(1024), cl::Hidden,
     cl::desc("k in SIMD-k Resource Constrained Scheduling"));
 
+static cl::opt<unsigned>
+SIMD_THREADS("simd-threads", cl::init(1), cl::Hidden,
+    cl::desc("Threads scheduling leaf modules (0: one per core)"));
+
 #define MAX_RES_CONSTRAINT 2000 
 #define SSCHED_THRESH 10000000
 
@@ -127,6 +134,16 @@ namespace {
     uint64_t numGates[MAX_RES_CONSTRAINT];
   };
 
+  // A leaf module scheduled ahead of the call graph walk by a worker thread
+  struct LeafJob{
+    Function* F;
+    bool isLeaf;
+    map<unsigned int, map<int,uint64_t> > qbits; //tableFuncQbits entry of F
+    modularInfo info; //funcInfo entry of F
+    string out; //everything printed while scheduling F
+    LeafJob(Function* f):F(f),isLeaf(false),qbits(),info(),out() { }
+  };
+
   struct GenSIMDSched : public ModulePass {
     static char ID; // Pass identification
 
@@ -158,7 +175,11 @@ namespace {
 
     bool isFirstMeas;
 
-    GenSIMDSched() : ModulePass(ID) {}
+    raw_ostream* outStream; //where schedules are printed, errs() if NULL
+
+    GenSIMDSched() : ModulePass(ID), outStream(NULL) {}
+
+    raw_ostream& out() { return outStream ? *outStream : errs(); }
 
     // Get arguments from operation
     bool backtraceOperand(Value* opd, int opOrIndex);
@@ -237,9 +258,9 @@ namespace {
 
     void print_qgateArg(qGateArg qg)
     {
-      errs()<< "Printing QGate Argument:\n";
-      if(qg.argPtr) errs() << "  Name: "<<qg.argPtr->getName()<<"\n";
-      errs() << "  Arg Num: "<<qg.argNum<<"\n"
+      out()<< "Printing QGate Argument:\n";
+      if(qg.argPtr) out() << "  Name: "<<qg.argPtr->getName()<<"\n";
+      out() << "  Arg Num: "<<qg.argNum<<"\n"
         << "  isUndef: "<<qg.isUndef
         << "  isQbit: "<<qg.isQbit
         << "  isAbit: "<<qg.isAbit
@@ -256,6 +277,10 @@ namespace {
 
     void CountCriticalFunctionResources (Function *F);
 
+    void schedule_function(Function *F);
+    GenSIMDSched* new_leaf_worker();
+    void run_leaf(LeafJob& job);
+
     bool runOnModule (Module &M);    
 
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
@@ -264,6 +289,7 @@ namespace {
     }
 
   }; // End of struct GenSIMDSched
+
 } // End of anonymous namespace
 
 
@@ -525,32 +551,32 @@ void GenSIMDSched::init_critical_path_algo(Function* F){
 
 void GenSIMDSched::print_funcQbits(){
   for(map<string, map<int,uint64_t> >::iterator mIter = funcQbits.begin(); mIter!=funcQbits.end(); ++mIter){
-    errs() << "Var "<< (*mIter).first << " ---> ";
+    out() << "Var "<< (*mIter).first << " ---> ";
     for(map<int,uint64_t>::iterator indexIter  = (*mIter).second.begin(); indexIter!=(*mIter).second.end(); ++indexIter){
-      errs() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
+      out() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
     }
-    errs() << "\n";
+    out() << "\n";
   }
 }
 
 void GenSIMDSched::print_ArrParGates(){
-  errs() << "Printing ArrParGate Vector \n";
+  out() << "Printing ArrParGate Vector \n";
   int j = 0;
   for(vector<ArrParGates>::iterator vit = currArrParGates.begin(); vit!=currArrParGates.end(); ++vit, j++){
-    errs() << j << " -- ";
+    out() << j << " -- ";
     for(unsigned int i=0;i<RES_CONSTRAINT;i++)
-      errs() << (*vit).typeOfGate[i] << " : " << (*vit).numGates[i] << " ; ";
-    errs() << "\n";
+      out() << (*vit).typeOfGate[i] << " : " << (*vit).numGates[i] << " ; ";
+    out() << "\n";
   }
 
 }
 
 void GenSIMDSched::print_qgate(qGate qg){
-  errs() << qg.qFunc->getName() << " : ";
+  out() << qg.qFunc->getName() << " : ";
   for(int i=0;i<qg.numArgs;i++){
-    errs() << qg.args[i].name << qg.args[i].index << ", "  ;
+    out() << qg.args[i].name << qg.args[i].index << ", "  ;
   }
-  errs() << "\n";
+  out() << "\n";
 }
 
 uint64_t GenSIMDSched::get_ts_to_schedule(Function* F, uint64_t ts, Function* funcToSched, uint64_t& first_step){
@@ -879,13 +905,13 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
 
 
   void GenSIMDSched::print_critical_info(){
-    errs() << "Timesteps = " << currArrParGates.size() << "\n";
+    out() << "Timesteps = " << currArrParGates.size() << "\n";
     for(unsigned int i = 0; i<currArrParGates.size(); i++){
-      errs() << i << " :";
+      out() << i << " :";
       for(unsigned int k=0;k<RES_CONSTRAINT;k++){      
-        errs() << currArrParGates[i].typeOfGate[k] << " : " << currArrParGates[i].numGates[k] << " / ";
+        out() << currArrParGates[i].typeOfGate[k] << " : " << currArrParGates[i].numGates[k] << " / ";
       }
-      errs() << "\n";
+      out() << "\n";
     }
   }
 
@@ -900,9 +926,9 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
           maxGates[(*vit).typeOfGate[i]] = (*vit).numGates[i];
     }
 
-    errs() << "\nMax Parallelism Factors: \n";
+    out() << "\nMax Parallelism Factors: \n";
     for(int k = 0; k<NUM_QGATES-1; k++){ //do not print 'All'
-      errs() << gate_name[k] << " : " << maxGates[k] << "\n";
+      out() << gate_name[k] << " : " << maxGates[k] << "\n";
     }  
   }
 
@@ -950,36 +976,36 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
 
     if(tmpGateName.find("llvm.")!=string::npos)
       tmpGateName = tmpGateName.substr(5);
-    errs() << ts << " " << tmpGateName;
+    out() << ts << " " << tmpGateName;
     for(int i = 0; i<qg.numArgs; i++){
-      errs() << " " << qg.args[i].name;
+      out() << " " << qg.args[i].name;
       if(qg.args[i].index != -1)
-        errs() << qg.args[i].index;
+        out() << qg.args[i].index;
     }
 
     /*
        if(tmpGateName == "PrepX" || tmpGateName == "PrepZ"){
        if(qg.angle > 0)
-       errs() << " 1";
+       out() << " 1";
        else
-       errs() << " 0";
+       out() << " 0";
        }
        else if(tmpGateName == "Rz" || tmpGateName == "Ry" || tmpGateName == "Rx")
-       errs() << " "<<qg.angle;
+       out() << " "<<qg.angle;
      */
 
-    errs() << "\n";
+    out() << "\n";
   }
 
   void GenSIMDSched::print_tableFuncQbits(){
     for(map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator m1 = tableFuncQbits.begin(); m1!=tableFuncQbits.end(); ++m1){
-      errs() << "Function " << (*m1).first->getName() << " \n  ";
+      out() << "Function " << (*m1).first->getName() << " \n  ";
       for(map<unsigned int, map<int, uint64_t> >::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
-        errs() << "\tArg# "<< (*m2).first << " -- ";
+        out() << "\tArg# "<< (*m2).first << " -- ";
         for(map<int, uint64_t>::iterator m3 = (*m2).second.begin(); m3!=(*m2).second.end(); ++m3){
-          errs() << " ; " << (*m3).first << " : " << (*m3).second;
+          out() << " ; " << (*m3).first << " : " << (*m3).second;
         }
-        errs() << "\n";
+        out() << "\n";
       }
     }
   }
@@ -1064,7 +1090,7 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
       }
 
       if(debugGenSIMDSched){
-        errs() << "Before Scheduling: \n";
+        out() << "Before Scheduling: \n";
         print_funcQbits();
       }
 
@@ -1113,10 +1139,10 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
     } // not first MeasX gate
 
     if(debugGenSIMDSched){   
-      errs() << "\nAfter Scheduling: \n";
+      out() << "\nAfter Scheduling: \n";
       print_funcQbits();
       print_critical_info();
-      errs() << "\n";
+      out() << "\n";
     }
 
   }
@@ -1164,7 +1190,7 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
     }
 
     if(debugGenSIMDSched){
-      errs() << "Before Scheduling: \n";
+      out() << "Before Scheduling: \n";
       print_funcQbits();
     }
 
@@ -1200,9 +1226,9 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
 
     if(debugGenSIMDSched)
     {   
-      errs() << "\nAfter Scheduling: \n";
+      out() << "\nAfter Scheduling: \n";
       print_funcQbits();
-      errs() << "\n";
+      out() << "\n";
     }
 
     return max_ts_of_all_args+1;
@@ -1241,7 +1267,7 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
     if(CallInst *CI = dyn_cast<CallInst>(pInst))
     {      
       if(debugGenSIMDSched)
-        errs() << "Call inst: " << CI->getCalledFunction()->getName() << "\n";
+        out() << "Call inst: " << CI->getCalledFunction()->getName() << "\n";
 
       if(CI->getCalledFunction()->getName() == "store_cbit"){   //trace return values
         return;
@@ -1264,7 +1290,7 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
 
 
         if(isa<UndefValue>(CI->getArgOperand(iop))){
-          errs() << "WARNING: LLVM IR code has UNDEF values. \n";
+          out() << "WARNING: LLVM IR code has UNDEF values. \n";
           tmpQGateArg.isUndef = true;   
           //exit(1);
         }
@@ -1322,16 +1348,16 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
       if(allDepQbit.size() > 0){
         if(debugGenSIMDSched)
         {
-          errs() << "\nCall inst: " << CI->getCalledFunction()->getName();        
-          errs() << ": Found all arguments: ";       
+          out() << "\nCall inst: " << CI->getCalledFunction()->getName();        
+          out() << ": Found all arguments: ";       
           for(unsigned int vb=0; vb<allDepQbit.size(); vb++){
             if(allDepQbit[vb].argPtr)
-              errs() << allDepQbit[vb].argPtr->getName() <<" Index: ";
+              out() << allDepQbit[vb].argPtr->getName() <<" Index: ";
 
             //else
-            errs() << allDepQbit[vb].valOrIndex <<" ";
+            out() << allDepQbit[vb].valOrIndex <<" ";
           }
-          errs()<<"\n";
+          out()<<"\n";
 
         }
 
@@ -1469,49 +1495,88 @@ uint64_t GenSIMDSched::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Functio
     }
 
 
+    void GenSIMDSched::schedule_function(Function *F) {
+      //errs() << "SIMD_K " << RES_CONSTRAINT << ", SIMD_D " << DATA_CONSTRAINT << "\n";      
+      out() << "#Function " << F->getName() << "\n";      
+      //errs() << "#Timestep GateName Operand1 Operand2 \n";
+
+      funcQbits.clear();
+      funcArgs.clear();
+      vectCalls.clear();
+      mapInstSet.clear();
+      priorityVector.clear();
+
+      getFunctionArguments(F);
+
+      // count the critical resources for this function
+      CountCriticalFunctionResources(F);
+
+      if(F->getName() == "main"){
+        //print_ArrParGates(F);
+        //errs() << "\n#Num of critical time steps for function main : " << getNumCritSteps(F) << "\n";           
+      }
+
+      //print_critical_info();
+      out() << "#EndFunction\n";
+      cleanupCurrArrParGates(); 
+    }
+
+    // A scheduler of its own for each leaf worker
+    GenSIMDSched* GenSIMDSched::new_leaf_worker(){
+      GenSIMDSched* sched = new GenSIMDSched();
+      sched->init_gate_names();
+      sched->init_gates_as_functions();
+      return sched;
+    }
+
+    void GenSIMDSched::run_leaf(LeafJob& job){
+      raw_string_ostream os(job.out);
+      outStream = &os;
+      schedule_function(job.F);
+      os.flush();
+      outStream = NULL;
+      job.isLeaf = (find(isLeaf.begin(), isLeaf.end(), job.F) != isLeaf.end());
+      job.qbits = tableFuncQbits[job.F];
+      job.info = funcInfo[job.F];
+    }
+
+
     bool GenSIMDSched::runOnModule (Module &M) {
       init_gate_names();
       init_gates_as_functions();
 
+      unsigned threads = SIMD_THREADS;
+      if(threads == 0)
+        threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
       // iterate over all functions, and over all instructions in those functions
       CallGraphNode* rootNode = getAnalysis<CallGraph>().getRoot();
+      vector<Function*> funcs;
+      vector<LeafJob> jobs;
+      map<Function*, unsigned> jobIndex;
 
       //Post-order
-      for (scc_iterator<CallGraphNode*> sccIb = scc_begin(rootNode), E = scc_end(rootNode); sccIb != E; ++sccIb) {
-        const std::vector<CallGraphNode*> &nextSCC = *sccIb;
-        for (std::vector<CallGraphNode*>::const_iterator nsccI = nextSCC.begin(), E = nextSCC.end(); nsccI != E; ++nsccI) {
-          Function *F = (*nsccI)->getFunction();      
-
-          if(F && !F->isDeclaration()){
-            //errs() << "SIMD_K " << RES_CONSTRAINT << ", SIMD_D " << DATA_CONSTRAINT << "\n";      
-            errs() << "#Function " << F->getName() << "\n";      
-            //errs() << "#Timestep GateName Operand1 Operand2 \n";
-
-            funcQbits.clear();
-            funcArgs.clear();
-            vectCalls.clear();
-            mapInstSet.clear();
-            priorityVector.clear();
-
-            getFunctionArguments(F);
-
-            // count the critical resources for this function
-            CountCriticalFunctionResources(F);
-
-            if(F->getName() == "main"){
-              //print_ArrParGates(F);
-              //errs() << "\n#Num of critical time steps for function main : " << getNumCritSteps(F) << "\n";           
-            }
-
-            //print_critical_info();
-            errs() << "#EndFunction\n";
-            cleanupCurrArrParGates(); 
-          }
-          else{
-            if(debugGenSIMDSched)
-              errs() << "WARNING: Ignoring external node or dummy function.\n";
-          }
+      collect_leaves(rootNode, threads, funcs, jobs, jobIndex, debugGenSIMDSched ? &out() : NULL);
+
+      //Leaf modules are independent of each other and are scheduled
+      //concurrently; their results are merged in call graph order, before
+      //the coarse-grained scheduling of the functions calling them
+      if(!jobs.empty())
+        run_leaves(*this, jobs, min(threads, (unsigned) jobs.size()));
+
+      for(vector<Function*>::iterator fit = funcs.begin(); fit != funcs.end(); ++fit){
+        Function *F = *fit;
+        map<Function*, unsigned>::iterator jit = jobIndex.find(F);
+        if(jit != jobIndex.end()){
+          LeafJob& job = jobs[(*jit).second];
+          out() << job.out;
+          if(job.isLeaf)
+            isLeaf.push_back(F);
+          tableFuncQbits[F] = job.qbits;
+          funcInfo[F] = job.info;
         }
+        else
+          schedule_function(F);
       }
       //print_tableFuncQbits();
       //print_parallelism();
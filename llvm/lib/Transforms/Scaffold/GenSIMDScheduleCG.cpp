@@ -34,6 +34,7 @@
 #include "llvm/Constants.h"
 #include "llvm/IntrinsicInst.h"
 #include "llvm/Support/CommandLine.h"
+#include "LeafSchedule.h"
 
 
 using namespace llvm;
@@ -172,8 +173,12 @@ namespace {
     vector<uint64_t> histogramData;
 
     map<string, modularInfo > fileContents;
+    bool leavesFromLPFS; //fileContents came from GenLPFSSchedule, not a file
 
-    GenSIMDSchedCG() : ModulePass(ID) {}
+    unsigned simdK; //k and d of the schedule being generated
+    unsigned simdD;
+
+    GenSIMDSchedCG() : ModulePass(ID), leavesFromLPFS(false), simdK(0), simdD(0) {}
 
     bool backtraceOperand(Value* opd, int opOrIndex);
     void analyzeAllocInst(Function* F,Instruction* pinst);
@@ -188,6 +193,9 @@ namespace {
     bool checkIfIntrinsic(Function* CF);
 
     void read_schedule_file();
+    void read_leaf_metrics(const LeafMetricsMap& leaves);
+    void print_fileContents();
+    void schedule_module(Module &M);
 
     void init_gate_names(){
       gate_name[_CNOT] = "CNOT";
@@ -277,6 +285,7 @@ namespace {
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesAll();  
       AU.addRequired<CallGraph>();    
+      AU.addRequired<LeafScheduleInfo>();
     }
 
   }; // End of struct GenSIMDSchedCG
@@ -529,7 +538,7 @@ void GenSIMDSchedCG::print_ArrParGates(){
   int j = 0;
   for(vector<ArrParGates>::iterator vit = currArrParGates.begin(); vit!=currArrParGates.end(); ++vit, j++){
     errs() << j << " -- ";
-    for(unsigned int i=0;i<RES_CONSTRAINT;i++)
+    for(unsigned int i=0;i<simdK;i++)
       errs() << (*vit).typeOfGate[i] << " : " << (*vit).numGates[i] << " ; ";
     errs() << "\n";
   }
@@ -608,7 +617,7 @@ uint64_t GenSIMDSchedCG::get_ts_to_schedule(Function* F, uint64_t ts, Function*
    */
 
   if(ts < totalSched.length+currSched.length){ //might be able to parallelize  
-    if((Win + currSched.width) <= RES_CONSTRAINT) //Hooray, can be parallelized
+    if((Win + currSched.width) <= simdK) //Hooray, can be parallelized
     {
       //first_step = totalSched.length; //where the func got scheduled
       first_step = max(ts,totalSched.length); //where the func got scheduled
@@ -747,10 +756,10 @@ uint64_t GenSIMDSchedCG::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Funct
     int searchFuncIndex = funcIndex+c*20;
 
     for(uint64_t i = ts; (i<currArrParGates.size() && !foundEntry); i++){
-      for(unsigned int j = 0; (j<RES_CONSTRAINT && !foundEntry); j++){
+      for(unsigned int j = 0; (j<simdK && !foundEntry); j++){
         if( (currArrParGates[i].typeOfGate[j] == searchFuncIndex) && 
-            ( (searchFuncIndex == _CNOT && 2*currArrParGates[i].numGates[j] < DATA_CONSTRAINT) || 
-              (searchFuncIndex != _CNOT && currArrParGates[i].numGates[j]< DATA_CONSTRAINT))){
+            ( (searchFuncIndex == _CNOT && 2*currArrParGates[i].numGates[j] < simdD) || 
+              (searchFuncIndex != _CNOT && currArrParGates[i].numGates[j]< simdD))){
           currArrParGates[i].numGates[j] += 1;
           if(!FirstEntrySched){
             first_step = i;
@@ -784,7 +793,7 @@ uint64_t GenSIMDSchedCG::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Funct
             //errs() << "Found T or Tdag \n";
 
             bool prevTgateFound = false;
-            for(unsigned int jcheck=0; jcheck<RES_CONSTRAINT; jcheck++){
+            for(unsigned int jcheck=0; jcheck<simdK; jcheck++){
               if(currArrParGates[i].typeOfGate[jcheck] == _T
                   || currArrParGates[i].typeOfGate[jcheck] == _Tdag)
                 prevTgateFound = true;
@@ -812,7 +821,7 @@ uint64_t GenSIMDSchedCG::get_ts_to_schedule_leaf(Function* F, uint64_t ts, Funct
       //add entry to vectArrParGates
 
       ArrParGates tmpArrPar; //initialize
-      for(unsigned int k=0;k<RES_CONSTRAINT; k++){
+      for(unsigned int k=0;k<simdK; k++){
         tmpArrPar.typeOfGate[k] = -1;
         tmpArrPar.numGates[k] = 0;
       }
@@ -881,7 +890,7 @@ void GenSIMDSchedCG::save_blackbox_info(Function* F){
   if(vit==isLeaf.end()) //not a leaf
     funcIsLeaf=false;
 
-  errs() << "SIMD k="<<RES_CONSTRAINT<<" d=" << DATA_CONSTRAINT << " " << F->getName() << " " << tmpMod.width << " " << tmpMod.length << " " << tmpMod.moves << " " << tmpMod.mts << " leaf= " << funcIsLeaf << "\n";
+  errs() << "SIMD k="<<simdK<<" d=" << simdD << " " << F->getName() << " " << tmpMod.width << " " << tmpMod.length << " " << tmpMod.moves << " " << tmpMod.mts << " leaf= " << funcIsLeaf << "\n";
 
 }
 
@@ -890,7 +899,7 @@ void GenSIMDSchedCG::print_critical_info(){
   errs() << "Timesteps = " << currArrParGates.size() << "\n";
   for(unsigned int i = 0; i<currArrParGates.size(); i++){
     errs() << i << " :";
-    for(unsigned int k=0;k<RES_CONSTRAINT;k++){      
+    for(unsigned int k=0;k<simdK;k++){      
       errs() << currArrParGates[i].typeOfGate[k] << " : " << currArrParGates[i].numGates[k] << " / ";
     }
     errs() << "\n";
@@ -903,7 +912,7 @@ void GenSIMDSchedCG::print_parallelism(Function* F){
     maxGates[k] = 0;
 
   for(vector<ArrParGates>::iterator vit = currArrParGates.begin(); vit!=currArrParGates.end(); ++vit){
-    for(unsigned int i = 0; i<RES_CONSTRAINT; i++)
+    for(unsigned int i = 0; i<simdK; i++)
       if((*vit).numGates[i] > maxGates[(*vit).typeOfGate[i]])
         maxGates[(*vit).typeOfGate[i]] = (*vit).numGates[i];
   }
@@ -1231,7 +1240,30 @@ void GenSIMDSchedCG::read_schedule_file(){
   else
     errs() << "Error: Could not open comm_aware_schedule.txt file.\n";
 
-  //print fileContents
+  print_fileContents();
+}
+
+// Same as read_schedule_file, from the leaf schedules of GenLPFSSchedule;
+// every move timestep costs MOVE_WEIGHT extra timesteps
+void GenSIMDSchedCG::read_leaf_metrics(const LeafMetricsMap& leaves){
+  for(LeafMetricsMap::const_iterator lit = leaves.begin(); lit != leaves.end(); ++lit){
+    const LeafMetrics& leaf = (*lit).second;
+    modularInfo mySize;
+    mySize.width = leaf.width;
+    mySize.mts = leaf.mts;
+    mySize.moves = leaf.moves;
+    mySize.tgates = leaf.tgates;
+    mySize.moveInfo = leaf.mlist;
+    mySize.length = (MOVE_WEIGHT) ? leaf.ots + MOVE_WEIGHT * leaf.mts : leaf.ots;
+
+    histogramData.insert(histogramData.end(), mySize.moveInfo.begin(), mySize.moveInfo.end());
+
+    fileContents[(*lit).first] = mySize;
+  }
+  print_fileContents();
+}
+
+void GenSIMDSchedCG::print_fileContents(){
   if(debugGenSIMDSchedCG){
     errs() << "Printing fileContents:\n";
     for(map<string, modularInfo >::iterator mit = fileContents.begin(); mit!=fileContents.end(); ++mit)
@@ -1257,7 +1289,7 @@ bool GenSIMDSchedCG::check_if_pre_schedule(Function* F){
 
   funcInfo[F] = (*foundFn).second;
 
-  errs() << "SIMD k="<<RES_CONSTRAINT<<" d=" << DATA_CONSTRAINT << " " << F->getName() << " " << (*foundFn).second.width << " " << (*foundFn).second.length << " " << (*foundFn).second.moves << " " << (*foundFn).second.mts << " leaf= 1" << " (read from file)\n";
+  errs() << "SIMD k="<<simdK<<" d=" << simdD << " " << F->getName() << " " << (*foundFn).second.width << " " << (*foundFn).second.length << " " << (*foundFn).second.moves << " " << (*foundFn).second.mts << " leaf= 1" << (leavesFromLPFS ? " (from GenLPFSSchedule)\n" : " (read from file)\n");
 
   return true;
 
@@ -1471,8 +1503,41 @@ void GenSIMDSchedCG::init_gates_as_functions(){
 bool GenSIMDSchedCG::runOnModule (Module &M) {
   init_gate_names();
   init_gates_as_functions();
-  read_schedule_file();
 
+  // With GenLPFSSchedule earlier in the same run, every (k, d) it scheduled
+  // is scheduled here from its leaf metrics, each after an "M:" header line.
+  // Otherwise the leaves are read from comm_aware_schedule.txt.
+  LeafScheduleInfo& leafInfo = getAnalysis<LeafScheduleInfo>();
+  if(leafInfo.configs.empty()){
+    simdK = RES_CONSTRAINT;
+    simdD = DATA_CONSTRAINT;
+    read_schedule_file();
+    schedule_module(M);
+    return false;
+  }
+  leavesFromLPFS = true;
+  for(unsigned c = 0; c < leafInfo.configs.size(); c++){
+    simdK = leafInfo.configs[c].first.first;
+    simdD = leafInfo.configs[c].first.second;
+    if(simdK > MAX_RES_CONSTRAINT){
+      errs() << "Skipping k=" << simdK << " d=" << simdD << ", k is at most " << MAX_RES_CONSTRAINT << "\n";
+      continue;
+    }
+    totalSched = modularInfo();
+    currSched = modularInfo();
+    tableFuncQbits.clear();
+    funcInfo.clear();
+    isLeaf.clear();
+    histogramData.clear();
+    fileContents.clear();
+    errs() << "M: $::SIMD_K=" << simdK << "; $::SIMD_D=" << simdD << "\n";
+    read_leaf_metrics(leafInfo.configs[c].second);
+    schedule_module(M);
+  }
+  return false;
+} // End runOnModule
+
+void GenSIMDSchedCG::schedule_module(Module &M) {
   // iterate over all functions, and over all instructions in those functions
   CallGraphNode* rootNode = getAnalysis<CallGraph>().getRoot();
 
@@ -1507,6 +1572,5 @@ bool GenSIMDSchedCG::runOnModule (Module &M) {
       }
     }
   }
+}
 
-  return false;
-} // End runOnModule
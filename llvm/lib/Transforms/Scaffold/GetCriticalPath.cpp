@@ -4,12 +4,16 @@
 //  in callgraph post-order.
 //
 //        This file was created by Scaffold Compiler Working Group
-//
+// Leaf modules can be analyzed on several threads (-critical-path-threads)
+// Qubit variables are interned, their timesteps kept in flat arrays
+// Modules export when each argument qubit is first needed and when it is
+// done; callers compose those instead of treating modules as black boxes
 //===----------------------------------------------------------------------===//
 
 #define DEBUG_TYPE "GetCriticalPath"
 #include <vector>
 #include <limits>
+#include <unistd.h>
 #include "llvm/Pass.h"
 #include "llvm/Function.h"
 #include "llvm/Module.h"
@@ -27,11 +31,23 @@
 #include "llvm/ADT/ilist.h"
 #include "llvm/Constants.h"
 #include "llvm/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "LeafPool.h"
 
 
 using namespace llvm;
 using namespace std;
 
+static cl::opt<unsigned>
+CRITICAL_PATH_THREADS("critical-path-threads", cl::init(1), cl::Hidden,
+    cl::desc("Threads analyzing leaf modules (0: one per core)"));
+
+static cl::opt<bool>
+CRITICAL_PATH_PROFILES("critical-path-profiles", cl::init(true), cl::Hidden,
+    cl::desc("Compose modules by per-qubit arrival and finish times (0: non-leaf modules are black boxes)"));
+
 #define MAX_GATE_ARGS 30
 #define MAX_BT_COUNT 15 //max backtrace allowed - to avoid infinite recursive loops
 #define NUM_QGATES 17
@@ -71,11 +87,98 @@ namespace {
   };
 
   struct qArgInfo{
-    string name;
+    int var; //interned qubit variable, see QbitVar
     int index;
-    qArgInfo(): name("none"), index(-1){ }
+    qArgInfo(): var(-1), index(-1){ }
   };
 
+  // Timesteps of one qubit variable (a qbit array or a qbit) of a function:
+  // of the entire array (the -1 entry), the max over its indices (the -2
+  // entry) and of each index used so far. An index not used yet takes the
+  // value of the entire array when it is first used.
+  struct QbitVar{
+    uint64_t whole;
+    uint64_t maxTs;
+    vector<uint64_t> ts;
+    vector<char> used;
+    map<int, uint64_t> far; //indices outside [0, MAX_DENSE_INDEX)
+
+    static const int MAX_DENSE_INDEX = 1 << 20;
+
+    explicit QbitVar(uint64_t val = 0): whole(val), maxTs(val) { }
+
+    // entry of idx (-1 and -2 included), NULL if not used yet
+    uint64_t* find(int idx){
+      if(idx == -1) return &whole;
+      if(idx == -2) return &maxTs;
+      if(idx < 0 || idx >= MAX_DENSE_INDEX){
+        map<int, uint64_t>::iterator it = far.find(idx);
+        return it == far.end() ? NULL : &(*it).second;
+      }
+      if((unsigned) idx >= used.size() || !used[idx]) return NULL;
+      return &ts[idx];
+    }
+
+    // entry of idx, added with value val if not used yet
+    uint64_t& get(int idx, uint64_t val){
+      if(uint64_t* entry = find(idx))
+        return *entry;
+      if(idx < 0 || idx >= MAX_DENSE_INDEX)
+        return far[idx] = val;
+      if((unsigned) idx >= used.size()){
+        ts.resize(idx+1, 0);
+        used.resize(idx+1, 0);
+      }
+      used[idx] = 1;
+      return ts[idx] = val;
+    }
+
+    // all entries used so far set to val
+    void set_all(uint64_t val){
+      whole = maxTs = val;
+      for(unsigned i = 0; i < ts.size(); i++)
+        if(used[i]) ts[i] = val;
+      for(map<int, uint64_t>::iterator it = far.begin(); it != far.end(); ++it)
+        (*it).second = val;
+    }
+
+    // all entries used so far lowered to at most val
+    void lower_all(uint64_t val){
+      whole = min(whole, val);
+      maxTs = min(maxTs, val);
+      for(unsigned i = 0; i < ts.size(); i++)
+        if(used[i]) ts[i] = min(ts[i], val);
+      for(map<int, uint64_t>::iterator it = far.begin(); it != far.end(); ++it)
+        (*it).second = min((*it).second, val);
+    }
+
+    // all entries used so far raised to at least val
+    void raise_all(uint64_t val){
+      whole = max(whole, val);
+      maxTs = max(maxTs, val);
+      for(unsigned i = 0; i < ts.size(); i++)
+        if(used[i]) ts[i] = max(ts[i], val);
+      for(map<int, uint64_t>::iterator it = far.begin(); it != far.end(); ++it)
+        (*it).second = max((*it).second, val);
+    }
+
+    // entry of idx (-1: all entries) lowered to at most val, -2 entry kept
+    // as the min over indices
+    void lower(int idx, uint64_t val){
+      if(idx == -1){
+        lower_all(val);
+        return;
+      }
+      uint64_t& entry = get(idx, whole);
+      entry = min(entry, val);
+      maxTs = min(maxTs, val);
+    }
+  };
+
+  // Timesteps of the qbit arguments of a function, by argument number; the
+  // latency of a call from its arguments' ready times to their finish times
+  typedef map<unsigned int, QbitVar> QbitSummary;
+
   struct qGate{
     Function* qFunc;
     int numArgs;
@@ -85,6 +188,16 @@ namespace {
     qGate():qFunc(NULL), numArgs(0), asap_num(0), alap_num(0) { }
   };
 
+  // A gate of tsGates: its arguments are gateArgs[argStart .. +numArgs]
+  struct TSGate{
+    uint64_t ts;
+    unsigned argStart;
+    int numArgs;
+    Function* qFunc;
+    TSGate(uint64_t ts, unsigned argStart, int numArgs, Function* qFunc):
+      ts(ts), argStart(argStart), numArgs(numArgs), qFunc(qFunc) { }
+  };
+
   struct ArrParGates{
     uint64_t parallel_gates[NUM_QGATES];
   };
@@ -101,12 +214,24 @@ namespace {
     MaxInfo(): timesteps(0){ }
   };
 
+  // A leaf module analyzed ahead of the call graph walk by a worker thread
+  struct LeafJob{
+    Function* F;
+    uint64_t critPath; //crit_path_f entry of F
+    QbitSummary qbits; //tableFuncQbits entry of F
+    QbitSummary qbitsStart; //tableFuncQbitsStart entry of F
+    allTSParallelism parallelFactor; //funcParallelFactor entry of F
+    MaxInfo maxParallelFactor; //funcMaxParallelFactor entry of F
+    string out; //everything printed while analyzing F
+    LeafJob(Function* f):F(f),critPath(0),qbits(),qbitsStart(),parallelFactor(),maxParallelFactor(),out() { }
+  };
+
   struct GetCriticalPath : public ModulePass {
     static char ID; // Pass identification
 
     string gate_name[NUM_QGATES];
     vector<qGateArg> tmpDepQbit;
-    vector<Value*> vectQbit;
+    DenseSet<Value*> vectQbit;
 
     int btCount; //backtrace count
 
@@ -118,14 +243,20 @@ namespace {
     map<string, allTSParallelism > funcParallelFactor; //string is function name
     map<string, MaxInfo> funcMaxParallelFactor;
 
-    map<string, map<int,uint64_t> > funcQbits; //qbits in current function
-    map<string, map<int,uint64_t> > funcQbitsStart; //start ts of qbits in current function
-    map<string, map<int,uint64_t> > funcQbitsHalf; //qbits in current function
-    map<Function*, map<unsigned int, map<int,uint64_t> > > tableFuncQbits;
-    map<Function*, map<unsigned int, map<int,uint64_t> > > tableFuncQbitsStart;
+    // Qubit variables of the current function, interned by name
+    map<string, int> varIndex;
+    vector<string> varNames;
+    DenseMap<Value*, int> varOf;
+    vector<QbitVar> funcQbits; //qbits in current function, by variable
+    vector<QbitVar> funcQbitsHalf; //qbits in current function, by variable; their first use with -critical-path-profiles
+    map<Function*, QbitSummary> tableFuncQbits;
+    map<Function*, QbitSummary> tableFuncQbitsStart;
     map<string, unsigned int> funcArgs;
 
-    map<uint64_t, vector<qGate> > tsGates;
+    vector<TSGate> tsGates; //gates of a leaf function, in the order scheduled
+    vector<qArgInfo> gateArgs; //and their arguments
+
+    DenseMap<Function*, int> calleeKind; //see calc_critical_time
     map<Function*, uint64_t> crit_path_f; 
 
     allTSParallelism currTS;
@@ -135,7 +266,11 @@ namespace {
 
     uint64_t highestDelay;
 
-    GetCriticalPath() : ModulePass(ID) {}
+    raw_ostream* outStream; //where results are printed, errs() if NULL
+
+    GetCriticalPath() : ModulePass(ID), outStream(NULL) {}
+
+    raw_ostream& out() { return outStream ? *outStream : errs(); }
 
     bool backtraceOperand(Value* opd, int opOrIndex);
     void analyzeAllocInst(Function* F,Instruction* pinst);
@@ -192,19 +327,27 @@ namespace {
 
     void init_gates_as_functions();    
     void init_critical_path_algo(Function* F);
-    void calc_critical_time(Function* F, qGate qg);        
+    void calc_critical_time(Function* F, const qGate& qg);        
+    void print_qbitVars(vector<QbitVar>& vars);
+    void print_qbitVar(QbitVar& var);
     void print_funcQbits();
     void print_funcQbitsHalf();
-    void print_qgate(qGate qg);
+    void print_qgate(const qGate& qg);
     void print_critical_info(string func);
     void calc_max_parallelism_statistic();
-    uint64_t compute_max_ts_of_all_args(qGate qg);
-    uint64_t compute_least_slack(Function* F, qGate qg, uint64_t tmax);
+    uint64_t compute_max_ts_of_all_args(const qGate& qg);
+    uint64_t compute_least_slack(Function* F, const qGate& qg, uint64_t tmax);
 
     void update_critical_info(string currFunc, uint64_t ts, string fname);
 
-    void print_scheduled_gate(qGate qg, uint64_t ts);
-    void addToTSGates(qGate qg, uint64_t ts);
+    void print_scheduled_gate(const qGate& qg, uint64_t ts);
+    void addToTSGates(const qGate& qg, uint64_t ts);
+    void sort_tsGates(uint64_t ct, vector<unsigned>& start, vector<unsigned>& order);
+
+    void add_qbit_var(Value* V);
+    int find_qbit_var(Value* V);
+    int callee_kind(Function* qFunc);
+    void compose_first_use(const qGate& qg, uint64_t base);
 
     void init_funcQbitsHalf(uint64_t i);
     void gen_half_funcQbits(uint64_t ct, uint64_t hct);
@@ -217,9 +360,9 @@ namespace {
 
     void print_qgateArg(qGateArg qg)
     {
-      errs()<< "Printing QGate Argument:\n";
-      if(qg.argPtr) errs() << "  Name: "<<qg.argPtr->getName()<<"\n";
-      errs() << "  Arg Num: "<<qg.argNum<<"\n"
+      out()<< "Printing QGate Argument:\n";
+      if(qg.argPtr) out() << "  Name: "<<qg.argPtr->getName()<<"\n";
+      out() << "  Arg Num: "<<qg.argNum<<"\n"
         << "  isUndef: "<<qg.isUndef
         << "  isQbit: "<<qg.isQbit
         << "  isCbit: "<<qg.isCbit
@@ -229,6 +372,10 @@ namespace {
 
     void CountCriticalFunctionResources (Function *F);
 
+    void analyze_function(Function *F);
+    GetCriticalPath* new_leaf_worker();
+    void run_leaf(LeafJob& job);
+
     bool runOnModule (Module &M);
 
 
@@ -238,6 +385,7 @@ namespace {
     }
 
   }; // End of struct GetCriticalPath
+
 } // End of anonymous namespace
 
 
@@ -265,55 +413,71 @@ void GetCriticalPath::getFunctionArguments(Function* F)
       Type *elementType = argType->getPointerElementType();
       if (elementType->isIntegerTy(16)){ //qbit*
         tmpQArg.isQbit = true;
-        vectQbit.push_back(ait);
-
-        map<int,uint64_t> tmpMap;
-        tmpMap[-1] = 0; //add entry for entire array
-        tmpMap[-2] = 0; //add entry for max
-        funcQbits[argName]=tmpMap;
-
-        map<int,uint64_t> tmpMapHalf;
-        funcQbitsHalf[argName]=tmpMapHalf;
-
+        vectQbit.insert(ait);
+        add_qbit_var(ait);
         funcArgs[argName] = argNum;
 
       }
       else if (elementType->isIntegerTy(1)){ //cbit*
         tmpQArg.isCbit = true;
-        vectQbit.push_back(ait);
+        vectQbit.insert(ait);
         funcArgs[argName] = argNum;
       }
     }
     else if (argType->isIntegerTy(16)){ //qbit
       tmpQArg.isQbit = true;
-      vectQbit.push_back(ait);
-
-      map<int,uint64_t> tmpMap;
-      tmpMap[-1] = 0; //add entry for entire array
-      tmpMap[-2] = 0; //add entry for max
-      funcQbits[argName]=tmpMap;
-
-      map<int,uint64_t> tmpMapHalf;
-      funcQbitsHalf[argName]=tmpMapHalf;
-
+      vectQbit.insert(ait);
+      add_qbit_var(ait);
       funcArgs[argName] = argNum;
     }
     else if (argType->isIntegerTy(1)){ //cbit
       tmpQArg.isCbit = true;
-      vectQbit.push_back(ait);
+      vectQbit.insert(ait);
       funcArgs[argName] = argNum;
     }
 
   }
 }
 
+// Intern the qbit variable V by name; a variable added again starts over,
+// as entries keyed by name did
+void GetCriticalPath::add_qbit_var(Value* V)
+{
+  string name = V->getName();
+  map<string, int>::iterator it = varIndex.find(name);
+  int var;
+  if(it == varIndex.end()){
+    var = funcQbits.size();
+    varIndex[name] = var;
+    varNames.push_back(name);
+    funcQbits.push_back(QbitVar());
+    funcQbitsHalf.push_back(QbitVar(UINT64_MAX));
+  }
+  else{
+    var = (*it).second;
+    funcQbits[var] = QbitVar();
+    funcQbitsHalf[var] = QbitVar(UINT64_MAX);
+  }
+  varOf[V] = var;
+}
+
+int GetCriticalPath::find_qbit_var(Value* V)
+{
+  DenseMap<Value*, int>::iterator it = varOf.find(V);
+  if(it != varOf.end())
+    return (*it).second;
+  map<string, int>::iterator nit = varIndex.find(V->getName());
+  assert(nit != varIndex.end() && "qbit variable not found"); //should already have an entry for the name of the qbit
+  varOf[V] = (*nit).second;
+  return (*nit).second;
+}
+
 bool GetCriticalPath::backtraceOperand(Value* opd, int opOrIndex)
 {
   if(opOrIndex == 0) //backtrace for operand
   {
     //search for opd in qbit/cbit vector
-    vector<Value*>::iterator vIter=find(vectQbit.begin(),vectQbit.end(),opd);
-    if(vIter != vectQbit.end()){
+    if(vectQbit.count(opd)){
       tmpDepQbit[0].argPtr = opd;
 
       return true;
@@ -440,23 +604,15 @@ void GetCriticalPath::analyzeAllocInst(Function* F, Instruction* pInst){
       Type *elementType = arrayType->getElementType();
       uint64_t arraySize = arrayType->getNumElements();
       if (elementType->isIntegerTy(16)){
-        vectQbit.push_back(AI);
+        vectQbit.insert(AI);
         tmpQArg.isQbit = true;
         tmpQArg.argPtr = AI;
         tmpQArg.valOrIndex = arraySize;
-
-        map<int,uint64_t> tmpMap; //add qbit to funcQbits
-        tmpMap[-1] = 0; //entry for entire array
-        tmpMap[-2] = 0; //entry for max
-        funcQbits[AI->getName()]=tmpMap;
-
-        map<int,uint64_t> tmpMapHalf;
-        funcQbitsHalf[AI->getName()]=tmpMapHalf;
-
+        add_qbit_var(AI); //add qbit to funcQbits
       }
 
       if (elementType->isIntegerTy(1)){
-        vectQbit.push_back(AI); //Cbit added here
+        vectQbit.insert(AI); //Cbit added here
         tmpQArg.isCbit = true;
         tmpQArg.argPtr = AI;
         tmpQArg.valOrIndex = arraySize;
@@ -477,10 +633,8 @@ void GetCriticalPath::init_critical_path_algo(Function* F){
   highestDelay = 0;
 
   //clear tsGates
-  for(map<uint64_t, vector<qGate> >::iterator mit=tsGates.begin(); mit!=tsGates.end(); ++mit){
-    (*mit).second.clear();
-  }
   tsGates.clear();
+  gateArgs.clear();
 
   currTimeStep.clear(); //initialize critical time steps   
 
@@ -499,47 +653,54 @@ void GetCriticalPath::init_critical_path_algo(Function* F){
   currParallelFunc.clear();
 }
 
-void GetCriticalPath::print_funcQbits(){
-  for(map<string, map<int,uint64_t> >::iterator mIter = funcQbits.begin(); mIter!=funcQbits.end(); ++mIter){
-    errs() << "Var "<< (*mIter).first << " ---> ";
-    for(map<int,uint64_t>::iterator indexIter  = (*mIter).second.begin(); indexIter!=(*mIter).second.end(); ++indexIter){
-      errs() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
-    }
-    errs() << "\n";
+void GetCriticalPath::print_qbitVar(QbitVar& var){
+  for(map<int,uint64_t>::iterator farIter = var.far.begin(); farIter!=var.far.end() && (*farIter).first < 0; ++farIter)
+    out() << (*farIter).first << ":"<<(*farIter).second<< "  ";
+  out() << "-2:" << var.maxTs << "  -1:" << var.whole << "  ";
+  for(unsigned i = 0; i < var.ts.size(); i++)
+    if(var.used[i])
+      out() << i << ":"<<var.ts[i]<< "  ";
+  for(map<int,uint64_t>::iterator farIter = var.far.lower_bound(0); farIter!=var.far.end(); ++farIter)
+    out() << (*farIter).first << ":"<<(*farIter).second<< "  ";
+}
+
+void GetCriticalPath::print_qbitVars(vector<QbitVar>& vars){
+  for(unsigned v = 0; v < vars.size(); v++){
+    out() << "Var "<< varNames[v] << " ---> ";
+    print_qbitVar(vars[v]);
+    out() << "\n";
   }
 }
 
+void GetCriticalPath::print_funcQbits(){
+  print_qbitVars(funcQbits);
+}
+
 void GetCriticalPath::print_funcQbitsHalf(){
-  errs() << "Printing funcQbitsHalf ---- \n";
-  for(map<string, map<int,uint64_t> >::iterator mIter = funcQbitsHalf.begin(); mIter!=funcQbitsHalf.end(); ++mIter){
-    errs() << "Var "<< (*mIter).first << " ---> ";
-    for(map<int,uint64_t>::iterator indexIter  = (*mIter).second.begin(); indexIter!=(*mIter).second.end(); ++indexIter){
-      errs() << (*indexIter).first << ":"<<(*indexIter).second<< "  ";
-    }
-    errs() << "\n";
-  }
+  out() << "Printing funcQbitsHalf ---- \n";
+  print_qbitVars(funcQbitsHalf);
 }
 
-void GetCriticalPath::print_qgate(qGate qg){
-  errs() << "--Gate: " << qg.qFunc->getName() << " : ";
+void GetCriticalPath::print_qgate(const qGate& qg){
+  out() << "--Gate: " << qg.qFunc->getName() << " : ";
   for(int i=0;i<qg.numArgs;i++){
-    errs() << qg.args[i].name << " idx=" << qg.args[i].index 
+    out() << varNames[qg.args[i].var] << " idx=" << qg.args[i].index 
       << ", "  ;
   }
-  errs() << "ASAP=" << qg.asap_num << " ALAP=" << qg.alap_num;
-  errs() << "\n";
+  out() << "ASAP=" << qg.asap_num << " ALAP=" << qg.alap_num;
+  out() << "\n";
 }
 
 
 void GetCriticalPath::print_critical_info(string func){
   map<string, allTSParallelism>::iterator fitr = funcParallelFactor.find(func);
   assert(fitr!=funcParallelFactor.end() && "Func not found in funcParFac");
-  errs() << "Timesteps = " << (*fitr).second.timesteps << "\n";
+  out() << "Timesteps = " << (*fitr).second.timesteps << "\n";
   for(unsigned int i = 0; i<(*fitr).second.gates.size(); i++){
-    errs() << i << " :";
+    out() << i << " :";
     for(int k=0;k<NUM_QGATES;k++)
-      errs() << " " << (*fitr).second.gates[i].parallel_gates[k];
-    errs() << "\n";
+      out() << " " << (*fitr).second.gates[i].parallel_gates[k];
+    out() << "\n";
   }
 }
 
@@ -589,10 +750,9 @@ void GetCriticalPath::update_critical_info(string currFunc, uint64_t ts, string
 
 uint64_t GetCriticalPath::find_max_funcQbits(){
   uint64_t max_timesteps = 0;
-  for(map<string, map<int,uint64_t> >::iterator mIter = funcQbits.begin(); mIter!=funcQbits.end(); ++mIter){
-    map<int,uint64_t>::iterator arrIter = (*mIter).second.find(-2);
-    if((*arrIter).second > max_timesteps)
-      max_timesteps = (*arrIter).second;
+  for(unsigned v = 0; v < funcQbits.size(); v++){
+    if(funcQbits[v].maxTs > max_timesteps)
+      max_timesteps = funcQbits[v].maxTs;
   }
 
   return max_timesteps;
@@ -600,55 +760,47 @@ uint64_t GetCriticalPath::find_max_funcQbits(){
 }
 
 void GetCriticalPath::memset_funcQbits(uint64_t val){
-  for(map<string, map<int,uint64_t> >::iterator mIter = funcQbits.begin(); mIter!=funcQbits.end(); ++mIter){
-    for(map<int,uint64_t>::iterator arrIter = (*mIter).second.begin(); arrIter!=(*mIter).second.end();++arrIter)
-      (*arrIter).second = val;
-  }
+  for(unsigned v = 0; v < funcQbits.size(); v++)
+    funcQbits[v].set_all(val);
 }
 
 void GetCriticalPath::memset_funcQbitsHalf(uint64_t val){
-  for(map<string, map<int,uint64_t> >::iterator mIter = funcQbitsHalf.begin(); mIter!=funcQbitsHalf.end(); ++mIter){
-    for(map<int,uint64_t>::iterator arrIter = (*mIter).second.begin(); arrIter!=(*mIter).second.end();++arrIter)
-      (*arrIter).second = val;
-  }
+  for(unsigned v = 0; v < funcQbitsHalf.size(); v++)
+    funcQbitsHalf[v].set_all(val);
 }
 
-void GetCriticalPath::print_scheduled_gate(qGate qg, uint64_t ts){
+void GetCriticalPath::print_scheduled_gate(const qGate& qg, uint64_t ts){
   string tmpGateName = qg.qFunc->getName();
   if(tmpGateName.find("llvm.")!=string::npos)
     tmpGateName = tmpGateName.substr(5);
-  errs() << ts << " : " << tmpGateName;
+  out() << ts << " : " << tmpGateName;
   for(int i = 0; i<qg.numArgs; i++){
     //if(qg.args[i].index != -1)
-    errs() << " " << qg.args[i].name << qg.args[i].index;
+    out() << " " << varNames[qg.args[i].var] << qg.args[i].index;
   }
 
-  errs() << "\n";
+  out() << "\n";
 }
 
 void GetCriticalPath::print_tableFuncQbits(){
-  for(map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator m1 = tableFuncQbits.begin(); m1!=tableFuncQbits.end(); ++m1){
-    errs() << "Function " << (*m1).first->getName() << " \n  ";
-    for(map<unsigned int, map<int, uint64_t> >::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
-      errs() << "\tArg# "<< (*m2).first << " -- ";
-      for(map<int, uint64_t>::iterator m3 = (*m2).second.begin(); m3!=(*m2).second.end(); ++m3){
-        errs() << " ; " << (*m3).first << " : " << (*m3).second;
-      }
-      errs() << "\n";
+  for(map<Function*, QbitSummary>::iterator m1 = tableFuncQbits.begin(); m1!=tableFuncQbits.end(); ++m1){
+    out() << "Function " << (*m1).first->getName() << " \n  ";
+    for(QbitSummary::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
+      out() << "\tArg# "<< (*m2).first << " -- ";
+      print_qbitVar((*m2).second);
+      out() << "\n";
     }
   }
 }
 
 void GetCriticalPath::print_tableFuncQbitsStart(){
-  errs() << "Printing tableFuncQbitsStart\n";
-  for(map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator m1 = tableFuncQbitsStart.begin(); m1!=tableFuncQbitsStart.end(); ++m1){
-    errs() << "Function " << (*m1).first->getName() << " \n  ";
-    for(map<unsigned int, map<int, uint64_t> >::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
-      errs() << "\tArg# "<< (*m2).first << " -- ";
-      for(map<int, uint64_t>::iterator m3 = (*m2).second.begin(); m3!=(*m2).second.end(); ++m3){
-        errs() << " ; " << (*m3).first << " : " << (*m3).second;
-      }
-      errs() << "\n";
+  out() << "Printing tableFuncQbitsStart\n";
+  for(map<Function*, QbitSummary>::iterator m1 = tableFuncQbitsStart.begin(); m1!=tableFuncQbitsStart.end(); ++m1){
+    out() << "Function " << (*m1).first->getName() << " \n  ";
+    for(QbitSummary::iterator m2 = (*m1).second.begin(); m2!=(*m1).second.end(); ++m2){
+      out() << "\tArg# "<< (*m2).first << " -- ";
+      print_qbitVar((*m2).second);
+      out() << "\n";
     }
   }
 }
@@ -657,7 +809,7 @@ void GetCriticalPath::calc_max_parallelism_statistic()
 {
   map<string, allTSParallelism>::iterator fitr = funcParallelFactor.find("main");
   assert(fitr!=funcParallelFactor.end() && "Func not found in funcParFac");
-  errs() << "Timesteps = " << (*fitr).second.timesteps << "\n";
+  out() << "Timesteps = " << (*fitr).second.timesteps << "\n";
 
   uint64_t max_par = 0;
   uint64_t ts_par = 0;
@@ -679,77 +831,89 @@ void GetCriticalPath::calc_max_parallelism_statistic()
 
   }
 
-  errs() << "Max parallelism in types of gates = " << max_par << " in TS: " << ts_par << "\n";
+  out() << "Max parallelism in types of gates = " << max_par << " in TS: " << ts_par << "\n";
 
 }
 
 void GetCriticalPath::print_tsGates()
 {
-  for(map<uint64_t, vector<qGate> >::iterator mit = tsGates.begin(); mit!=tsGates.end(); ++mit){
-    errs() << "TS#"<<(*mit).first << " --> ";
-    for(vector<qGate>::iterator vit = (*mit).second.begin(); vit!=(*mit).second.end();++vit)
-      print_qgate(*vit);
+  vector<unsigned> start, order;
+  uint64_t maxTs = 0;
+  for(unsigned g = 0; g < tsGates.size(); g++)
+    maxTs = max(maxTs, tsGates[g].ts);
+  sort_tsGates(maxTs, start, order);
+  for(uint64_t ts = 0; ts <= maxTs; ts++){
+    if(start[ts] == start[ts+1])
+      continue;
+    out() << "TS#"<< ts << " --> ";
+    for(unsigned o = start[ts]; o < start[ts+1]; o++){
+      const TSGate& g = tsGates[order[o]];
+      qGate qg;
+      qg.qFunc = g.qFunc;
+      qg.numArgs = g.numArgs;
+      for(int j = 0; j < g.numArgs; j++)
+        qg.args[j] = gateArgs[g.argStart + j];
+      print_qgate(qg);
+    }
   }
 
 }
 
-void GetCriticalPath::addToTSGates(qGate qg, uint64_t ts)
+void GetCriticalPath::addToTSGates(const qGate& qg, uint64_t ts)
 {
   if(isLeaf){
     //add to tsGates
-    map<uint64_t, vector<qGate> >::iterator git = tsGates.find(ts);
-    if(git!=tsGates.end()){
-      (*git).second.push_back(qg); //add to vector
-    }
-    else{
-      vector<qGate> tmpVect;
-      tmpVect.push_back(qg);
-      tsGates[ts] = tmpVect; //add to map	
-    } 
+    tsGates.push_back(TSGate(ts, gateArgs.size(), qg.numArgs, qg.qFunc));
+    gateArgs.insert(gateArgs.end(), qg.args, qg.args + qg.numArgs);
   } //isLeaf
 }
 
-uint64_t GetCriticalPath::compute_max_ts_of_all_args(qGate qg)
+// Gates of tsGates at timestep ts (up to ct) are order[start[ts] .. 
+// start[ts+1]], in the order they were scheduled
+void GetCriticalPath::sort_tsGates(uint64_t ct, vector<unsigned>& start, vector<unsigned>& order)
+{
+  start.assign(ct+2, 0);
+  for(unsigned g = 0; g < tsGates.size(); g++)
+    if(tsGates[g].ts <= ct)
+      start[tsGates[g].ts+1]++;
+  for(uint64_t ts = 0; ts <= ct; ts++)
+    start[ts+1] += start[ts];
+  order.resize(start[ct+1]);
+  vector<unsigned> next(start.begin(), start.end()-1);
+  for(unsigned g = 0; g < tsGates.size(); g++)
+    if(tsGates[g].ts <= ct)
+      order[next[tsGates[g].ts]++] = g;
+}
+
+uint64_t GetCriticalPath::compute_max_ts_of_all_args(const qGate& qg)
 {
 
   uint64_t max_ts_of_all_args = 0;
 
   //find last timestep for all arguments of qgate
   for(int i=0;i<qg.numArgs; i++){
-    map<string, map<int,uint64_t> >::iterator mIter = funcQbits.find(qg.args[i].name);
-    assert(mIter!=funcQbits.end()); //should already have an entry for the name of the qbit
+    QbitVar& qbit = funcQbits[qg.args[i].var];
 
     int argIndex = qg.args[i].index;
 
-    //find the index of argument in the map<int,int>
+    //find the index of argument
     if(argIndex == -1) //operation on entire array
     {
       //find max for the array
-      map<int,uint64_t>::iterator indexIter = (*mIter).second.find(-2);
-      if((*indexIter).second > max_ts_of_all_args)
-        max_ts_of_all_args = (*indexIter).second;	  
+      if(qbit.maxTs > max_ts_of_all_args)
+        max_ts_of_all_args = qbit.maxTs;	  
     }
     else
     {
-      map<int,uint64_t>::iterator indexIter = (*mIter).second.find(argIndex);
-      if(indexIter!=(*mIter).second.end()){
-        if((*indexIter).second > max_ts_of_all_args)
-          max_ts_of_all_args = (*indexIter).second;
-      }
-      else{
-        //find the value for entire array
-        map<int,uint64_t>::iterator fullArrayIndexIter = (*mIter).second.find(-1);
-
-        ((*mIter).second)[argIndex] = (*fullArrayIndexIter).second;
-        if((*fullArrayIndexIter).second > max_ts_of_all_args)
-          max_ts_of_all_args = (*fullArrayIndexIter).second;
-        //((*mIter).second)[argIndex] = 0;
-      }
+      //first use of the index takes the value for entire array
+      uint64_t ts = qbit.get(argIndex, qbit.whole);
+      if(ts > max_ts_of_all_args)
+        max_ts_of_all_args = ts;
     }
   }
 
   if(debugGetCriticalPath){
-    errs() << "Before Scheduling: \n";
+    out() << "Before Scheduling: \n";
     print_funcQbits();
   }
 
@@ -759,7 +923,14 @@ uint64_t GetCriticalPath::compute_max_ts_of_all_args(qGate qg)
 
 }
 
-uint64_t GetCriticalPath::compute_least_slack(Function* F, qGate qg, uint64_t tmax){
+// Slack of index idx of qbit if it is needed at startsAt
+static uint64_t index_slack(uint64_t startsAt, QbitVar& qbit, int idx)
+{
+  uint64_t* entry = qbit.find(idx);
+  return startsAt - (entry ? *entry : qbit.whole);
+}
+
+uint64_t GetCriticalPath::compute_least_slack(Function* F, const qGate& qg, uint64_t tmax){
 
   //errs() << "In compute least \n";
 
@@ -777,11 +948,11 @@ uint64_t GetCriticalPath::compute_least_slack(Function* F, qGate qg, uint64_t tm
   //compute startsAt
   //print_tableFuncQbitsStart();
 
-  map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator tableIt = tableFuncQbitsStart.find(qg.qFunc);
+  map<Function*, QbitSummary>::iterator tableIt = tableFuncQbitsStart.find(qg.qFunc);
   assert(tableIt!=tableFuncQbitsStart.end() && "No previous entry for this function");
 
   for(int i=0;i<qg.numArgs; i++){    
-    map<unsigned int, map<int, uint64_t> >::iterator entryIt = (*tableIt).second.find(i);
+    QbitSummary::iterator entryIt = (*tableIt).second.find(i);
     if(entryIt!=(*tableIt).second.end()){
 
       //differentiate for qbit and qbit*
@@ -790,16 +961,33 @@ uint64_t GetCriticalPath::compute_least_slack(Function* F, qGate qg, uint64_t tm
 
         //errs() << "Array\n";
 
-        map<int, uint64_t>::iterator lookUpIt = (*entryIt).second.find(-2);
-        startsAt[i] = tmax + (*lookUpIt).second;			
+        if(CRITICAL_PATH_PROFILES){
+          //each index the called function uses is matched with when it is
+          //done here, instead of the first one needed with the last one
+          //done; indices it does not use leave any slack
+          QbitVar& callee = (*entryIt).second;
+          QbitVar& qbit = funcQbits[qg.args[i].var];
+          uint64_t slack = UINT64_MAX;
+          if(callee.whole != UINT64_MAX) //uses of the entire array
+            slack = tmax + callee.whole - qbit.maxTs;
+          for(unsigned idx = 0; idx < callee.ts.size(); idx++)
+            if(callee.used[idx])
+              slack = min(slack, index_slack(tmax + callee.ts[idx], qbit, idx));
+          for(map<int, uint64_t>::iterator farIt = callee.far.begin(); farIt != callee.far.end(); ++farIt)
+            slack = min(slack, index_slack(tmax + (*farIt).second, qbit, (*farIt).first));
+          startsAt[i] = slack;
+          endsAt[i] = 0;
+        }
+        else
+          startsAt[i] = tmax + (*entryIt).second.maxTs;			
       }
       else{ //qbit was passed
         //errs() << "i = " << i << " Qbit\n";
         //errs() << "index = " << qg.args[i].index << " Qbit\n";
         //take the 0th entry and add that to the index entry
-        map<int, uint64_t>::iterator lookUpQbitIt = (*entryIt).second.find(0);
-        assert(lookUpQbitIt!=(*entryIt).second.end() && "arg index not found in tablefuncqbitshalf"); //there exists entry for reqd index in the func table of called func
-        startsAt[i] = tmax + (*lookUpQbitIt).second;
+        uint64_t* lookUpQbit = (*entryIt).second.find(0);
+        assert(lookUpQbit && "arg index not found in tablefuncqbitshalf"); //there exists entry for reqd index in the func table of called func
+        startsAt[i] = tmax + *lookUpQbit;
 
       }
     }
@@ -811,31 +999,21 @@ uint64_t GetCriticalPath::compute_least_slack(Function* F, qGate qg, uint64_t tm
   //compute endsAt
   //find last timestep for all arguments of qgate
   for(int i=0;i<qg.numArgs; i++){
-    map<string, map<int,uint64_t> >::iterator mIter = funcQbits.find(qg.args[i].name);
-    assert(mIter!=funcQbits.end()); //should already have an entry for the name of the qbit
+    QbitVar& qbit = funcQbits[qg.args[i].var];
 
     int argIndex = qg.args[i].index;
 
-    //find the index of argument in the map<int,int>
+    //find the index of argument
     if(argIndex == -1) //operation on entire array
     {
       //find max for the array
-      map<int,uint64_t>::iterator indexIter = (*mIter).second.find(-2);
-      endsAt[i] = (*indexIter).second;	  
+      if(!CRITICAL_PATH_PROFILES) //else matched with startsAt above
+        endsAt[i] = qbit.maxTs;	  
     }
     else
     {
-      map<int,uint64_t>::iterator indexIter = (*mIter).second.find(argIndex);
-      if(indexIter!=(*mIter).second.end()){
-        endsAt[i] = (*indexIter).second;
-      }
-      else{
-        //find the value for entire array
-        map<int,uint64_t>::iterator fullArrayIndexIter = (*mIter).second.find(-1);
-
-        ((*mIter).second)[argIndex] = (*fullArrayIndexIter).second;
-        endsAt[i] = (*fullArrayIndexIter).second;
-      }
+      //first use of the index takes the value for entire array
+      endsAt[i] = qbit.get(argIndex, qbit.whole);
     }
   }
 
@@ -857,34 +1035,85 @@ uint64_t GetCriticalPath::compute_least_slack(Function* F, qGate qg, uint64_t tm
   }
 
   //errs() << "LS = " << leastslack << "\n";
-  if(leastslack > tmax) leastslack = 1;
+  if(CRITICAL_PATH_PROFILES){
+    //no earlier than timestep 0; slack left by the arguments alone
+    if(leastslack > tmax + 1) leastslack = tmax + 1;
+  }
+  else if(leastslack > tmax) leastslack = 1;
 
   return leastslack;  
 }
 
-void GetCriticalPath::calc_critical_time(Function* F, qGate qg){
-  string fname = qg.qFunc->getName();
+// 0: a gate, 1: a MeasX or MeasZ gate, 2: a module; by callee, so the names
+// are only looked at once
+int GetCriticalPath::callee_kind(Function* qFunc){
+  DenseMap<Function*, int>::iterator it = calleeKind.find(qFunc);
+  if(it != calleeKind.end())
+    return (*it).second;
+  string fname = qFunc->getName();
+  int kind = 2;
+  if(fname.find("llvm.MeasX")!=string::npos || fname.find("llvm.MeasZ")!=string::npos)
+    kind = 1;
+  else if(fname.find("llvm.")!=string::npos)
+    kind = 0;
+  calleeKind[qFunc] = kind;
+  return kind;
+}
+
+// First use of the arguments of qg, a call to a module starting at base
+// (its timestep 0), from when the module first needs them
+void GetCriticalPath::compose_first_use(const qGate& qg, uint64_t base){
+  map<Function*, QbitSummary>::iterator tableIt = tableFuncQbitsStart.find(qg.qFunc);
+  assert(tableIt!=tableFuncQbitsStart.end() && "No previous entry for this function");
+
+  for(int i=0;i<qg.numArgs; i++){
+    QbitSummary::iterator entryIt = (*tableIt).second.find(i);
+    if(entryIt==(*tableIt).second.end())
+      continue;
+    QbitVar& callee = (*entryIt).second;
+    QbitVar& first = funcQbitsHalf[qg.args[i].var];
+
+    if(qg.args[i].index == -1){ //qbit*
+      for(unsigned idx = 0; idx < callee.ts.size(); idx++)
+        if(callee.used[idx])
+          first.lower(idx, base + callee.ts[idx]);
+      for(map<int, uint64_t>::iterator farIt = callee.far.begin(); farIt != callee.far.end(); ++farIt)
+        first.lower((*farIt).first, base + (*farIt).second);
+      //uses of the entire array in the called function
+      if(callee.whole != UINT64_MAX)
+        first.whole = min(first.whole, base + callee.whole);
+    }
+    else if(uint64_t* lookUpQbit = callee.find(0)) //qbit was passed
+      first.lower(qg.args[i].index, base + *lookUpQbit);
+  }
+}
+
+void GetCriticalPath::calc_critical_time(Function* F, const qGate& qg){
+  int kind = callee_kind(qg.qFunc);
 
   //print_qgate(qg);
 
-  if(isFirstMeas && (fname.find("llvm.MeasX")!=string::npos || fname.find("llvm.MeasZ")!=string::npos)){
+  if(isFirstMeas && kind == 1){
     uint64_t maxFQ = find_max_funcQbits();
     memset_funcQbits(maxFQ);
 
     //--print_scheduled_gate(qg,maxFQ+1);
     addToTSGates(qg,maxFQ+1);
 
-    map<string, map<int,uint64_t> >::iterator mIter = funcQbits.find(qg.args[0].name);
-
-    int argIndex = qg.args[0].index;
+    QbitVar& qbit = funcQbits[qg.args[0].var];
 
-    //update the timestep number for that argument
-    map<int,uint64_t>::iterator indexIter = (*mIter).second.find(argIndex);
-    (*indexIter).second =  maxFQ + 1;
+    //update the timestep number for that argument; an index not used yet
+    //keeps taking the value of the entire array
+    if(uint64_t* entry = qbit.find(qg.args[0].index))
+      *entry = maxFQ + 1;
 
     //update -2 entry for the array, i.e. max ts over all indices
-    indexIter = (*mIter).second.find(-2);
-    (*indexIter).second = maxFQ + 1;
+    qbit.maxTs = maxFQ + 1;
+
+    //the first Meas waits for every qubit
+    if(CRITICAL_PATH_PROFILES)
+      for(unsigned v = 0; v < funcQbitsHalf.size(); v++)
+        funcQbitsHalf[v].lower_all(maxFQ + 1);
 
     //update_critical_info(F->getName().str(), maxFQ, qg.qFunc->getName(), qg.angle);   
     isFirstMeas = false;
@@ -896,35 +1125,32 @@ void GetCriticalPath::calc_critical_time(Function* F, qGate qg){
     //errs() << "Max timestep for all args = " << max_ts_of_all_args << "\n";
 
 
-    if(fname.find("llvm.")!=string::npos){ //is intrinsic
+    if(kind != 2){ //is intrinsic
 
       //schedule gate in max_ts_of_all_args + 1th timestep
       //--print_scheduled_gate(qg,max_ts_of_all_args+1);
       addToTSGates(qg,max_ts_of_all_args+1);
-      qg.asap_num = max_ts_of_all_args+1;
 
       //find last timestep for all arguments of qgate
       for(int i=0;i<qg.numArgs; i++){
-        map<string, map<int,uint64_t> >::iterator mIter = funcQbits.find(qg.args[i].name);
+        QbitVar& qbit = funcQbits[qg.args[i].var];
 
         int argIndex = qg.args[i].index;
 
         if(argIndex == -1){
-          for(map<int,uint64_t>::iterator entryIter = (*mIter).second.begin(); entryIter!=(*mIter).second.end();++entryIter){
-            (*entryIter).second = max_ts_of_all_args + 1;
-          }
-
+          qbit.set_all(max_ts_of_all_args + 1);
         }
         else{
           //update the timestep number for that argument
-          map<int,uint64_t>::iterator indexIter = (*mIter).second.find(argIndex);
-          (*indexIter).second =  max_ts_of_all_args + 1;
+          qbit.get(argIndex, max_ts_of_all_args + 1) = max_ts_of_all_args + 1;
 
           //update -2 entry for the array, i.e. max ts over all indices
-          indexIter = (*mIter).second.find(-2);
-          if((*indexIter).second < max_ts_of_all_args + 1)
-            (*indexIter).second = max_ts_of_all_args + 1;
+          if(qbit.maxTs < max_ts_of_all_args + 1)
+            qbit.maxTs = max_ts_of_all_args + 1;
         }  
+
+        if(CRITICAL_PATH_PROFILES)
+          funcQbitsHalf[qg.args[i].var].lower(argIndex, max_ts_of_all_args + 1);
       }
     } //intrinsic func
 
@@ -949,42 +1175,52 @@ void GetCriticalPath::calc_critical_time(Function* F, qGate qg){
       uint64_t tmpDelay = max_ts_of_all_args + (*delayIt).second - least_slack + 1; 
       if(tmpDelay > highestDelay) highestDelay = tmpDelay;
 
+      if(CRITICAL_PATH_PROFILES)
+        compose_first_use(qg, max_ts_of_all_args - least_slack + 1);
+
       //check tableFuncQbits for values to update with
-      map<Function*, map<unsigned int, map<int, uint64_t> > >::iterator tableIt = tableFuncQbits.find(qg.qFunc);
+      map<Function*, QbitSummary>::iterator tableIt = tableFuncQbits.find(qg.qFunc);
       assert(tableIt!=tableFuncQbits.end() && "No previous entry for this function");
 
       for(int i=0;i<qg.numArgs; i++){
-        map<string, map<int,uint64_t> >::iterator mIter = funcQbits.find(qg.args[i].name);
-        assert(mIter!=funcQbits.end()); //should already have an entry for the name of the qbit
+        QbitVar& qbit = funcQbits[qg.args[i].var];
 
-        map<unsigned int, map<int, uint64_t> >::iterator entryIt = (*tableIt).second.find(i);
+        QbitSummary::iterator entryIt = (*tableIt).second.find(i);
         if(entryIt!=(*tableIt).second.end()){
+          QbitVar& callee = (*entryIt).second;
 
           //differentiate for qbit and qbit*
 
           if(qg.args[i].index == -1){ //qbit*
-            for(map<int, uint64_t>::iterator indexIt = (*entryIt).second.begin(); indexIt!=(*entryIt).second.end(); ++indexIt){
-              map<int,uint64_t>::iterator currEntryIt = (*mIter).second.find((*indexIt).first);
-              if(currEntryIt!=(*mIter).second.end())
-                (*currEntryIt).second = max_ts_of_all_args + (*indexIt).second - least_slack + 1;
-              else
-                (*mIter).second[(*indexIt).first] = max_ts_of_all_args + (*indexIt).second - least_slack + 1;
+            //every entry of the called function's argument, -1 and -2 included
+            if(CRITICAL_PATH_PROFILES){
+              //the called function may start before the indices it does
+              //not use are done with
+              uint64_t maxTs = qbit.maxTs;
+              qbit.raise_all(max_ts_of_all_args + callee.whole - least_slack + 1);
+              qbit.maxTs = max(maxTs, max_ts_of_all_args + callee.maxTs - least_slack + 1);
+            }
+            else{
+              qbit.whole = max_ts_of_all_args + callee.whole - least_slack + 1;
+              qbit.maxTs = max_ts_of_all_args + callee.maxTs - least_slack + 1;
             }
+            for(unsigned idx = 0; idx < callee.ts.size(); idx++)
+              if(callee.used[idx])
+                qbit.get(idx, 0) = max_ts_of_all_args + callee.ts[idx] - least_slack + 1;
+            for(map<int, uint64_t>::iterator farIt = callee.far.begin(); farIt != callee.far.end(); ++farIt)
+              qbit.get((*farIt).first, 0) = max_ts_of_all_args + (*farIt).second - least_slack + 1;
           }
           else{ //qbit was passed
             //take the 0th entry and add that to the index entry
-            map<int, uint64_t>::iterator lookUpQbitIt = (*entryIt).second.find(0);
-            assert(lookUpQbitIt!=(*entryIt).second.end()); //there exists entry for 0 in the func table of called func
-            map<int, uint64_t>::iterator currEntryIt = (*mIter).second.find(qg.args[i].index);
-            if(currEntryIt!=(*mIter).second.end())
-              (*currEntryIt).second = max_ts_of_all_args + (*lookUpQbitIt).second - least_slack + 1;
-            else
-              (*mIter).second[qg.args[i].index] = max_ts_of_all_args + (*lookUpQbitIt).second - least_slack + 1;
+            uint64_t* lookUpQbit = callee.find(0);
+            assert(lookUpQbit); //there exists entry for 0 in the func table of called func
+            qbit.get(qg.args[i].index, 0) = max_ts_of_all_args + *lookUpQbit - least_slack + 1;
 
             //update -2 entry for the array, i.e. max ts over all indices
-            currEntryIt = (*mIter).second.find(-2);
-            if((*currEntryIt).second < max_ts_of_all_args + (*lookUpQbitIt).second)
-              (*currEntryIt).second = max_ts_of_all_args + (*lookUpQbitIt).second- least_slack + 1;	    
+            if(CRITICAL_PATH_PROFILES)
+              qbit.maxTs = max(qbit.maxTs, max_ts_of_all_args + *lookUpQbit - least_slack + 1);
+            else if(qbit.maxTs < max_ts_of_all_args + *lookUpQbit)
+              qbit.maxTs = max_ts_of_all_args + *lookUpQbit - least_slack + 1;	    
           }
         } 
       }
@@ -994,10 +1230,10 @@ void GetCriticalPath::calc_critical_time(Function* F, qGate qg){
 
   if(debugGetCriticalPath)
   {   
-    errs() << "\nAfter Scheduling: \n";
+    out() << "\nAfter Scheduling: \n";
     print_funcQbits();
     print_qgate(qg);
-    errs() << "\n";
+    out() << "\n";
   }
 
 }
@@ -1006,7 +1242,7 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
   if(CallInst *CI = dyn_cast<CallInst>(pInst))
   {      
     if(debugGetCriticalPath)
-      errs() << "Call inst: " << CI->getCalledFunction()->getName() << "\n";
+      out() << "Call inst: " << CI->getCalledFunction()->getName() << "\n";
 
     if(CI->getCalledFunction()->getName() == "store_cbit"){	//trace return values
       return;
@@ -1028,7 +1264,7 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
 
 
       if(isa<UndefValue>(CI->getArgOperand(iop))){
-        errs() << "WARNING: LLVM IR code has UNDEF values. \n";
+        out() << "WARNING: LLVM IR code has UNDEF values. \n";
         tmpQGateArg.isUndef = true;	
         //exit(1);
       }
@@ -1069,20 +1305,19 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
     if(allDepQbit.size() > 0){
       if(debugGetCriticalPath)
       {
-        errs() << "\nCall inst: " << CI->getCalledFunction()->getName();	    
-        errs() << ": Found all arguments: ";       
+        out() << "\nCall inst: " << CI->getCalledFunction()->getName();	    
+        out() << ": Found all arguments: ";       
         for(unsigned int vb=0; vb<allDepQbit.size(); vb++){
           if(allDepQbit[vb].argPtr)
-            errs() << allDepQbit[vb].argPtr->getName() <<" Index: ";
+            out() << allDepQbit[vb].argPtr->getName() <<" Index: ";
 
           //else
-          errs() << allDepQbit[vb].valOrIndex <<" ";
+          out() << allDepQbit[vb].valOrIndex <<" ";
         }
-        errs()<<"\n";
+        out()<<"\n";
 
       }
 
-      string fname =  CI->getCalledFunction()->getName();  
       qGate thisGate;
       thisGate.qFunc =  CI->getCalledFunction();
 
@@ -1090,7 +1325,7 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
       for(unsigned int vb=0; vb<allDepQbit.size(); vb++){
         if(allDepQbit[vb].argPtr){
           qGateArg param =  allDepQbit[vb];       
-          thisGate.args[thisGate.numArgs].name = param.argPtr->getName();
+          thisGate.args[thisGate.numArgs].var = find_qbit_var(param.argPtr);
           if(!param.isPtr)
             thisGate.args[thisGate.numArgs].index = param.valOrIndex;
           thisGate.numArgs++;
@@ -1106,30 +1341,30 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
 
 
   void GetCriticalPath::saveTableFuncQbits(Function* F){
-    map<unsigned int, map<int, uint64_t> > tmpFuncQbitsMap;
+    QbitSummary& tmpFuncQbitsMap = tableFuncQbits[F];
+    tmpFuncQbitsMap.clear();
 
-    for(map<string, map<int, uint64_t> >::iterator mapIt = funcQbits.begin(); mapIt!=funcQbits.end(); ++mapIt){
-      map<string, unsigned int>::iterator argIt = funcArgs.find((*mapIt).first);
+    for(unsigned v = 0; v < funcQbits.size(); v++){
+      map<string, unsigned int>::iterator argIt = funcArgs.find(varNames[v]);
       if(argIt!=funcArgs.end()){
         unsigned int argNum = (*argIt).second;
-        tmpFuncQbitsMap[argNum] = (*mapIt).second;
+        tmpFuncQbitsMap[argNum] = funcQbits[v];
       }
     }
-    tableFuncQbits[F] = tmpFuncQbitsMap;
   }
 
 
   void GetCriticalPath::saveTableFuncQbitsStart(Function* F){
-    map<unsigned int, map<int, uint64_t> > tmpFuncQbitsMap;
+    QbitSummary& tmpFuncQbitsMap = tableFuncQbitsStart[F];
+    tmpFuncQbitsMap.clear();
 
-    for(map<string, map<int, uint64_t> >::iterator mapIt = funcQbitsHalf.begin(); mapIt!=funcQbitsHalf.end(); ++mapIt){
-      map<string, unsigned int>::iterator argIt = funcArgs.find((*mapIt).first);
+    for(unsigned v = 0; v < funcQbitsHalf.size(); v++){
+      map<string, unsigned int>::iterator argIt = funcArgs.find(varNames[v]);
       if(argIt!=funcArgs.end()){
         unsigned int argNum = (*argIt).second;
-        tmpFuncQbitsMap[argNum] = (*mapIt).second;
+        tmpFuncQbitsMap[argNum] = funcQbitsHalf[v];
       }
     }
-    tableFuncQbitsStart[F] = tmpFuncQbitsMap;
   }
 
 
@@ -1137,15 +1372,9 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
     //copy all entries of funcQbit
     //print_funcQbitsHalf();
 
-    for(map<string, map<int,uint64_t> >::iterator inItr = funcQbits.begin(); inItr!=funcQbits.end(); ++inItr){
-      //find string in funcQbitsHalf
-      //errs() << "Looking for string " << (*inItr).first << "\n";
-      map<string, map<int,uint64_t> >::iterator outItr = funcQbitsHalf.find((*inItr).first);
-      assert(outItr != funcQbitsHalf.end() && "funcQbitsHalf does not have entry");
-
-      for(map<int,uint64_t>::iterator in2Itr = (*inItr).second.begin(); in2Itr!=(*inItr).second.end(); ++in2Itr){
-        (*outItr).second[(*in2Itr).first] = i;
-      }
+    for(unsigned v = 0; v < funcQbits.size(); v++){
+      funcQbitsHalf[v] = funcQbits[v];
+      funcQbitsHalf[v].set_all(i);
     }
 
   }
@@ -1153,23 +1382,23 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
   void GetCriticalPath::gen_half_funcQbits(uint64_t ct, uint64_t hct){
     init_funcQbitsHalf(ct);
 
+    vector<unsigned> start, order;
+    sort_tsGates(ct, start, order);
+
     for(uint64_t i=hct+1; i<ct; i++){
-      map<uint64_t, vector<qGate> >::iterator mit=tsGates.find(i);
-      for(vector<qGate>::iterator vit = (*mit).second.begin(); vit!=(*mit).second.end(); ++vit){
+      for(unsigned g = start[i]; g < start[i+1]; g++){
+        TSGate& gate = tsGates[order[g]];
         //iterate over the args
-        for(int j=0; j<(*vit).numArgs; j++){
-          string argName = (*vit).args[j].name;
-          int argIndex = (*vit).args[j].index;
-          map<string, map<int,uint64_t> >::iterator fit = funcQbitsHalf.find(argName);
-          assert(fit!=funcQbitsHalf.end() && "arg not found in funQbitsHalf");
+        for(int j=0; j<gate.numArgs; j++){
+          qArgInfo& arg = gateArgs[gate.argStart + j];
 
-          assert(argIndex != -1 && "argindex is -1");
+          assert(arg.index != -1 && "argindex is -1");
 
-          map<int,uint64_t>::iterator mfit = (*fit).second.find(argIndex);
-          assert(mfit != (*fit).second.end() && "arg index not found in funcQbitsHalf");
+          uint64_t* entry = funcQbitsHalf[arg.var].find(arg.index);
+          assert(entry && "arg index not found in funcQbitsHalf");
 
-          if(i < (*mfit).second){ //gate scheduled in TS=i
-            (*mfit).second = i;	  
+          if(i < *entry){ //gate scheduled in TS=i
+            *entry = i;	  
           }
 
         }
@@ -1186,65 +1415,42 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
 
     assert(hct!=0 && "ZERO hct");
 
+    vector<unsigned> start, order;
+    sort_tsGates(ct, start, order);
+
     for(uint64_t i=hct; i>=1; i--){
-      map<uint64_t, vector<qGate> >::iterator mit=tsGates.find(i);
-      for(vector<qGate>::iterator vit = (*mit).second.begin(); vit!=(*mit).second.end(); ++vit){
+      for(unsigned g = start[i]; g < start[i+1]; g++){
+        TSGate& gate = tsGates[order[g]];
         //iterate over the args and get ALAP num
         uint64_t min_ts_of_all_args = ct;
 
-        for(int j=0; j<(*vit).numArgs; j++){
-          string argName = (*vit).args[j].name;
-          int argIndex = (*vit).args[j].index;
-
-          map<string, map<int,uint64_t> >::iterator fit = funcQbitsHalf.find(argName);
-          assert(fit!=funcQbitsHalf.end() && "arg not found in funQbitsHalf");
-          assert(argIndex != -1 && "argIndex = -1 in sched_alap");
-
-          //if(argIndex == -1) //operation on entire array
-          //{
-          //find min for the array
-          //map<int,uint64_t>::iterator indexIter = (*fit).second.find(-2);
-          //  if((*indexIter).second < min_ts_of_all_args)
-          //    min_ts_of_all_args = (*indexIter).second;	  
-          //}
-          //else
-          //{
-          map<int,uint64_t>::iterator mfit = (*fit).second.find(argIndex);
-          assert(mfit != (*fit).second.end() && "arg index not found in funcQbitsHalf");
+        for(int j=0; j<gate.numArgs; j++){
+          qArgInfo& arg = gateArgs[gate.argStart + j];
 
-          if((*mfit).second < min_ts_of_all_args)
-            min_ts_of_all_args = (*mfit).second;
-          //}
+          assert(arg.index != -1 && "argIndex = -1 in sched_alap");
+
+          uint64_t* entry = funcQbitsHalf[arg.var].find(arg.index);
+          assert(entry && "arg index not found in funcQbitsHalf");
+
+          if(*entry < min_ts_of_all_args)
+            min_ts_of_all_args = *entry;
         }
-        //print_qgate((*vit));
         //errs() << "min_ts_of_all_args = " << min_ts_of_all_args << "\n";
-        (*vit).alap_num = min_ts_of_all_args-1;
 
         //schedule gate in min_ts_of_all_args - 1; update funcQbitsHalf
         //--print_scheduled_gate((*vit),min_ts_of_all_args-1);
 
         //find last timestep for all arguments of qgate
-        for(int j=0;j<(*vit).numArgs; j++){
-          map<string, map<int,uint64_t> >::iterator mIter = funcQbitsHalf.find((*vit).args[j].name);
+        for(int j=0;j<gate.numArgs; j++){
+          qArgInfo& arg = gateArgs[gate.argStart + j];
+          QbitVar& qbit = funcQbitsHalf[arg.var];
 
-          int argIndex = (*vit).args[j].index;
-
-          if(argIndex == -1){
-            for(map<int,uint64_t>::iterator entryIter = (*mIter).second.begin(); entryIter!=(*mIter).second.end();++entryIter){
-              (*entryIter).second = min_ts_of_all_args - 1;
-            }
+          //update the timestep number for that argument
+          *qbit.find(arg.index) = min_ts_of_all_args - 1;
 
-          }
-          else{
-            //update the timestep number for that argument
-            map<int,uint64_t>::iterator indexIter = (*mIter).second.find(argIndex);
-            (*indexIter).second =  min_ts_of_all_args - 1;
-
-            //update -2 entry for the array, i.e. min ts over all indices
-            indexIter = (*mIter).second.find(-2);
-            if((*indexIter).second > min_ts_of_all_args - 1)
-              (*indexIter).second = min_ts_of_all_args - 1;
-          }  
+          //update -2 entry for the array, i.e. min ts over all indices
+          if(qbit.maxTs > min_ts_of_all_args - 1)
+            qbit.maxTs = min_ts_of_all_args - 1;
         }
       }
     }
@@ -1268,7 +1474,10 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
       analyzeCallInst(F,Inst);	
     }
 
-    if(isLeaf){
+    //with -critical-path-profiles funcQbitsHalf already has the first use of
+    //each qubit, recorded while scheduling; unlike an ALAP start it keeps
+    //the finish times in funcQbits valid when the qubit arrives just before
+    if(isLeaf && !CRITICAL_PATH_PROFILES){
       //print_tsGates();
 
       //do ALAP processing
@@ -1294,7 +1503,7 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
       //print_funcQbitsHalf();
 
     }
-    else{
+    else if(!CRITICAL_PATH_PROFILES){
       //dummy info for ALAP
       process_nonLeafALAP();
 
@@ -1341,41 +1550,89 @@ void GetCriticalPath::analyzeCallInst(Function* F, Instruction* pInst){
   }
 
 
+  void GetCriticalPath::analyze_function(Function *F) {
+    //errs() << "\nFunction: " << F->getName() << "\n";      
+
+    funcQbits.clear();
+    funcQbitsHalf.clear();
+    funcArgs.clear();
+    varIndex.clear();
+    varNames.clear();
+    varOf.clear();
+    vectQbit.clear();
+
+    getFunctionArguments(F);
+
+    // count the critical resources for this function
+    CountCriticalFunctionResources(F);
+
+    crit_path_f[F] = max(find_max_funcQbits(), highestDelay);
+    //if(F->getName() == "main")
+    //errs() << F->getName() << ": " << "Critical Path Length : " << find_max_funcQbits() << "\n";
+    out() << F->getName() << " " << max(find_max_funcQbits(),highestDelay) << " isLeaf= " << isLeaf <<"\n";	
+  }
+
+  // An analysis of its own for each leaf worker
+  GetCriticalPath* GetCriticalPath::new_leaf_worker(){
+    GetCriticalPath* cp = new GetCriticalPath();
+    cp->init_gate_names();
+    cp->init_gates_as_functions();
+    return cp;
+  }
+
+  void GetCriticalPath::run_leaf(LeafJob& job){
+    raw_string_ostream os(job.out);
+    outStream = &os;
+    analyze_function(job.F);
+    os.flush();
+    outStream = NULL;
+    string fName = job.F->getName().str();
+    job.critPath = crit_path_f[job.F];
+    job.qbits = tableFuncQbits[job.F];
+    job.qbitsStart = tableFuncQbitsStart[job.F];
+    job.parallelFactor = funcParallelFactor[fName];
+    job.maxParallelFactor = funcMaxParallelFactor[fName];
+  }
+
+
   bool GetCriticalPath::runOnModule (Module &M) {
     init_gate_names();
     init_gates_as_functions();
 
+    unsigned threads = CRITICAL_PATH_THREADS;
+    if(threads == 0)
+      threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+
     // iterate over all functions, and over all instructions in those functions
     CallGraphNode* rootNode = getAnalysis<CallGraph>().getRoot();
+    vector<Function*> funcs;
+    vector<LeafJob> jobs;
+    map<Function*, unsigned> jobIndex;
 
     //Post-order
-    for (scc_iterator<CallGraphNode*> sccIb = scc_begin(rootNode), E = scc_end(rootNode); sccIb != E; ++sccIb) {
-      const std::vector<CallGraphNode*> &nextSCC = *sccIb;
-      for (std::vector<CallGraphNode*>::const_iterator nsccI = nextSCC.begin(), E = nextSCC.end(); nsccI != E; ++nsccI) {
-        Function *F = (*nsccI)->getFunction();	  
-
-        if(F && !F->isDeclaration()){
-          //errs() << "\nFunction: " << F->getName() << "\n";      
-
-          funcQbits.clear();
-          funcQbitsHalf.clear();
-          funcArgs.clear();
-
-          getFunctionArguments(F);
-
-          // count the critical resources for this function
-          CountCriticalFunctionResources(F);
-
-          crit_path_f[F] = max(find_max_funcQbits(), highestDelay);
-          //if(F->getName() == "main")
-          //errs() << F->getName() << ": " << "Critical Path Length : " << find_max_funcQbits() << "\n";
-          errs() << F->getName() << " " << max(find_max_funcQbits(),highestDelay) << " isLeaf= " << isLeaf <<"\n";	
-        }
-        else{
-          if(debugGetCriticalPath)
-            errs() << "WARNING: Ignoring external node or dummy function.\n";
-        }
+    collect_leaves(rootNode, threads, funcs, jobs, jobIndex, debugGetCriticalPath ? &out() : NULL);
+
+    //Leaf modules are independent of each other and are analyzed
+    //concurrently; their results are merged in call graph order, before
+    //the functions calling them are analyzed
+    if(!jobs.empty())
+      run_leaves(*this, jobs, min(threads, (unsigned) jobs.size()));
+
+    for(vector<Function*>::iterator fit = funcs.begin(); fit != funcs.end(); ++fit){
+      Function *F = *fit;
+      map<Function*, unsigned>::iterator jit = jobIndex.find(F);
+      if(jit != jobIndex.end()){
+        LeafJob& job = jobs[(*jit).second];
+        out() << job.out;
+        string fName = F->getName().str();
+        crit_path_f[F] = job.critPath;
+        tableFuncQbits[F] = job.qbits;
+        tableFuncQbitsStart[F] = job.qbitsStart;
+        funcParallelFactor[fName] = job.parallelFactor;
+        funcMaxParallelFactor[fName] = job.maxParallelFactor;
       }
+      else
+        analyze_function(F);
     }
     //print_tableFuncQbits();
     //print_critical_info("main");
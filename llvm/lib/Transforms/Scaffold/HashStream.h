@@ -0,0 +1,40 @@
+//===----------------- HashStream.h ----------------------===//
+// raw_ostream that hashes IR instead of printing it, used by UnrollClone
+//  to detect its fixed point and by GenLPFSSchedule to key leaf schedules.
+//
+//        This file was created by Scaffold Compiler Working Group
+//===----------------------------------------------------------------------===//
+
+#ifndef SCAFFOLD_HASHSTREAM_H
+#define SCAFFOLD_HASHSTREAM_H
+
+#include "llvm/Support/DataTypes.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+  // raw_ostream that folds everything written to it into a 64-bit FNV-1a
+  // hash, so IR can be compared without materializing its text.
+  class hash_ostream : public raw_ostream {
+    uint64_t Hash;
+    uint64_t Pos;
+
+    virtual void write_impl(const char *Ptr, size_t Size) {
+      for (size_t i = 0; i < Size; i++) {
+        Hash ^= (unsigned char)Ptr[i];
+        Hash *= 1099511628211ULL;
+      }
+      Pos += Size;
+    }
+    virtual uint64_t current_pos() const { return Pos; }
+
+  public:
+    hash_ostream() : Hash(14695981039346656037ULL), Pos(0) {}
+    ~hash_ostream() { flush(); }
+
+    uint64_t hash() { flush(); return Hash; }
+  };
+
+}
+
+#endif
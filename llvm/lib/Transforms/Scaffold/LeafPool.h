@@ -0,0 +1,123 @@
+//===----------------- LeafPool.h ----------------------===//
+// Thread pool for the leaf modules of GenLPFSSchedule, GenSIMDSchedule
+//  and GetCriticalPath. Leaf modules only call gates, so they are
+//  processed concurrently ahead of the call graph walk, each worker with
+//  its own instance of the pass, and merged in call graph order.
+//
+//  A pass using it provides
+//    Pass* new_leaf_worker();  //a fresh instance to process jobs on
+//    void run_leaf(Job& job);  //process job.F and keep its results in job
+//
+//        This file was created by Scaffold Compiler Working Group
+//===----------------------------------------------------------------------===//
+
+#ifndef SCAFFOLD_LEAFPOOL_H
+#define SCAFFOLD_LEAFPOOL_H
+
+#include <map>
+#include <vector>
+#include <pthread.h>
+#include "llvm/Function.h"
+#include "llvm/Analysis/CallGraph.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace llvm {
+
+  // True if the function of node only calls declared functions (gates), so
+  // its results do not depend on any other function of the module
+  inline bool callsOnlyDeclarations(CallGraphNode* node){
+    for(CallGraphNode::iterator cit = node->begin(); cit != node->end(); ++cit){
+      Function* callee = (*cit).second->getFunction();
+      if(callee && !callee->isDeclaration())
+        return false;
+    }
+    return true;
+  }
+
+  // Collects the defined functions of the call graph in post-order into
+  // funcs and, if threads > 1, a job for each leaf module among them.
+  // External nodes are reported on warn if it is given.
+  template <class Job>
+  void collect_leaves(CallGraphNode* rootNode, unsigned threads, std::vector<Function*>& funcs,
+                      std::vector<Job>& jobs, std::map<Function*, unsigned>& jobIndex,
+                      raw_ostream* warn = NULL){
+    for (scc_iterator<CallGraphNode*> sccIb = scc_begin(rootNode), E = scc_end(rootNode); sccIb != E; ++sccIb) {
+      const std::vector<CallGraphNode*> &nextSCC = *sccIb;
+      for (std::vector<CallGraphNode*>::const_iterator nsccI = nextSCC.begin(), E = nextSCC.end(); nsccI != E; ++nsccI) {
+        Function *F = (*nsccI)->getFunction();
+
+        if(F && !F->isDeclaration()){
+          funcs.push_back(F);
+          if(threads > 1 && callsOnlyDeclarations(*nsccI)){
+            F->arg_begin(); //arguments are built lazily, not on the workers
+            jobIndex[F] = jobs.size();
+            jobs.push_back(Job(F));
+          }
+        }
+        else if(warn)
+          *warn << "WARNING: Ignoring external node or dummy function.\n";
+      }
+    }
+  }
+
+  // Leaf jobs are handed out in order to the workers of run_leaves
+  template <class Pass, class Job>
+  struct LeafPool{
+    std::vector<Job>* jobs;
+    unsigned next;
+    pthread_mutex_t lock;
+  };
+
+  template <class Pass, class Job>
+  struct LeafWorker{
+    LeafPool<Pass, Job>* pool;
+    Pass* pass; //private state of this worker
+
+    static void* run(void* arg){
+      LeafWorker* worker = (LeafWorker*) arg;
+      LeafPool<Pass, Job>* pool = worker->pool;
+      while(true){
+        pthread_mutex_lock(&pool->lock);
+        unsigned j = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if(j >= pool->jobs->size())
+          break;
+        worker->pass->run_leaf((*pool->jobs)[j]);
+      }
+      return NULL;
+    }
+  };
+
+  // Runs the jobs on threads, each with its own instance of the pass from
+  // P.new_leaf_worker(); the calling thread is one of them
+  template <class Pass, class Job>
+  void run_leaves(Pass& P, std::vector<Job>& jobs, unsigned threads){
+    LeafPool<Pass, Job> pool;
+    pool.jobs = &jobs;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    std::vector<LeafWorker<Pass, Job> > workers(threads);
+    std::vector<pthread_t> tids(threads);
+    std::vector<bool> started(threads, false);
+    for(unsigned t = 0; t < threads; t++){
+      workers[t].pool = &pool;
+      workers[t].pass = P.new_leaf_worker();
+    }
+    //if a thread cannot be created the others take over its jobs
+    for(unsigned t = 1; t < threads; t++)
+      started[t] = (pthread_create(&tids[t], NULL, LeafWorker<Pass, Job>::run, &workers[t]) == 0);
+    LeafWorker<Pass, Job>::run(&workers[0]);
+    for(unsigned t = 1; t < threads; t++)
+      if(started[t])
+        pthread_join(tids[t], NULL);
+
+    for(unsigned t = 0; t < threads; t++)
+      delete workers[t].pass;
+    pthread_mutex_destroy(&pool.lock);
+  }
+
+}
+
+#endif
@@ -0,0 +1,52 @@
+//===----------------- LeafSchedule.h ----------------------===//
+// Leaf module schedules handed from GenLPFSSchedule to
+//  GenCGSIMDSchedule when both passes run in the same opt invocation,
+//  in place of comm_aware.pl and comm_aware_schedule.txt.
+//
+//        This file was created by Scaffold Compiler Working Group
+//===----------------------------------------------------------------------===//
+
+#ifndef SCAFFOLD_LEAFSCHEDULE_H
+#define SCAFFOLD_LEAFSCHEDULE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "llvm/Pass.h"
+#include "llvm/Support/DataTypes.h"
+
+namespace llvm {
+
+  // Metrics of one leaf schedule, the fields comm_aware.pl used to extract
+  struct LeafMetrics{
+    uint64_t width;  //SIMD regions used
+    uint64_t ots;    //operation timesteps
+    uint64_t mts;    //timesteps with moves
+    uint64_t moves;
+    uint64_t tgates;
+    std::vector<uint64_t> mlist; //moves at each of the ots timesteps
+    LeafMetrics(): width(0), ots(0), mts(0), moves(0), tgates(0) { }
+  };
+
+  typedef std::map<std::string, LeafMetrics> LeafMetricsMap; //by function name
+
+  struct LeafScheduleInfo : public ImmutablePass {
+    static char ID; // Pass identification
+
+    // Leaves of every (k, d) scheduled, in the order they were scheduled
+    std::vector<std::pair<std::pair<unsigned, unsigned>, LeafMetricsMap> > configs;
+
+    LeafScheduleInfo() : ImmutablePass(ID) {}
+
+    LeafMetricsMap& config(unsigned k, unsigned d){
+      for(unsigned c = 0; c < configs.size(); c++)
+        if(configs[c].first == std::make_pair(k, d))
+          return configs[c].second;
+      configs.push_back(std::make_pair(std::make_pair(k, d), LeafMetricsMap()));
+      return configs.back().second;
+    }
+  };
+
+}
+
+#endif
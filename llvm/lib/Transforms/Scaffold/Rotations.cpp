@@ -1,12 +1,22 @@
 // Scaffold
 // This pass stops at Rz gates in the call graphs and decomposes them into
 // sequences of clifford+T gates
+// With -rotation-lib=<file> (or ROTATIONLIB) the sequences are assembled
+// in-process by RotLib::concatenate from a precomputed rotation library
 //
 
+#include <cctype>
 #include <cstdlib>
 #include <cstdio>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <set>
 #include <sstream>
 #include <string>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "llvm/ADT/ArrayRef.h"
 
@@ -14,24 +24,106 @@
 #include "llvm/Function.h"
 #include "llvm/Instructions.h"
 #include "llvm/Intrinsics.h"
+#include "llvm/Module.h"
 #include "llvm/LLVMContext.h"
 #include "llvm/Pass.h"
 
 #include "llvm/Support/CallSite.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/InstIterator.h"
 #include "llvm/Support/InstVisitor.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/CommandLine.h"
 
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
+#include "RotLib.h"
+
 using namespace llvm;
 
 static cl::opt<unsigned>
 SqctLevels("sqct-levels", cl::init(1), cl::Hidden,
   cl::desc("The rotation decomposition precision"));
 
+static cl::opt<std::string>
+RotationLib("rotation-lib", cl::init(""), cl::Hidden,
+  cl::desc("Assemble rotations from this RotLib library instead of calling ROTATIONPATH"));
+
+static cl::opt<unsigned>
+ROTATION_JOBS("rotation-jobs", cl::init(0), cl::Hidden,
+  cl::desc("Parallel rotation decompositions (0 = one per core)"));
+
 namespace {
+	// On-disk memo of rotation decompositions, shared by every compilation
+	// that points ROTATIONCACHE at the same directory. Each line of
+	// <dir>/rotations.cache is "<tool> <axis> <angle> <precision> <gates>";
+	// lines are appended under an exclusive flock and read under a shared one,
+	// so concurrent opt processes can use one file. Only single-line keys and
+	// gate strings without whitespace are stored, so every record parses back.
+	class RotationCache {
+		std::string File;
+		std::map<std::string, std::string> Entries;
+
+		static bool storable(const std::string &key, const std::string &gates) {
+			if (key.empty() || gates.empty() || key.find('\n') != std::string::npos)
+				return false;
+			for (std::string::const_iterator c = gates.begin(); c != gates.end(); ++c)
+				if (isspace(*c))
+					return false;
+			return true;
+		}
+	public:
+		bool enabled() const { return !File.empty(); }
+
+		void open(const char *dir) {
+			if (!dir || !*dir) return;
+			mkdir(dir, 0775); // may already exist
+			File = std::string(dir) + "/rotations.cache";
+			FILE *fp = fopen(File.c_str(), "r");
+			if (!fp) return;
+			flock(fileno(fp), LOCK_SH);
+			std::string entry;
+			int c;
+			while ((c = fgetc(fp)) != EOF) {
+				if (c != '\n') {
+					entry += (char)c;
+					continue;
+				}
+				// Only newline-terminated records count; a torn last line is skipped
+				size_t sep = entry.rfind(' ');
+				if (sep != std::string::npos && storable(entry.substr(0, sep), entry.substr(sep+1)))
+					Entries[entry.substr(0, sep)] = entry.substr(sep+1);
+				entry.clear();
+			}
+			flock(fileno(fp), LOCK_UN);
+			fclose(fp);
+		}
+
+		bool lookup(const std::string &key, std::string &gates) const {
+			std::map<std::string, std::string>::const_iterator it = Entries.find(key);
+			if (it == Entries.end()) return false;
+			gates = it->second;
+			return true;
+		}
+
+		void insert(const std::string &key, const std::string &gates) {
+			Entries[key] = gates;
+			if (!enabled()) return;
+			if (!storable(key, gates)) {
+				errs() << "Not caching multi-token decomposition for " << key << "\n";
+				return;
+			}
+			int fd = ::open(File.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0664);
+			if (fd < 0) return;
+			std::string line = key + " " + gates + "\n";
+			flock(fd, LOCK_EX);
+			ssize_t written = write(fd, line.data(), line.size());
+			(void)written;
+			flock(fd, LOCK_UN);
+			close(fd);
+		}
+	}; // class RotationCache
+
 	// We need to use a ModulePass in order to create new Functions
 	struct Rotations : public ModulePass {
 		static char ID;
@@ -40,11 +132,40 @@ namespace {
 		struct RotationVisitor : public InstVisitor<RotationVisitor> {
 			// All decompositions will be created as Functions in M's FunctionList
 			Module *M;
+			// Decompositions from earlier runs (see RotationCache)
+			RotationCache Cache;
+			// Precomputed library, when rotations are assembled in-process
+			RotLib *Lib;
 			// The constructor is called once per module (in runOnModule)
-			RotationVisitor(Module *module) : M(module) {}
+			RotationVisitor(Module *module, RotLib *lib) : M(module), Lib(lib) {
+				if (!Lib)
+					Cache.open(getenv("ROTATIONCACHE"));
+			}
+
+			// One external decomposition of the batch pre-pass
+			struct SynthJob { std::string cmd, key, circuit; };
+			struct SynthPool {
+				std::vector<SynthJob> *jobs;
+				size_t next;
+				pthread_mutex_t lock;
+			};
+
+			// Worker thread: runs queued commands until the pool is drained
+			static void *synthWorker(void *arg) {
+				SynthPool *pool = (SynthPool*)arg;
+				for (;;) {
+					pthread_mutex_lock(&pool->lock);
+					size_t j = pool->next++;
+					pthread_mutex_unlock(&pool->lock);
+					if (j >= pool->jobs->size())
+						return NULL;
+					SynthJob &job = (*pool->jobs)[j];
+					job.circuit = exec(job.cmd.c_str());
+				}
+			}
 
 			// private:
-			std::string exec(const char* cmd) {
+			static std::string exec(const char* cmd) {
 				FILE* pipe = popen(cmd, "r");
 				if (!pipe) return "ERROR";
 				char buffer[128];
@@ -56,6 +177,152 @@ namespace {
 				pclose(pipe);
 				return result;
 			} // exec()
+
+			// Builds the decomposition command for the tool in ROTATIONPATH and
+			// the cache key (tool, axis, angle, precision) of Rz(Angle). The key
+			// holds the angle as the tool is given it, so angles that print the
+			// same share the one decomposition the tool returns for them
+			bool command(double Angle, const std::string &axis, std::string &cmd, std::string &key) {
+				std::ostringstream ss2, angle;
+				char *path = getenv("ROTATIONPATH");
+				if (!path) {
+					errs() << "Rotation decomposer not found!\n";
+					return false;
+				}
+				char *prec = getenv("PRECISION");
+				std::string tool, precision;
+				if (std::string(path).find("gridsynth") != std::string::npos && axis == " Z " ) {
+					angle << std::fixed << Angle;
+					ss2 << path << " \"(" << angle.str() << ")\"" << " -d " << prec;
+					tool = "gridsynth";
+					precision = prec ? prec : "";
+				}
+				else if (std::string(path).find("sqct") != std::string::npos) {
+					angle << Angle;
+					ss2 << path << " " << angle.str() << axis << SqctLevels;
+					tool = "sqct";
+					std::ostringstream lvl; lvl << SqctLevels;
+					precision = lvl.str();
+				}
+				else {
+					errs() << "Rotation decomposition offline\n.";
+					return false;
+				}
+				cmd = ss2.str();
+				key = tool + " " + axis.substr(1, 1) + " " + angle.str() + " " + precision;
+				return true;
+			} // command()
+
+			// Strips the whitespace around the tool output; false if it failed
+			static bool trimCircuit(std::string &circuit) {
+				while (!circuit.empty() && isspace(circuit[circuit.length()-1]))
+					circuit.erase(circuit.length()-1);
+				size_t first = 0;
+				while (first < circuit.length() && isspace(circuit[first]))
+					first++;
+				circuit.erase(0, first);
+				return !circuit.empty() && circuit != "ERROR";
+			}
+
+			// Finds the Clifford+T sequence for an Rz(Angle), from the cache or
+			// from the tool in ROTATIONPATH. The sequence is returned without
+			// its trailing newline.
+			bool decompose(double Angle, const std::string &axis, std::string &circuit) {
+				if (Lib) {
+					// RotLib assembles Rz(Angle) from its library angles, no subprocess
+					RotLib::Rz rz;
+					Lib->concatenate(&rz, Angle);
+					circuit = rz.gates;
+					return true;
+				}
+				std::string cmd, key;
+				if (!command(Angle, axis, cmd, key))
+					return false;
+				if (Cache.lookup(key, circuit)) {
+					errs() << "Cached: " << circuit << "\n";
+					return true;
+				}
+
+				errs() << "Calling '" << cmd << "'\n";
+				// Capture result
+				circuit = exec(cmd.c_str());
+				errs() << "Decomp: " << circuit << "\n";
+				if (!trimCircuit(circuit))
+					return false;
+				Cache.insert(key, circuit);
+				return true;
+			} // decompose()
+
+			// Returns the constant angle of an Rz call, or false for anything else
+			static bool rzAngle(CallInst &I, double &Angle) {
+				Function *CF = I.getCalledFunction();
+				if (!CF || !CF->isIntrinsic() || CF->getIntrinsicID() != Intrinsic::Rz)
+					return false;
+				ConstantFP *C = dyn_cast<ConstantFP>(I.getArgOperand(1));
+				if (!C)
+					return false;
+				Angle = C->getValueAPF().convertToDouble();
+				return Angle != 0.0;
+			}
+
+			// Pre-pass: collects the unique Rz angles of the module that are not
+			// cached yet and runs the decomposition tool on all of them with a
+			// pool of ROTATION_JOBS workers. visitCallInst then finds every
+			// sequence in the cache.
+			void synthesizeAll(Module &Mod) {
+				if (Lib)
+					return;
+				std::vector<SynthJob> jobs;
+				std::set<std::string> seen;
+				for (Module::iterator F = Mod.begin(), FE = Mod.end(); F != FE; ++F)
+					for (inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I) {
+						CallInst *CI = dyn_cast<CallInst>(&*I);
+						double Angle;
+						if (!CI || !rzAngle(*CI, Angle))
+							continue;
+						SynthJob job;
+						std::string circuit;
+						if (!command(Angle, " Z ", job.cmd, job.key))
+							return;
+						if (Cache.lookup(job.key, circuit) || !seen.insert(job.key).second)
+							continue;
+						jobs.push_back(job);
+					}
+				if (jobs.empty())
+					return;
+
+				unsigned workers = ROTATION_JOBS;
+				if (workers == 0) {
+					long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+					workers = cpus > 0 ? (unsigned)cpus : 1;
+				}
+				if (workers > jobs.size())
+					workers = jobs.size();
+				errs() << "Decomposing " << jobs.size() << " rotation angles with "
+					<< workers << " workers\n";
+
+				SynthPool pool;
+				pool.jobs = &jobs;
+				pool.next = 0;
+				pthread_mutex_init(&pool.lock, NULL);
+				std::vector<pthread_t> threads(workers);
+				unsigned started = 0;
+				for (unsigned w = 0; w < workers; w++)
+					if (pthread_create(&threads[started], NULL, synthWorker, &pool) == 0)
+						started++;
+				if (started == 0)
+					synthWorker(&pool);
+				for (unsigned w = 0; w < started; w++)
+					pthread_join(threads[w], NULL);
+				pthread_mutex_destroy(&pool.lock);
+
+				for (std::vector<SynthJob>::iterator J = jobs.begin(), JE = jobs.end(); J != JE; ++J) {
+					errs() << "Called '" << J->cmd << "'\nDecomp: " << J->circuit << "\n";
+					if (trimCircuit(J->circuit))
+						Cache.insert(J->key, J->circuit);
+				}
+			} // synthesizeAll()
+
 			// public: 
 			void visitCallInst(CallInst &I) {
 				// Determine whether this is an Rz gate
@@ -79,6 +346,7 @@ namespace {
 				}
 				// Detemine whether we know the rotation angle
 				if (!isa<ConstantFP>(I.getArgOperand(1))) {
+					// left for dyn-gen-qasm-with-loops -dyn-rotations to decompose at run time
 					errs() << "Unknown rotation angle\n";
 					return;
 				}
@@ -122,6 +390,9 @@ namespace {
 				Function *DR = M->getFunction(FuncName);
 				// If it does not exist perform a decomposition
 				if (!DR) {
+					std::string circuit;
+					if (!decompose(Angle, axis, circuit))
+						return;
 					// Create the new function
 					DR = Function::Create(FuncType, GlobalVariable::ExternalLinkage,
 						FuncName, M);
@@ -133,36 +404,9 @@ namespace {
 
 					// Create a BasicBlock and insert it at the end of the Function
 					// Populate the BasicBlock
-					// Build rotation decomposition command
-					std::string buf; std::ostringstream ss2;
-					char *path = getenv("ROTATIONPATH");
-					if (!path) {
-						errs() << "Rotation decomposer not found!\n";
-						return;
-					}          
-          char *prec = getenv("PRECISION");
-          if (std::string(path).find("gridsynth") != std::string::npos && axis == " Z " ) {
-    			  ss2 << path << " \"(" << std::fixed << Angle << ")\"" << " -d " << prec;          
-          }
-          else if (std::string(path).find("sqct") != std::string::npos) {
-            ss2 << path << " " << Angle << axis << SqctLevels;
-          }
-          else {
-            errs() << "Rotation decomposition offline\n.";
-			return;
-          }
-          
-          buf = ss2.str();
-          raw_string_ostream ss3(buf);          
-					errs() << "Calling '" << ss3.str() << "'\n";
-					// Capture result
-          // if basic rotation angle, do not decompose
-          //if (Angle == 3.14 || Angle == 1.57 || Angle == 0) 
-					std::string circuit = exec(ss3.str().c_str());
-					errs() << "Decomp: " << circuit << "\n";
 					// For each gate in decomposition:
           // (the decomposed string is given in the reverse order that ops must be applied)
-					for (int i=circuit.length()-2; i>=0; i--) {
+					for (int i=circuit.length()-1; i>=0; i--) {
 						Function *gate = NULL;
 						switch(circuit[i]) {
 							case 'T':
@@ -212,8 +456,26 @@ namespace {
 		}; // struct RotationVisitor
 
 		virtual bool runOnModule(Module &M) {
-			RotationVisitor RV(&M);
+			// -rotation-lib, or ROTATIONLIB in the environment like ROTATIONPATH
+			std::string libFile = RotationLib;
+			if (libFile.empty() && getenv("ROTATIONLIB"))
+				libFile = getenv("ROTATIONLIB");
+			RotLib *Lib = NULL;
+			if (!libFile.empty()) {
+				errs() << "Loading rotation library " << libFile << "\n";
+				Lib = new RotLib(libFile.c_str());
+				if (!Lib->error.empty()) {
+					errs() << "Cannot load rotation library: " << Lib->error
+						<< ", decomposing with ROTATIONPATH instead\n";
+					delete Lib;
+					Lib = NULL;
+				}
+			}
+
+			RotationVisitor RV(&M, Lib);
+			RV.synthesizeAll(M);
 			RV.visit(M);
+			delete Lib;
 
 			return true;
 		} // runOnModule()
@@ -0,0 +1,141 @@
+//===----------------------------- UnrollClone.cpp -----------------------===//
+// This file implements the Scaffold pass that fully unrolls loops and clones
+// functions with constant arguments until the module reaches a fixed point.
+//
+// Each iteration runs the same sequence as one round of the $(FILE)6.ll rule
+// in Scaffold.makefile:
+//   -mem2reg -loops -loop-simplify -loop-rotate -lcssa -loop-unroll
+//   -unroll-threshold=100000000 -sccp -simplifycfg -FunctionClone -sccp
+//   -deadargelim
+// Convergence is detected from a hash of every function's printed body
+// instead of a 'diff' of whole textual modules.
+//
+//        This file was created by Scaffold Compiler Working Group
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "UnrollClone"
+#include <map>
+#include <string>
+#include "llvm/Pass.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Function.h"
+#include "llvm/Module.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "HashStream.h"
+
+using namespace llvm;
+
+STATISTIC(NumIterations, "Number of unroll/clone iterations");
+
+static cl::opt<unsigned>
+MAX_ITERATIONS("unroll-clone-max-iter", cl::init(0), cl::Hidden,
+    cl::desc("Stop unroll/clone after this many iterations (0 = until fixed point)"));
+
+namespace {
+
+  struct UnrollClone : public ModulePass {
+    static char ID; // Pass identification
+    UnrollClone() : ModulePass(ID) {}
+
+    typedef std::map<std::string, uint64_t> HashMap;
+
+    // Hash each function (and, under "", the global variables) of M
+    void hashModule(Module &M, HashMap &hashes);
+
+    // Number of entries that differ between two snapshots
+    unsigned countChanged(const HashMap &before, const HashMap &after);
+
+    bool runOnModule (Module &M);
+
+  }; // End of struct UnrollClone
+} // End of anonymous namespace
+
+char UnrollClone::ID = 0;
+static RegisterPass<UnrollClone> X("UnrollClone", "Unroll and clone functions until a fixed point", false, false);
+
+void UnrollClone::hashModule(Module &M, HashMap &hashes) {
+  hashes.clear();
+  hash_ostream globals;
+  for (Module::global_iterator G = M.global_begin(), E = M.global_end(); G != E; ++G)
+    G->print(globals);
+  hashes[""] = globals.hash();
+
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    hash_ostream hs;
+    F->print(hs);
+    hashes[F->getName().str()] = hs.hash();
+  }
+}
+
+unsigned UnrollClone::countChanged(const HashMap &before, const HashMap &after) {
+  unsigned changed = 0;
+  for (HashMap::const_iterator i = after.begin(), e = after.end(); i != e; ++i) {
+    HashMap::const_iterator old = before.find(i->first);
+    if (old == before.end() || old->second != i->second)
+      changed++;
+  }
+  for (HashMap::const_iterator i = before.begin(), e = before.end(); i != e; ++i)
+    if (after.find(i->first) == after.end())
+      changed++;
+  return changed;
+}
+
+bool UnrollClone::runOnModule (Module &M) {
+  const PassInfo *CloneInfo = PassRegistry::getPassRegistry()->getPassInfo("FunctionClone");
+  if (!CloneInfo || !CloneInfo->getNormalCtor()) {
+    errs() << "UnrollClone: FunctionClone pass is not registered\n";
+    return false;
+  }
+
+  HashMap before, after;
+  hashModule(M, before);
+
+  unsigned iter = 0;
+  bool modified = false;
+  while (MAX_ITERATIONS == 0 || iter < MAX_ITERATIONS) {
+    iter++;
+    NumIterations++;
+    errs() << "Unrolling Loops and Cloning Functions (" << iter << ") ...\n";
+
+    PassManager PM;
+    PM.add(new TargetLibraryInfo(Triple(M.getTargetTriple())));
+    if (!M.getDataLayout().empty())
+      PM.add(new TargetData(M.getDataLayout()));
+    PM.add(createPromoteMemoryToRegisterPass());
+    PM.add(createLoopSimplifyPass());
+    PM.add(createLoopRotatePass());
+    PM.add(createLCSSAPass());
+    PM.add(createLoopUnrollPass(100000000));
+    PM.add(createSCCPPass());
+    PM.add(createCFGSimplificationPass());
+    PM.add(CloneInfo->getNormalCtor()());
+    PM.add(createSCCPPass());
+    PM.add(createDeadArgEliminationPass());
+
+    // No pass reporting a change is conclusive; otherwise compare bodies,
+    // since FunctionClone always claims to have modified the module.
+    if (!PM.run(M))
+      break;
+    modified = true;
+
+    hashModule(M, after);
+    unsigned changed = countChanged(before, after);
+    if (changed == 0)
+      break;
+    errs() << "\t" << changed << " functions changed\n";
+    before.swap(after);
+  }
+
+  errs() << "Unroll/clone converged after " << iter << " iterations\n";
+  return modified;
+
+} // End runOnModule
@@ -21,6 +21,7 @@ function show_help {
     echo "    -l   Levels of recursion to run (default=1)"
     echo "    -P   Set precision of rotation decomposition in decimal digits (default=10)"
     echo "    -F   Force running all steps"
+    echo "    -C   Do not use the compilation cache (\$SCAFFOLD_CACHE, default ${ROOT}/cache)"
     echo "    -c   Clean all files (no other actions)"
     echo "    -k   Keep all intermediate files (default only keeps specified output,"
     echo "         but requires recompilation for any new output)"
@@ -40,6 +41,7 @@ rkqc=0
 clean=0
 dryrun=""
 force=0
+cache=1
 purge=1
 res=0
 coptimization=0
@@ -52,7 +54,7 @@ precision=4
 tracking=0
 targets=""
 optimize=0
-while getopts "h?vcdfbsOFkqrtoTRl:P:" opt; do
+while getopts "h?vcdfbsOFCkqrtoTRl:P:" opt; do
     case "$opt" in
     h|\?)
         show_help
@@ -68,6 +70,8 @@ while getopts "h?vcdfbsOFkqrtoTRl:P:" opt; do
         ;;
     F) force=1
         ;;
+    C) cache=0
+        ;;
     f) flat=1
         ;;
 	b) openqasm=1
@@ -161,6 +165,11 @@ if [ ${clean} -eq 1 ]; then
 	make -f $ROOT/scaffold/Scaffold.makefile ${dryrun} ROOT=$ROOT DIRNAME=${dir} FILENAME=${filename} FILE=${file} CFILE=${cfile} clean
     exit
 fi
-make -f $ROOT/scaffold/Scaffold.makefile ${dryrun} ROOT=$ROOT DIRNAME=${dir} FILENAME=${filename} FILE=${file} CFILE=${cfile} TOFF=${toff} RKQC=${rkqc} COPTIMIZATION=${coptimization} ROTATIONS=${rot} PRECISION=${precision} OPTIMIZE=${optimize} ${targets}
+flags="ROOT=$ROOT DIRNAME=${dir} FILENAME=${filename} FILE=${file} CFILE=${cfile} TOFF=${toff} RKQC=${rkqc} COPTIMIZATION=${coptimization} ROTATIONS=${rot} PRECISION=${precision} OPTIMIZE=${optimize} CACHE=${cache}"
+# Restore a previously compiled ${file}12.ll before deciding what to rebuild
+if [ ${cache} -eq 1 ] && [ ${force} -eq 0 ]; then
+    make -f $ROOT/scaffold/Scaffold.makefile ${dryrun} ${flags} cache-fetch
+fi
+make -f $ROOT/scaffold/Scaffold.makefile ${dryrun} ${flags} ${targets}
 
 exit 0
@@ -1,62 +1,518 @@
-#include <iostream>
+//===----------------------------- scaffold.cpp --------------------------===//
+// Native Scaffold compiler driver.
+//
+// Runs the clang frontend and the Scaffold pass sequence of
+// Scaffold.makefile on a single in-memory Module, instead of one opt
+// process per stage that re-parses and re-prints textual .ll files.
+// Intermediate IR ($(FILE)1.ll ... $(FILE)12.ll) is only written with -k.
+// It neither runs CTQG nor uses the $(FILE)12.ll compilation cache of
+// scaffold.sh, and has no -c, -d, -F or -C modes.
+//
+//        This file was created by Scaffold Compiler Working Group
+//
+//===----------------------------------------------------------------------===//
 
-#include "llvm/Support/Host.h"
-#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
 
+#include "clang/Basic/Version.h"
+#include "clang/CodeGen/CodeGenAction.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Tool.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
 #include "clang/Frontend/DiagnosticOptions.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
-#include "clang/Frontend/CompilerInstance.h"
-#include "clang/Basic/TargetOptions.h"
-#include "clang/Basic/TargetInfo.h"
-#include "clang/Basic/FileManager.h"
-#include "clang/AST/ASTConsumer.h"
-#include "clang/Parse/ParseAST.h"
 
-#include "clang/Lex/Preprocessor.h"
-#include "clang/AST/ASTContext.h"
+#include "llvm/ADT/OwningPtr.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/Verifier.h"
+#include "llvm/Assembly/PrintModulePass.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/LinkAllPasses.h"
+#include "llvm/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetLibraryInfo.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+InputFilename(cl::Positional, cl::Required, cl::desc("<filename>.scaffold"));
+
+static cl::opt<bool>
+Resources("r", cl::Grouping, cl::desc("Generate resource estimate (default)"));
+
+static cl::opt<bool>
+Tracking("t", cl::Grouping, cl::desc("Variable tracking"));
+
+static cl::opt<bool>
+QASM("q", cl::Grouping, cl::desc("Generate QASM"));
+
+static cl::opt<bool>
+FlatQASM("f", cl::Grouping, cl::desc("Generate flattened QASM"));
+
+static cl::opt<bool>
+OpenQASM("b", cl::Grouping, cl::desc("Generate OpenQASM"));
+
+static cl::opt<bool>
+OptimizeQASM("o", cl::Grouping, cl::desc("Generate optimized QASM"));
+
+static cl::opt<bool>
+COptimization("O", cl::Grouping, cl::desc("Enable C++ optimization routine"));
+
+static cl::opt<bool>
+Rotations("R", cl::Grouping, cl::desc("Enable rotation decomposition"));
+
+static cl::opt<bool>
+Toffoli("T", cl::Grouping, cl::desc("Enable Toffoli decomposition"));
+
+static cl::opt<bool>
+QXSim("s", cl::Grouping, cl::desc("Generate QX Simulator input file"));
+
+static cl::opt<bool>
+Keep("k", cl::Grouping,
+    cl::desc("Keep all intermediate files (written as textual IR)"));
+
+static cl::opt<unsigned>
+Precision("P", cl::Prefix, cl::init(4),
+    cl::desc("Set precision of rotation decomposition in decimal digits"));
+
+static cl::opt<unsigned>
+Levels("l", cl::Prefix, cl::init(1),
+    cl::desc("Levels of recursion to run (default=1)"));
+
+// Search paths handed to the frontend; matches CC_FLAGS in Scaffold.makefile
+static const char *IncludeDirs[] = {
+  "-I/usr/include",
+  "-I/usr/include/x86_64-linux-gnu",
+  "-I/usr/lib/gcc/x86_64-linux-gnu/4.8/include"
+};
+
+// This function isn't referenced outside its translation unit, but it
+// can't use the "static" keyword because its address is used for
+// GetMainExecutable.
+sys::Path GetExecutablePath(const char *Argv0) {
+  void *MainAddr = (void*) (intptr_t) GetExecutablePath;
+  return sys::Path::GetMainExecutable(Argv0, MainAddr);
+}
+
+namespace {
+
+  // Redirects stderr to a file (or restores it) at a fixed point in the
+  // pass sequence. The Scaffold output passes print to errs(), which the
+  // makefile captures with '2> $(FILE).<ext>'.
+  struct StderrRedirect : public ModulePass {
+    static char ID;
+    static int SavedFd;
+    std::string File; // empty: restore the original stderr
+
+    StderrRedirect(const std::string &F) : ModulePass(ID), File(F) {}
+
+    virtual bool runOnModule(Module &M) {
+      errs().flush();
+      fflush(stderr);
+      if (!File.empty()) {
+        int fd = open(File.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+          errs() << "[scaffold] Cannot open " << File << "\n";
+          return false;
+        }
+        if (SavedFd < 0)
+          SavedFd = dup(2);
+        dup2(fd, 2);
+        close(fd);
+      } else if (SavedFd >= 0) {
+        dup2(SavedFd, 2);
+        close(SavedFd);
+        SavedFd = -1;
+      }
+      return false;
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesAll();
+    }
+  };
+
+} // End of anonymous namespace
+
+char StderrRedirect::ID = 0;
+int StderrRedirect::SavedFd = -1;
+
+// Adds target information the way opt does for every module it loads
+static void addTargetPasses(PassManager &PM, Module &M) {
+  PM.add(new TargetLibraryInfo(Triple(M.getTargetTriple())));
+  if (!M.getDataLayout().empty())
+    PM.add(new TargetData(M.getDataLayout()));
+}
+
+// Appends a space-separated list of opt pass names ("-mem2reg -sccp ...")
+// to PM. Scaffold passes are looked up after Scaffold.so has registered them.
+static bool addPasses(PassManager &PM, const std::string &Pipeline) {
+  std::istringstream ss(Pipeline);
+  std::string name;
+  while (ss >> name) {
+    if (name[0] == '-')
+      name.erase(0, 1);
+    const PassInfo *PI = PassRegistry::getPassRegistry()->getPassInfo(name);
+    if (!PI || !PI->getNormalCtor()) {
+      errs() << "[scaffold] Unknown pass: -" << name << "\n";
+      return false;
+    }
+    PM.add(PI->getNormalCtor()());
+  }
+  return true;
+}
+
+// Writes the module as textual IR to File when intermediates are kept
+static void addKeep(PassManager &PM, const std::string &File) {
+  if (!Keep)
+    return;
+  std::string Err;
+  raw_fd_ostream *Out = new raw_fd_ostream(File.c_str(), Err);
+  if (!Err.empty()) {
+    errs() << "[scaffold] " << Err << "\n";
+    delete Out;
+    return;
+  }
+  PM.add(createPrintModulePass(Out, true));
+}
+
+// Runs Pipeline with its stderr captured in File, as 'opt ... 2> File'
+static bool addOutput(PassManager &PM, const std::string &Pipeline,
+                      const std::string &File) {
+  PM.add(new StderrRedirect(File));
+  if (!addPasses(PM, Pipeline))
+    return false;
+  PM.add(new StderrRedirect(""));
+  return true;
+}
+
+// Compiles the .scaffold source to an in-memory Module through clang
+static Module *runFrontend(const std::string &ClangPath,
+                           const std::string &ResourceDir,
+                           const std::string &Input, LLVMContext &Ctx) {
+  using namespace clang;
+  using namespace clang::driver;
+
+  TextDiagnosticPrinter *DiagClient =
+    new TextDiagnosticPrinter(errs(), DiagnosticOptions());
+  IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
+  DiagnosticsEngine Diags(DiagID, DiagClient);
+  Driver TheDriver(ClangPath, sys::getDefaultTargetTriple(), "a.out",
+                   /*IsProduction=*/false, Diags);
+
+  std::string DirFlag = "-I" + sys::path::parent_path(Input).str();
+  if (DirFlag == "-I")
+    DirFlag = "-I.";
+  SmallVector<const char *, 16> Args;
+  Args.push_back(ClangPath.c_str());
+  Args.push_back(Input.c_str());
+  for (unsigned i = 0; i < sizeof(IncludeDirs)/sizeof(IncludeDirs[0]); i++)
+    Args.push_back(IncludeDirs[i]);
+  Args.push_back(DirFlag.c_str());
+  // Forces a single -cc1 job; the action below replaces it with codegen
+  Args.push_back("-fsyntax-only");
+  OwningPtr<Compilation> C(TheDriver.BuildCompilation(Args));
+  if (!C)
+    return 0;
+
+  const JobList &Jobs = C->getJobs();
+  if (Jobs.size() != 1 || !isa<Command>(*Jobs.begin())) {
+    SmallString<256> Msg;
+    raw_svector_ostream OS(Msg);
+    C->PrintJob(OS, C->getJobs(), "; ", true);
+    Diags.Report(diag::err_fe_expected_compiler_job) << OS.str();
+    return 0;
+  }
+  const Command *Cmd = cast<Command>(*Jobs.begin());
+  const ArgStringList &CCArgs = Cmd->getArguments();
+  OwningPtr<CompilerInvocation> CI(new CompilerInvocation);
+  CompilerInvocation::CreateFromArgs(*CI,
+      const_cast<const char **>(CCArgs.data()),
+      const_cast<const char **>(CCArgs.data()) + CCArgs.size(), Diags);
+
+  CompilerInstance Clang;
+  Clang.setInvocation(CI.take());
+  Clang.createDiagnostics(int(CCArgs.size()), const_cast<char**>(CCArgs.data()));
+  if (!Clang.hasDiagnostics())
+    return 0;
+  if (Clang.getHeaderSearchOpts().UseBuiltinIncludes &&
+      Clang.getHeaderSearchOpts().ResourceDir.empty())
+    Clang.getHeaderSearchOpts().ResourceDir = ResourceDir;
+
+  OwningPtr<CodeGenAction> Act(new EmitLLVMOnlyAction(&Ctx));
+  if (!Clang.ExecuteAction(*Act))
+    return 0;
+  return Act->takeModule();
+}
+
+// Scaffold.so registers its cl::opts when it is loaded, after those of the
+// driver, so they follow an option constructed after the load in the list
+// of registered options
+static cl::Option *findScaffoldOption(const cl::Option &After, StringRef Name) {
+  for (cl::Option *O = After.getNextRegisteredOption(); O;
+       O = O->getNextRegisteredOption())
+    if (Name == O->ArgStr)
+      return O;
+  errs() << "[scaffold] " << Name << " is not an option of Scaffold.so\n";
+  return 0;
+}
+
+// Runs a post-processing command of Scaffold.makefile through the shell
+static bool runCommand(const std::string &Cmd) {
+  errs().flush();
+  if (system(Cmd.c_str()) != 0) {
+    errs() << "[scaffold] Failed: " << Cmd << "\n";
+    return false;
+  }
+  return true;
+}
+
+// Same test as scaffold.sh: any line starting an 'rkqc' module
+static bool hasRKQC(const std::string &Input) {
+  std::ifstream in(Input.c_str());
+  std::string line;
+  while (std::getline(in, line))
+    if (line.compare(0, 4, "rkqc") == 0 && line.find('{') != std::string::npos)
+      return true;
+  return false;
+}
 
 int main(int argc, char *argv[]) {
-	using clang::CompilerInstance;
-	using clang::TargetOptions;
-	using clang::TargetInfo;
-	using clang::FileEntry;
-	using clang::ASTConsumer;
-	using clang::DiagnosticOptions;
-	using clang::TextDiagnosticPrinter;
-
-	CompilerInstance CI;
-	DiagnosticOptions diagnosticOptions;
-	TextDiagnosticPrinter *pTextDiagnosticPrinter =
-		new TextDiagnosticPrinter(
-			llvm::outs(), diagnosticOptions, true);
-	CI.createDiagnostics(0, NULL, pTextDiagnosticPrinter);
-
-	TargetOptions targetOptions;
-	targetOptions.Triple = llvm::sys::getDefaultTargetTriple();
-	TargetInfo *pTargetInfo = TargetInfo::CreateTargetInfo(
-			CI.getDiagnostics(), targetOptions);
-	CI.setTarget(pTargetInfo);
-
-	CI.createFileManager();
-	CI.createSourceManager(CI.getFileManager());
-	CI.createPreprocessor();
-	CI.getPreprocessorOpts().UsePredefines = false;
-	ASTConsumer *astConsumer = new ASTConsumer();
-	CI.setASTConsumer(astConsumer);
-
-	CI.createASTContext();
-	CI.createSema(clang::TU_Complete, NULL);
-
-	const FileEntry *pFile = CI.getFileManager().getFile(argv[1]);
-	CI.getSourceManager().createMainFileID(pFile);
-
-	CI.getASTContext().BuiltinInfo.InitializeBuiltins(
-		CI.getPreprocessor().getIdentifierTable(), CI.getLangOpts());
-
-	CI.getDiagnosticClient().BeginSourceFile(
-			CI.getLangOpts(), &(CI.getPreprocessor()));
-	clang::ParseAST(CI.getSema());
-	CI.getDiagnosticClient().EndSourceFile();
-
-	return 0;
-	}
+  llvm_shutdown_obj Y;
+
+  // <root>/scaffold/scaffold -> <root>
+  sys::Path Exe = GetExecutablePath(argv[0]);
+  std::string Root = sys::path::parent_path(
+      sys::path::parent_path(Exe.str())).str();
+  std::string Build = Root + "/build/Release+Asserts";
+#ifdef __APPLE__
+  std::string ScaffoldLib = Build + "/lib/Scaffold.dylib";
+#else
+  std::string ScaffoldLib = Build + "/lib/Scaffold.so";
+#endif
+  if (char *lib = getenv("SCAFFOLD_LIB"))
+    ScaffoldLib = lib;
+
+  PassRegistry &Registry = *PassRegistry::getPassRegistry();
+  initializeCore(Registry);
+  initializeScalarOpts(Registry);
+  initializeIPO(Registry);
+  initializeAnalysis(Registry);
+  initializeIPA(Registry);
+  initializeTransformUtils(Registry);
+  initializeInstCombine(Registry);
+  initializeTarget(Registry);
+
+  // Scaffold passes register themselves (and their cl::opts) on load, so
+  // this has to happen before the command line is parsed.
+  std::string Err;
+  if (sys::DynamicLibrary::LoadLibraryPermanently(ScaffoldLib.c_str(), &Err)) {
+    errs() << "[scaffold] Cannot load " << ScaffoldLib << ": " << Err << "\n";
+    return 1;
+  }
+
+  static cl::opt<bool> ScaffoldOpts("scaffold-options", cl::ReallyHidden);
+  cl::ParseCommandLineOptions(argc, argv, "Scaffold compiler driver\n\n"
+      "  Unlike scaffold.sh, it does not run CTQG or use the compilation\n"
+      "  cache, and has no -c, -d, -F or -C modes.\n");
+
+  // FlattenModule is only run for complete inlining ('-FlattenModule -all 1'),
+  // and -l sets the levels of sqct ('-sqct-levels'); both are opt<unsigned>
+  cl::Option *All = findScaffoldOption(ScaffoldOpts, "all");
+  cl::Option *SqctLevels = findScaffoldOption(ScaffoldOpts, "sqct-levels");
+  if (!All || !SqctLevels)
+    return 1;
+  if (!All->getNumOccurrences())
+    *static_cast<cl::opt<unsigned> *>(All) = 1;
+  if (Levels.getNumOccurrences())
+    *static_cast<cl::opt<unsigned> *>(SqctLevels) = Levels;
+
+  std::string File = sys::path::stem(InputFilename).str();
+  bool RKQC = hasRKQC(InputFilename);
+  bool Toff = Toffoli || RKQC;
+  bool Flat = FlatQASM || QXSim;
+  if (!QASM && !OpenQASM && !Tracking && !OptimizeQASM && !Flat)
+    Resources = true;
+
+  std::string RotationPath = Root + "/Rotations/gridsynth/gridsynth";
+  if (char *path = getenv("ROTATIONPATH"))
+    RotationPath = path;
+  std::ostringstream prec;
+  prec << Precision;
+  setenv("ROTATIONPATH", RotationPath.c_str(), 1);
+  setenv("PRECISION", prec.str().c_str(), 1);
+  // Rotations keeps synthesized sequences in the same cache as scaffold.sh
+  if (!getenv("ROTATIONCACHE")) {
+    char *cache = getenv("SCAFFOLD_CACHE");
+    setenv("ROTATIONCACHE", cache ? cache : (Root + "/cache").c_str(), 1);
+  }
+
+  LLVMContext &Ctx = getGlobalContext();
+  errs() << "[scaffold] Compiling " << InputFilename << " ...\n";
+  OwningPtr<Module> M(runFrontend(Build + "/bin/clang",
+      Build + "/lib/clang/" CLANG_VERSION_STRING, InputFilename, Ctx));
+  if (!M)
+    return 1;
+  if (Keep) {
+    PassManager PM;
+    addKeep(PM, File + ".ll");
+    PM.run(*M);
+  }
+
+  // Cbit transformation and optional O1 chain ($(FILE)1.ll, $(FILE)4.ll)
+  {
+    PassManager PM;
+    addTargetPasses(PM, *M);
+    errs() << "[scaffold] Transforming cbits ...\n";
+    if (!addPasses(PM, "-xform-cbit-stores"))
+      return 1;
+    addKeep(PM, File + "1.ll");
+    if (COptimization) {
+      errs() << "[scaffold] O1 optimizations ...\n";
+      if (!addPasses(PM, "-no-aa -tbaa -targetlibinfo -basicaa "
+            "-simplifycfg -domtree -early-cse -lower-expect "
+            "-targetlibinfo -no-aa -tbaa -basicaa -globalopt -ipsccp "
+            "-simplifycfg -basiccg -prune-eh -always-inline -functionattrs "
+            "-domtree -early-cse -lazy-value-info -constantprop "
+            "-correlated-propagation -tailcallelim -reassociate -loops "
+            "-loop-simplify -lcssa -loop-rotate -licm -loop-unswitch "
+            "-scalar-evolution -loop-simplify -iv-users -indvars -loop-idiom "
+            "-loop-deletion -loop-unroll -memdep -memcpyopt -sccp "
+            "-lazy-value-info -correlated-propagation -dse -adce "
+            "-strip-dead-prototypes -preverify -verify"))
+        return 1;
+    }
+    addKeep(PM, File + "4.ll");
+    PM.run(*M);
+  }
+
+  // Remaining Scaffold passes and the requested outputs
+  PassManager PM;
+  addTargetPasses(PM, *M);
+  // Unroll and clone until the module stops changing ($(FILE)6.ll)
+  if (!addPasses(PM, "-UnrollClone -internalize -globaldce -adce"))
+    return 1;
+  addKeep(PM, File + "6.ll");
+
+  if (Rotations) {
+    if (!getenv("ROTATIONLIB") && !sys::fs::exists(RotationPath)) {
+      errs() << "[scaffold] Rotation tool not built, skipping rotation decomposition ...\n";
+    } else {
+      errs() << "[scaffold] Decomposing Rotations ...\n";
+      if (!addPasses(PM, "-Rotations"))
+        return 1;
+    }
+  }
+  addKeep(PM, File + "7.ll");
+
+  if (!addPasses(PM, "-internalize -globaldce -deadargelim"))
+    return 1;
+  addKeep(PM, File + "8.ll");
+
+  if (RKQC) {
+    errs() << "[scaffold] Compiling RKQC Functions ...\n";
+    if (!addOutput(PM, "-GenRKQC", File + ".errs"))
+      return 1;
+  }
+  addKeep(PM, File + "9.ll");
+
+  if (Toff) {
+    errs() << "[scaffold] Toffoli Decomposition ...\n";
+    if (!addPasses(PM, "-ToffoliReplace"))
+      return 1;
+  }
+  addKeep(PM, File + "11.ll");
+
+  if (!addPasses(PM, "-FunctionReverse"))
+    return 1;
+  addKeep(PM, File + "12.ll");
+
+  if (Resources && !addOutput(PM, "-ResourceCount", File + ".resources"))
+    return 1;
+  if (QASM && !addOutput(PM, "-gen-qasm", File + ".qasmh"))
+    return 1;
+
+  // Outputs that work on the completely inlined module ($(FILE)12.inlined.ll)
+  if (Tracking || OpenQASM || OptimizeQASM || Flat) {
+    errs() << "[scaffold] Flattening modules ...\n";
+    if (!addPasses(PM, "-FlattenModule"))
+      return 1;
+    addKeep(PM, File + "12.inlined.ll");
+  }
+  if (Tracking && !addOutput(PM, "-var-tracking", File + ".debug"))
+    return 1;
+  if (OpenQASM && !addOutput(PM, "-gen-openqasm", File + ".qasm"))
+    return 1;
+  if (OptimizeQASM && !addOutput(PM, "-Optimize", File + "_optimized.qasmf"))
+    return 1;
+  // Flat QASM is printed by running the hierarchical QASM of the flattened
+  // module, as $(FILE).qasmf in Scaffold.makefile
+  if (Flat && !addOutput(PM, "-gen-qasm", File + ".qasmh"))
+    return 1;
+  PM.add(createVerifierPass());
+  PM.run(*M);
+
+  if (Flat) {
+    errs() << "[scaffold] Generating flattened QASM ...\n";
+#ifdef __APPLE__
+    std::string SysRoot = " -isysroot $(xcrun --sdk macosx --show-sdk-path)";
+#else
+    std::string SysRoot;
+#endif
+    bool ok = runCommand("python " + Root + "/scaffold/flatten-qasm.py " + File + ".qasmh") &&
+      runCommand(Build + "/bin/clang" + SysRoot + " " + File + "_qasm.scaffold -o " + File + "_qasm") &&
+      runCommand("./" + File + "_qasm > " + File + ".tmp") &&
+      runCommand("cat fdecl.out " + File + ".tmp > " + File + ".qasmf");
+    if (!Keep) {
+      std::string Temps[] = { File + "_qasm", File + "_qasm.scaffold", "fdecl.out", File + ".tmp" };
+      for (unsigned i = 0; i < sizeof(Temps)/sizeof(Temps[0]); i++)
+        unlink(Temps[i].c_str());
+    }
+    if (!ok)
+      return 1;
+    if (QXSim) {
+      errs() << "[scaffold] Transforming flat QASM to QX Simulator input ...\n";
+      if (!runCommand("bash " + Root + "/scripts/qasmf2qc.sh " + File + ".qasmf"))
+        return 1;
+    }
+  }
+
+  if (Resources)
+    errs() << "[scaffold] Resources written to " << File << ".resources ...\n";
+  if (QASM)
+    errs() << "[scaffold] Hierarchical QASM written to " << File << ".qasmh ...\n";
+  if (Tracking)
+    errs() << "[scaffold] Variable Tracking written to " << File << ".debug ...\n";
+  if (OpenQASM)
+    errs() << "[scaffold] OpenQASM written to " << File << ".qasm ...\n";
+  if (OptimizeQASM)
+    errs() << "[scaffold] Optimized circuit written to " << File << "_optimized.qasmf ...\n";
+  if (Flat)
+    errs() << "[scaffold] Flat QASM written to " << File << ".qasmf ...\n";
+  if (QXSim)
+    errs() << "[scaffold] QX Simulator input written to " << File << ".qc ...\n";
+
+  return 0;
+}
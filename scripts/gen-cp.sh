@@ -8,6 +8,8 @@ SCAF=$ROOT/build/Release+Asserts/lib/Scaffold.so
 # Module flattening threshold
 # note: thresholds must be picked from the set in scripts/flattening_thresh.py
 THRESHOLDS=(010k 100k 2M 25M)
+# Threads analyzing leaf modules in parallel (0: one per core)
+THREADS=0
 
 # Create directory to put all byproduct and output files in
 for f in $*; do
@@ -47,7 +49,7 @@ for f in $*; do
     fi
     if [ ! -e ${b}/${b}.flat${th}.cp ]; then
       echo "[gen-cp.sh] Critical path calculation ..."        
-      /usr/bin/time -v $OPT -load $SCAF -GetCriticalPath ${b}/${b}.flat${th}.ll >/dev/null 2> ${b}/${b}.flat${th}.cp
+      /usr/bin/time -v $OPT -load $SCAF -GetCriticalPath -critical-path-threads $THREADS ${b}/${b}.flat${th}.ll >/dev/null 2> ${b}/${b}.flat${th}.cp
     fi
   done
   rm -f *flat*txt ${b}.out
@@ -19,6 +19,11 @@ K=(2)
 THRESHOLDS=(010k)
 # Full schedule? otherwise only generates metrics (faster)
 FULL_SCHED=1
+# Threads scheduling leaf modules in parallel (0: one per core)
+THREADS=0
+# Leaf schedules are kept in this file and reused by later runs, for any
+# benchmark, when a leaf module's body is unchanged (empty: no cache)
+LPFS_CACHE=lpfs.cache
 
 # Create directory to put all byproduct and output files in
 for f in $*; do
@@ -71,56 +76,39 @@ for f in $*; do
 done
 
 # For different K and D values specified above, generate MultiSIMD schedules
+# All K and D values are scheduled in one run (-lpfs-sweep). The same run
+# co-schedules the modules from the leaf schedules, with the communication
+# latencies added (GenCGSIMDSchedule). Both outputs are then split at each
+# "M:" header into one file per K and D. The leaf schedules are also written
+# in binary (.lpfs.bin), which braidflash reads in place of the .lpfs
 # Turn on opp_simd (opportunistic simd) for more efficient schedules, but much slower. Refer to paper.
 for f in $*; do
   b=$(basename $f .scaffold)
-  for d in ${D[@]}; do
-    for k in ${K[@]}; do
-      for th in ${THRESHOLDS[@]}; do
-        echo "[gen-lpfs.sh] $b.flat${th}: Generating SIMD K=$k D=$d leaves ..."        
+  for th in ${THRESHOLDS[@]}; do
+    sweep=""
+    for d in ${D[@]}; do
+      for k in ${K[@]}; do
         if [ ! -e ${b}/${b}.flat${th}.simd.${k}.${d}.leaves.local ]; then
-          $OPT -load $SCAF -GenLPFSSchedule -simd-kconstraint-lpfs $k -simd-dconstraint-lpfs $d -simd_l 1 -full_sched $FULL_SCHED -local_mem 1 -opp_simd 0 ${b}/${b}.flat${th}.ll > /dev/null 2> ${b}/${b}.flat${th}.simd.${k}.${d}.leaves.local
+          sweep="${sweep:+$sweep,}$k:$d"
         fi
       done
     done
+    if [ -n "$sweep" ]; then
+      echo "[gen-lpfs.sh] $b.flat${th}: Generating SIMD K:D=$sweep leaves and coarse-grain schedules ..."        
+      $OPT -load $SCAF -GenLPFSSchedule -lpfs-sweep $sweep -simd_l 1 -full_sched $FULL_SCHED -local_mem 1 -opp_simd 0 -lpfs-threads $THREADS ${LPFS_CACHE:+-lpfs-cache $LPFS_CACHE} -lpfs-out ${b}/${b}.flat${th}.sweep -lpfs-bin ${b}/${b}.flat${th}.simd.%k.%d.lpfs.bin -GenCGSIMDSchedule ${b}/${b}.flat${th}.ll > /dev/null 2> ${b}/${b}.flat${th}.cgsweep
+      P=${b}/${b}.flat${th}.simd X=leaves.local perl -ne 'open(O, ">", "$ENV{P}.$1.$2.$ENV{X}") or die if /^M: \$::SIMD_K=(\d+); \$::SIMD_D=(\d+)/; print O' ${b}/${b}.flat${th}.sweep
+      P=${b}/${b}.flat${th}.simd X=local.time perl -ne 'open(O, ">", "$ENV{P}.$1.$2.$ENV{X}") or die if /^M: \$::SIMD_K=(\d+); \$::SIMD_D=(\d+)/; print O' ${b}/${b}.flat${th}.cgsweep
+      rm -f ${b}/${b}.flat${th}.sweep ${b}/${b}.flat${th}.cgsweep
+    fi
   done
 done
 
-# Take into account the penalty of ballistic communication
-for f in $*; do
-  b=$(basename $f .scaffold)
-  cd ${b}
-  echo "[gen-lpfs.sh] $b: Adding communication latencies ..."
-  ../${DIR}/comm_aware.pl ${b}*.leaves.local
-  cd ..
-done
-
-# Obtain coarse-grain schedules by co-scheduling modules
-for f in $*; do
-  b=$(basename $f .scaffold)
-  cd ${b}
-  for th in ${THRESHOLDS[@]}; do      
-    echo "[gen-lpfs.sh] $b.flat${th}: Coarse-grain schedule ..."    
-    for c in comm_aware_schedule.txt.${b}.flat${th}_*; do
-      k=$(perl -e '$ARGV[0] =~ /_K(\d+)/; print $1' $c)
-      d=$(perl -e '$ARGV[0] =~ /_D(\d+)/; print $1' $c)
-      x=$(perl -e '$ARGV[0] =~ /.*_(.+)/; print $1' $c)
-      th=$(perl -e '$ARGV[0] =~ /.flat(\d+[a-zA-Z])/; print $1' $c)    
-      mv $c comm_aware_schedule.txt
-      if [ ! -e ${b}/${b}.flat${th}.simd.${k}.${d}.${x}.time ]; then
-        ../$OPT -load ../$SCAF -GenCGSIMDSchedule -simd-kconstraint-cg $k -simd-dconstraint-cg $d ${b}.flat${th}.ll > /dev/null 2> ${b}.flat${th}.simd.${k}.${d}.${x}.time
-      fi
-    done
-  done
-  rm -f comm_aware_schedule.txt histogram_data.txt
-  cd ..
-done
-
 # Rename to simple names
 for f in $*; do
   b=$(basename $f .scaffold)  
   rename -f 's/\.simd\.(\d)\.(\d+)\.leaves\.local/\.lpfs/' ${b}/*leaves.local
   rename -f 's/\.simd\.(\d)\.(\d+)\.local\.time/\.cg/' ${b}/*time
+  rename -f 's/\.simd\.(\d)\.(\d+)\.lpfs\.bin/\.lpfs\.bin/' ${b}/*lpfs.bin
 done
 
 # Perform module frequency estimation
@@ -13,6 +13,8 @@ K=(2)
 THRESHOLDS=(2M)
 # Full schedule? otherwise only generates metrics (faster)
 FULL_SCHED=true
+# Threads scheduling leaf modules in parallel (0: one per core)
+THREADS=0
 
 # Create directory to put all byproduct and output files in
 for f in $*; do
@@ -75,7 +77,7 @@ for f in $*; do
       for th in ${THRESHOLDS[@]}; do
         if [ ! -e ${b}/${b}.flat${th}.simd.${k}.${d}.leaves ]; then
           echo "[gen-scheds.sh] GenSIMD for Threshold = $th flattening ..."
-          $OPT -load $SCAF -GenSIMDSchedule -simd-kconstraint $k -simd-dconstraint $d ${b}/${b}.flat${th}.ll > /dev/null 2> ${b}/${b}.flat${th}.simd.${k}.${d}
+          $OPT -load $SCAF -GenSIMDSchedule -simd-kconstraint $k -simd-dconstraint $d -simd-threads $THREADS ${b}/${b}.flat${th}.ll > /dev/null 2> ${b}/${b}.flat${th}.simd.${k}.${d}
           ${DIR}/leaves.pl ${b}/${b}.flat${th}.simd.${k}.${d} > ${b}/${b}.flat${th}.simd.${k}.${d}.leaves
         fi
       done
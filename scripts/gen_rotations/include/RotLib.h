@@ -11,6 +11,7 @@
 #include <cstdio>
 #include <iomanip>
 #include <math.h>
+#include <stdint.h>
 
 #include "precision.h"
 #include "storage.h"
@@ -46,6 +47,13 @@
  *    decompresses rotation sequences with Huffman encoding.
  *  - RotLib::save(filename) - which writes the encoded library in output file.
  *  - RotLib::load(filename) - which loads previously saved library from file.
+ *    It returns 0 and describes the problem in RotLib::error if the file
+ *    cannot be read.
+ *    Libraries are saved in a binary format (see FileHeader below) that
+ *    load() maps into memory read-only, so opening even a large library is
+ *    O(1) and all processes using it share one page-cached copy.
+ *  - RotLib::concatenate(gates, size, radian[, factor]) - the same, but
+ *    writes the gate symbols into a caller-provided buffer without allocating.
  *  - RotLib::concatenate(angle[, factor]) - which automatically assembles 
  *    library angles for the desired angle, optionally with factor = "pi". 
  *    Note that angle is in RotLib::Rz type, whose members include:
@@ -79,19 +87,35 @@ public:
 	// Initialize a RotLib with given precision
 	RotLib(PRECISION lib_p, STORAGE lib_s, int basis, bool phase);
 
-	// Load a previously generated RotLib from file
+	// Load a previously generated RotLib from file; check error afterwards
 	RotLib(const char* file);
 
+	~RotLib();
+
 	void generate();
 	
+	// Returns 1 on success, or 0 with the reason in error
 	int load(const char* file);
+
+	// Why the last load() failed, empty if it succeeded
+	std::string error;
 	
 	void save(const char* file);
 
 	void concatenate(Rz *output, double radian, const char *factor = "");
+
+	// Write the gates of Rz(radian) into gates[0..size). Returns the length
+	// of the sequence; nothing is written if it is larger than size. Returns
+	// -1 if the library does not decode to the lengths it records.
+	int concatenate(char *gates, int size, double radian, const char *factor = "");
 	
 	friend std::ostream& operator<<(std::ostream& out, const RotLib& L);
 
+	friend class RotLibBench;
+
+	// Number of library angles, either generated or mapped from file
+	int num_seqs() const;
+
 
 private:
 	typedef std::vector<unsigned char> Code;
@@ -109,24 +133,103 @@ private:
 	};
 
 	std::vector<seq> seqs;
-	
-	// Hardcoded Huffman encoding 
-	
-	const Codemap encode_table = {
-		{"HT", "0"},
-		{"S", "10"},
-		{"W", "111"},
-		{"X", "1100"},
-		{"H", "11010"},
-		{"T", "11011"}
+
+	/*
+	 * On-disk layout (version 2, host byte order):
+	 *   FileHeader
+	 *   IndexEntry[count]   at index_offset, entry id for angle Rz(c*pi/basis^k)
+	 *                       is 0 for k = 0 and (basis-1)*(k-1)+c otherwise
+	 *   payload             at payload_offset, the Huffman codes of all
+	 *                       sequences packed back to back, MSB first
+	 */
+	struct FileHeader
+	{
+		char magic[8];            // "RotLib\0\0"
+		uint32_t version;
+		uint32_t phase;
+		int32_t basis;
+		int32_t base;             // precision: base^-digits
+		int32_t digits;
+		int32_t storage_size;
+		double epsilon;
+		char storage_unit[8];
+		uint32_t count;           // number of IndexEntry
+		uint32_t reserved;
+		uint64_t index_offset;    // in bytes from start of file
+		uint64_t payload_offset;  // in bytes from start of file
+		uint64_t payload_bits;
 	};
-	const Codemap encode_table2 = {
-		{"HT", "0"},
-		{"S", "10"},
-		{"X", "111"},
-		{"H", "1100"},
-		{"T", "1101"}
+
+	struct IndexEntry
+	{
+		uint32_t l;               // Length(# gates) of the rotation sequence
+		uint32_t bits;            // Size(# bits) of its code in the payload
+		uint64_t offset;          // First bit of the code in the payload
 	};
+
+	static const uint32_t FILE_VERSION = 2;
+
+	// Memory mapped library, NULL if the sequences live in seqs
+	void *map_base;
+	size_t map_size;
+	const IndexEntry *map_index;
+	const unsigned char *map_payload;
+	uint32_t map_count;
+
+	// Parameters of the mapped library, lib_p and lib_s point here
+	struct pre map_p;
+	struct sto map_s;
+	char map_unit[sizeof(((FileHeader *)0)->storage_unit) + 1];
+
+	// Mapped files cannot be shared between copies
+	RotLib(const RotLib &);
+	RotLib &operator=(const RotLib &);
+
+	int map_file(const char *file, int fd);
+
+	// Bits ('0'/'1') of the code word of sequence id
+	std::string seq_bits(int id) const;
+
+	int seq_length(int id) const;
+	
+	// Hardcoded Huffman encoding (filled in by init_tables)
+	//  encode_table:  HT=0, S=10, W=111, X=1100, H=11010, T=11011
+	//  encode_table2: HT=0, S=10, X=111, H=1100, T=1101 (up to global phase)
+	Codemap encode_table;
+	Codemap encode_table2;
+
+	void init_tables();
+
+	// Multi-bit decoder: entry w of a table holds the gates of all codes
+	// that fit entirely in the byte w, and the first code on its own for
+	// decoding the tail of a sequence
+	static const int DECODE_BITS = 8;
+	struct DecodeEntry
+	{
+		unsigned char bits;       // Bits consumed by all codes in the window
+		unsigned char chars;      // Gate symbols they decode to
+		unsigned char first_bits; // Bits of the first code
+		unsigned char first_chars;
+		char gates[2 * DECODE_BITS];
+	};
+	DecodeEntry decode_table[1 << DECODE_BITS];   // encode_table
+	DecodeEntry decode_table2[1 << DECODE_BITS];  // encode_table2
+
+	void build_decode_table(const Codemap &codes, DecodeEntry *table);
+
+	// Decode nbits of code starting at bit start of data into out[0..size),
+	// returns the number of gate symbols written, or -1 if the code is
+	// corrupt or decodes to more than size symbols
+	int decode_into(const unsigned char *data, uint64_t start, uint64_t nbits, char *out, int size) const;
+
+	// Decode sequence id into out[0..size), returns its length or -1 if it
+	// does not fit or does not decode to seq_length(id) symbols
+	int decode_seq(int id, char *out, int size) const;
+
+	// Map radian (in units of factor) onto library entries, returns the
+	// normalized angle in units of pi
+	double select_seqs(double radian, const char *factor, std::vector<int> &indices);
+
 	int estimate_storage(double thres, int Na);
 
 	// Internal helpers for generating library
@@ -134,6 +237,8 @@ private:
 
 	std::string decode(charBits &data, int l); 
 
+	std::string decode_bits(const std::string &all_bits) const;
+
 	void load_gridsynth(const char *args, charBits *data, int *l, int *s);
 
 	double range_zero_two(double radian);
@@ -1,11 +1,18 @@
 #include "RotLib.h"
 #include "Exception.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
 RotLib::RotLib(PRECISION p, STORAGE s, int b, bool ph)
-: lib_p(p), lib_s(s), basis(b), phase(ph)
+: lib_p(p), lib_s(s), basis(b), phase(ph),
+  map_base(NULL), map_size(0), map_index(NULL), map_payload(NULL), map_count(0)
 {
+	init_tables();
 	int N = p -> base;
 	if (N != 2 && N != 10) {
 		cout << "non base-2 or base-10 target precision." << endl;
@@ -14,16 +21,77 @@ RotLib::RotLib(PRECISION p, STORAGE s, int b, bool ph)
 }
 
 RotLib::RotLib(const char* file)
+: lib_p(NULL), lib_s(NULL), basis(0), phase(false),
+  map_base(NULL), map_size(0), map_index(NULL), map_payload(NULL), map_count(0)
 {
+	init_tables();
 	load(file);
 }
 
+RotLib::~RotLib() {
+	if (map_base)
+		munmap(map_base, map_size);
+}
+
+int RotLib::num_seqs() const {
+	return map_base ? (int)map_count : (int)seqs.size();
+}
+
+void RotLib::init_tables() {
+	encode_table["HT"] = "0";
+	encode_table["S"] = "10";
+	encode_table["W"] = "111";
+	encode_table["X"] = "1100";
+	encode_table["H"] = "11010";
+	encode_table["T"] = "11011";
+
+	encode_table2["HT"] = "0";
+	encode_table2["S"] = "10";
+	encode_table2["X"] = "111";
+	encode_table2["H"] = "1100";
+	encode_table2["T"] = "1101";
+
+	build_decode_table(encode_table, decode_table);
+	build_decode_table(encode_table2, decode_table2);
+}
+
+void RotLib::build_decode_table(const Codemap &codes, DecodeEntry *table) {
+	for (int w = 0; w < (1 << DECODE_BITS); w++) {
+		string window;
+		for (int b = DECODE_BITS - 1; b >= 0; b--) {
+			window += ((w >> b) & 1) ? "1" : "0";
+		}
+		DecodeEntry &e = table[w];
+		memset(&e, 0, sizeof(e));
+		// greedily match codes, which are prefix-free
+		bool matched = true;
+		while (matched) {
+			matched = false;
+			for (Codemap::const_iterator ci = codes.begin(); ci != codes.end(); ci++) {
+				const string &code = ci->second;
+				if (e.bits + code.size() <= (size_t)DECODE_BITS &&
+				    window.compare(e.bits, code.size(), code) == 0) {
+					if (e.bits == 0) {
+						e.first_bits = code.size();
+						e.first_chars = ci->first.size();
+					}
+					memcpy(e.gates + e.chars, ci->first.data(), ci->first.size());
+					e.bits += code.size();
+					e.chars += ci->first.size();
+					matched = true;
+					break;
+				}
+			}
+		}
+	}
+}
+
 ostream& operator<<(ostream& out, const RotLib& L) {
 	out << "===== Rotation library info =====" << endl;
 	out << " - Basis = " << L.basis << endl;
 	out << " - Precision: " << std::scientific << pow(L.lib_p->base, -L.lib_p->digits) << endl;
 	out << " - Max Storage: " << L.lib_s -> size << L.lib_s -> unit << endl;
-	out << " - Number of sequences: " << L.seqs.size() << endl;
+	out << " - Number of sequences: " << L.num_seqs() << endl;
 	out << "=================================" << endl;
 	return out;
 }
@@ -77,7 +145,7 @@ void RotLib::generate() {
 	int Na = (B-1) * J + 1; // number of angles to generate
 	
 	// Estimate storage and verify if too much
-	int bytes = estimate_storage(thres, Na);
+	estimate_storage(thres, Na);
 
 	int Ka = K; // Precision for each angle
 	string p_flag;
@@ -115,7 +183,8 @@ void RotLib::generate() {
 	stringstream argss;
 	argss << "./" << gridsynthpath << " ";
 	argss << "pi" << " " << p_flag;
-	const char *args = argss.str().c_str();
+	string argstr = argss.str(); // keep the command alive while it runs
+	const char *args = argstr.c_str();
 	int l = 0;
 	int s = 0;
 	charBits *bit_buff = new charBits(); // new code vector
@@ -145,7 +214,8 @@ void RotLib::generate() {
 			stringstream ckss;
 			ckss << "./" << gridsynthpath << " ";
 			ckss << c << "*pi*" << setprecision(15)<< fixed << denom << " " << p_flag;
-			const char *ckstr = ckss.str().c_str();
+			string ckcmd = ckss.str();
+			const char *ckstr = ckcmd.c_str();
 
 			int ckl = 0;
 			int cks = 0;
@@ -202,8 +272,12 @@ int RotLib::encode(string gates, int l, charBits *data) {
 
 string RotLib::decode(charBits &data, int l) {
 	string all_bits;
-	stringstream ress;
 	data.charBits::read_bits(&all_bits);
+	return decode_bits(all_bits);
+}
+
+string RotLib::decode_bits(const string &all_bits) const {
+	stringstream ress;
 	int len = all_bits.size();
 	if (phase) {
 		// no W gate
@@ -272,6 +346,64 @@ string RotLib::decode(charBits &data, int l) {
 	return ress.str();
 }
 
+int RotLib::decode_into(const unsigned char *data, uint64_t start, uint64_t nbits, char *out, int size) const {
+	const DecodeEntry *table = phase ? decode_table2 : decode_table;
+	char *o = out;
+	char *o_end = out + size;
+	uint64_t pos = start;
+	uint64_t end = start + nbits;
+	// whole windows, each consuming every code that fits in it
+	while (end - pos >= (uint64_t)DECODE_BITS) {
+		const unsigned char *p = data + (pos >> 3);
+		unsigned shift = pos & 7;
+		unsigned w = shift ? ((p[0] << shift) | (p[1] >> (8 - shift))) & 0xff : p[0];
+		const DecodeEntry &e = table[w];
+		if (e.chars > o_end - o)
+			return -1;
+		memcpy(o, e.gates, e.chars);
+		o += e.chars;
+		pos += e.bits;
+	}
+	// tail, one code at a time from the zero-padded window
+	while (pos < end) {
+		unsigned w = 0;
+		for (int b = 0; b < DECODE_BITS; b++) {
+			w <<= 1;
+			uint64_t bp = pos + b;
+			if (bp < end && (data[bp >> 3] & (0x80 >> (bp & 7))))
+				w |= 1;
+		}
+		const DecodeEntry &e = table[w];
+		if (e.first_bits == 0 || pos + e.first_bits > end || e.first_chars > o_end - o)
+			return -1;
+		memcpy(o, e.gates, e.first_chars);
+		o += e.first_chars;
+		pos += e.first_bits;
+	}
+	return o - out;
+}
+
+int RotLib::decode_seq(int id, char *out, int size) const {
+	int length = seq_length(id);
+	if (length > size)
+		return -1;
+	int g;
+	if (map_base) {
+		const IndexEntry &e = map_index[id];
+		g = decode_into(map_payload, e.offset, e.bits, out, length);
+	} else {
+		// charBits layout: the high nibble of the first byte counts the
+		// unused bits of the last byte, data starts at bit 4
+		const Code &word = seqs.at(id).word;
+		if (word.empty())
+			return length == 0 ? 0 : -1;
+		uint64_t nbits = word.size() * 8 - 4 - (word[0] >> 4);
+		g = decode_into(&word[0], 4, nbits, out, length);
+	}
+	// the code must decode to exactly the recorded length
+	return g == length ? g : -1;
+}
+
 void RotLib::load_gridsynth(const char *args, charBits *data, int *l, int *s) {
 	cout << "Calling: " << args << endl;
 	string res = exec(args);
@@ -295,66 +427,139 @@ void RotLib::load_gridsynth(const char *args, charBits *data, int *l, int *s) {
 }
 
 int RotLib::load(const char *file) {
-	char header[27];
-	char check[] = "Gridsynth Rotation Library";
-	char msg[128];
+	error.clear();
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		error = string("unable to open file '") + file + "' for reading";
+		return 0;
+	}
+	char magic[8];
+	if (read(fd, magic, sizeof(magic)) == (ssize_t)sizeof(magic) &&
+	    memcmp(magic, "RotLib\0\0", sizeof(magic)) == 0) {
+		int ok = map_file(file, fd);
+		close(fd);
+		return ok;
+	}
+	close(fd);
+	// Libraries written before the binary format held raw pointers and
+	// cannot be read back
+	error = string("'") + file + "' does not look like a Rotation Library";
+	return 0;
+}
 
-	ifstream infile;
-	infile.open(file, ios::in | ios::binary);
-	if (!infile) {
-		sprintf(msg, "unable to open file '%s' for reading", file);
-		cout << msg << endl;
-		exit(1);
+int RotLib::map_file(const char *file, int fd) {
+	char msg[128];
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader)) {
+		error = string("'") + file + "' is truncated";
+		return 0;
 	}
-	// Check Header
-	infile.read((char *)header, sizeof(check));
-	if (strncmp(header, check, 27*sizeof(char))) {
-		sprintf(msg, "'%s' does not look like a Rotation Library.", file);
-		cout << msg << endl;
-		exit(1);
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		error = string("unable to map file '") + file + "'";
+		return 0;
 	}
 
-	// Structural stuff
-	infile.read((char *)&basis, sizeof(basis));
-	infile.read((char *)&phase, sizeof(phase));
-	infile.read((char *)&lib_p, sizeof(lib_p));
-	infile.read((char *)&lib_s, sizeof(lib_s));
-
-	// Content of sequences
-	int total;
-	infile.read((char *)&total, sizeof(int));
-
-	for (int si = 0; si < total; si++) {
-		int ls;
-		int ss;
-		int cs;
-		int ks;
-		Code words;
-
-		infile.read((char *)&ls, sizeof(int));
-		infile.read((char *)&ss, sizeof(int));
-		infile.read((char *)&cs, sizeof(int));
-		infile.read((char *)&ks, sizeof(int));
-		int code_bytes;
-		infile.read((char *)&code_bytes, sizeof(int));
-		unsigned char tmp;
-		for (int ci = 0; ci < code_bytes; ci++) {
-			infile.read((char *)&tmp, sizeof(unsigned char));
-			words.push_back(tmp);
+	const char *base_ptr = (const char *)base;
+	const FileHeader *hdr = (const FileHeader *)base_ptr;
+	uint64_t file_size = st.st_size;
+	if (hdr->version != FILE_VERSION) {
+		snprintf(msg, sizeof(msg), "unsupported library version %u", hdr->version);
+		error = string("'") + file + "' has " + msg;
+		munmap(base, st.st_size);
+		return 0;
+	}
+	if (hdr->index_offset > file_size || hdr->payload_offset > file_size ||
+	    hdr->count > (file_size - hdr->index_offset) / sizeof(IndexEntry) ||
+	    hdr->payload_bits / 8 > file_size - hdr->payload_offset ||
+	    (hdr->payload_bits + 7) / 8 > file_size - hdr->payload_offset) {
+		error = string("'") + file + "' is truncated";
+		munmap(base, st.st_size);
+		return 0;
+	}
+	// A library of basis b to j places holds pi and c*pi/b^k for c < b,
+	// k <= j, so select_seqs can address every entry
+	if (hdr->basis < 2 || hdr->count < 1 || (hdr->count - 1) % (hdr->basis - 1) != 0) {
+		snprintf(msg, sizeof(msg), "%u sequences in basis %d", hdr->count, hdr->basis);
+		error = string("'") + file + "' is corrupt: " + msg;
+		munmap(base, st.st_size);
+		return 0;
+	}
+	// Every code must lie in the payload, and as each code decodes to at
+	// most two gates neither can its length exceed twice its bits
+	const IndexEntry *index = (const IndexEntry *)(base_ptr + hdr->index_offset);
+	for (uint32_t id = 0; id < hdr->count; id++) {
+		const IndexEntry &e = index[id];
+		if (e.offset > hdr->payload_bits || e.bits > hdr->payload_bits - e.offset ||
+		    e.l > 2 * (uint64_t)e.bits || e.l > (uint32_t)INT_MAX) {
+			snprintf(msg, sizeof(msg), "sequence %u is out of bounds", id);
+			error = string("'") + file + "' is corrupt: " + msg;
+			munmap(base, st.st_size);
+			return 0;
 		}
-		
-		seqs.push_back(RotLib::seq(ls, ss, cs, ks, words));
 	}
-	
-	infile.close();
-	return 1;
+	map_base = base;
+	map_size = st.st_size;
 
+	// Structural stuff
+	basis = hdr->basis;
+	phase = hdr->phase != 0;
+	lib_p = &map_p;
+	lib_p->base = hdr->base;
+	lib_p->digits = hdr->digits;
+	lib_p->epsilon = hdr->epsilon;
+	lib_s = &map_s;
+	lib_s->size = hdr->storage_size;
+	lib_s->unit = map_unit;
+	memcpy(lib_s->unit, hdr->storage_unit, sizeof(hdr->storage_unit));
+	lib_s->unit[sizeof(hdr->storage_unit)] = '\0';
+
+	// Sequences stay in the mapping and are decoded on demand
+	map_count = hdr->count;
+	map_index = index;
+	map_payload = (const unsigned char *)(base_ptr + hdr->payload_offset);
+	return 1;
 }
 
 void RotLib::save(const char *file) {
-	char header[] = "Gridsynth Rotation Library";
 	char msg[128];
 
+	// Sequences are stored in (c, k) order, so that entry id of the index
+	// is the same id concatenate() computes
+	int total = num_seqs();
+	vector<IndexEntry> index(total);
+	string payload;
+	for (int id = 0; id < total; id++) {
+		string bits = seq_bits(id);
+		index[id].l = seq_length(id);
+		index[id].bits = bits.size();
+		index[id].offset = payload.size();
+		payload += bits;
+	}
+
+	FileHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "RotLib\0\0", sizeof(hdr.magic));
+	hdr.version = FILE_VERSION;
+	hdr.phase = phase ? 1 : 0;
+	hdr.basis = basis;
+	hdr.base = lib_p->base;
+	hdr.digits = lib_p->digits;
+	hdr.storage_size = lib_s->size;
+	hdr.epsilon = lib_p->epsilon;
+	strncpy(hdr.storage_unit, lib_s->unit, sizeof(hdr.storage_unit));
+	hdr.count = total;
+	hdr.index_offset = sizeof(FileHeader);
+	hdr.payload_offset = hdr.index_offset + total * sizeof(IndexEntry);
+	hdr.payload_bits = payload.size();
+
+	// Pack the payload MSB first
+	vector<unsigned char> packed((payload.size() + 7) / 8, 0);
+	for (size_t b = 0; b < payload.size(); b++) {
+		if (payload[b] == '1')
+			packed[b >> 3] |= 0x80 >> (b & 7);
+	}
+
 	ofstream outfile;
 	outfile.open(file, ios::out | ios::binary);
 	if (!outfile) {
@@ -362,34 +567,36 @@ void RotLib::save(const char *file) {
 		cout << msg << endl;
 		exit(1);
 	}
-	// Header
-	outfile.write(header, sizeof(header));
-	// Structural stuff
-	outfile.write((char *)&basis, sizeof(basis));
-	outfile.write((char *)&phase, sizeof(phase));
-	outfile.write((char *)&lib_p, sizeof(lib_p));
-	outfile.write((char *)&lib_s, sizeof(lib_s));
-	// Content of sequences
-	int total = seqs.size();
-	outfile.write((char *)&total, sizeof(int));
-	vector<seq>::iterator si = seqs.begin();
-	while (si != seqs.end()) {
-		outfile.write((char *)&(*si).l, sizeof(int));
-		outfile.write((char *)&(*si).s, sizeof(int));
-		outfile.write((char *)&(*si).c, sizeof(int));
-		outfile.write((char *)&(*si).k, sizeof(int));
-		int code_bytes = (*si).word.size();
-		outfile.write((char *)&code_bytes, sizeof(int));
-		for (Code::iterator ci = (*si).word.begin(); ci != (*si).word.end(); ci++) {
-			outfile.write((char *)&(*ci), sizeof(unsigned char));
-		}
-		si++;
-	}
-	
+	outfile.write((char *)&hdr, sizeof(hdr));
+	if (total > 0)
+		outfile.write((char *)&index[0], total * sizeof(IndexEntry));
+	if (!packed.empty())
+		outfile.write((char *)&packed[0], packed.size());
 	outfile.close();
 
 }
 
+string RotLib::seq_bits(int id) const {
+	if (!map_base) {
+		charBits bits(seqs.at(id).word);
+		string all_bits;
+		bits.read_bits(&all_bits);
+		return all_bits;
+	}
+	const IndexEntry &e = map_index[id];
+	string all_bits(e.bits, '0');
+	for (uint32_t b = 0; b < e.bits; b++) {
+		uint64_t pos = e.offset + b;
+		if (map_payload[pos >> 3] & (0x80 >> (pos & 7)))
+			all_bits[b] = '1';
+	}
+	return all_bits;
+}
+
+int RotLib::seq_length(int id) const {
+	return map_base ? (int)map_index[id].l : seqs.at(id).l;
+}
+
 double RotLib::range_zero_two(double radian) {
   // assuming radian does not have pi factor 
   while (radian < 0) {
@@ -414,20 +621,25 @@ void RotLib::seq_combine(const vector<int> &indices, Rz *out) {
 		exit(0);
 	}
 	// append sequences from left to right
-	stringstream gss;
 	vector<int>::const_iterator ii;
 	for (ii = indices.begin(); ii != indices.end(); ii++) {
-		const seq seqi = seqs.at(*ii);
-		out -> length += seqi.l;
-		charBits *bits = new charBits(seqi.word);
-		gss << decode(*bits, seqi.l);
-		// clean up bits
-		delete bits;
-	}
-	out -> gates = gss.str();
+		out -> length += seq_length(*ii);
+	}
+	out -> gates.resize(out -> length);
+	int g = 0;
+	for (ii = indices.begin(); ii != indices.end(); ii++) {
+		if (seq_length(*ii) == 0)
+			continue;
+		int n = decode_seq(*ii, &out -> gates[g], out -> length - g);
+		if (n < 0) {
+			cout << "Something went wrong while decoding." << endl;
+			exit(1);
+		}
+		g += n;
+	}
 }
 
-void RotLib::concatenate(Rz *output, double radian, const char *factor) {
+double RotLib::select_seqs(double radian, const char *factor, vector<int> &indices) {
 	double pi = 3.1415926535897;
 	char pi_str[] = "pi";
 	char no_str[] = "";
@@ -446,11 +658,9 @@ void RotLib::concatenate(Rz *output, double radian, const char *factor) {
 		// angle: radian*pi
 		radian = range_zero_two(radian);
 		r_angle = radian;
-		vector<int> indices;
-		int J = seqs.size() / (basis - 1);
-		int c_array[J + 1]; // basis representation of radian
+		int J = (num_seqs() - 1) / (basis - 1);
+		vector<int> c_array(J + 1, 0); // basis representation of radian
 		// c_array[i] stores c_i
-		for (int i = 0; i < J + 1; i++) c_array[i] = 0;
 		// integer part
 		if (radian >= 1.0) {
 			c_array[0] = 1;
@@ -472,19 +682,14 @@ void RotLib::concatenate(Rz *output, double radian, const char *factor) {
 			int c = c_array[k];
 			if (c > 0) {
 				int id = (basis - 1) * (k - 1) + c;
-				if (id >= seqs.size()) {
-					cout << "seqs out of bound: " << id << " out of " << seqs.size() << endl;
+				if (id >= num_seqs()) {
+					cout << "seqs out of bound: " << id << " out of " << num_seqs() << endl;
 					exit(1);
 				}
 				indices.push_back(id); 
 			}
 		}
-		// Now combine the selected sequences
-		stringstream angless;
-		angless << r_angle << "*pi";
-		output -> theta = angless.str();
-		output -> p = lib_p;
-		seq_combine(indices, output);
+		return r_angle;
 
 	} else {
 		cout << "non pi-factor angles are not yet supported!" << endl;
@@ -492,3 +697,34 @@ void RotLib::concatenate(Rz *output, double radian, const char *factor) {
   }
 }
 
+void RotLib::concatenate(Rz *output, double radian, const char *factor) {
+	vector<int> indices;
+	double r_angle = select_seqs(radian, factor, indices);
+	// Now combine the selected sequences
+	stringstream angless;
+	angless << r_angle << "*pi";
+	output -> theta = angless.str();
+	output -> p = lib_p;
+	seq_combine(indices, output);
+}
+
+int RotLib::concatenate(char *gates, int size, double radian, const char *factor) {
+	vector<int> indices;
+	select_seqs(radian, factor, indices);
+	int length = 0;
+	vector<int>::const_iterator ii;
+	for (ii = indices.begin(); ii != indices.end(); ii++) {
+		length += seq_length(*ii);
+	}
+	if (length > size)
+		return length;
+	int g = 0;
+	for (ii = indices.begin(); ii != indices.end(); ii++) {
+		int n = decode_seq(*ii, gates + g, length - g);
+		if (n < 0)
+			return -1;
+		g += n;
+	}
+	return length;
+}
+
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <time.h>
+
+#include "RotLib.h"
+using namespace std;
+
+/*
+ * Compares the bit-at-a-time decoder RotLib used originally (one '0'/'1'
+ * string per sequence, decoded against the code strings) with the
+ * table-driven decoder behind RotLib::concatenate, on the same angles.
+ */
+class RotLibBench
+{
+public:
+	RotLibBench(RotLib &l) : L(l) {}
+
+	// The original path: bits as a string, decoded one code at a time
+	string bitwise(double radian) {
+		vector<int> indices;
+		L.select_seqs(radian, "pi", indices);
+		stringstream gss;
+		for (vector<int>::iterator ii = indices.begin(); ii != indices.end(); ii++) {
+			gss << L.decode_bits(L.seq_bits(*ii));
+		}
+		return gss.str();
+	}
+
+	// Upper bound on any assembled sequence: all library entries at once
+	int max_length() {
+		int length = 0;
+		for (int id = 0; id < L.num_seqs(); id++) {
+			length += L.seq_length(id);
+		}
+		return length;
+	}
+
+	int table(double radian, char *gates, int size) {
+		return L.concatenate(gates, size, radian, "pi");
+	}
+
+private:
+	RotLib &L;
+};
+
+static double seconds(clock_t start, clock_t end) {
+	return ((double)end - (double)start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2 || argc > 3) {
+		cout << "Example Usage: ./bench rotations_2_100B.lib 100000" << endl;
+		cout << "./bench lib [n]" << endl;
+		cout << "\t lib - rotation library generated by ./example" << endl;
+		cout << "\t n - number of rotations to assemble with each decoder (default 100000)\n" << endl;
+		exit(1);
+	}
+	int n = (argc == 3) ? atoi(argv[2]) : 100000;
+
+	RotLib rlib(argv[1]);
+	if (!rlib.error.empty()) {
+		cout << rlib.error << endl;
+		exit(1);
+	}
+	cout << rlib << endl;
+	RotLibBench bench(rlib);
+
+	// Angles spread over [0, 2) so that every library entry is used
+	vector<double> angles(n);
+	srand(1);
+	for (int i = 0; i < n; i++) {
+		angles[i] = 2.0 * rand() / ((double)RAND_MAX + 1);
+	}
+
+	// Both decoders must agree before timing them
+	vector<char> buffer(bench.max_length() + 1);
+	for (int i = 0; i < n && i < 1000; i++) {
+		int len = bench.table(angles[i], &buffer[0], buffer.size());
+		if (len < 0 || bench.bitwise(angles[i]) != string(&buffer[0], len)) {
+			cout << "Decoders disagree on " << angles[i] << "*pi" << endl;
+			exit(1);
+		}
+	}
+
+	size_t gates = 0;
+	clock_t start = clock();
+	for (int i = 0; i < n; i++) {
+		gates += bench.bitwise(angles[i]).size();
+	}
+	clock_t end = clock();
+	double t_bitwise = seconds(start, end);
+
+	size_t gates2 = 0;
+	start = clock();
+	for (int i = 0; i < n; i++) {
+		gates2 += bench.table(angles[i], &buffer[0], buffer.size());
+	}
+	end = clock();
+	double t_table = seconds(start, end);
+
+	cout << fixed << setprecision(3);
+	cout << n << " rotations, " << gates << " gates" << endl;
+	cout << "\tbit-at-a-time decoder: " << t_bitwise << " seconds" << endl;
+	cout << "\ttable decoder:         " << t_table << " seconds";
+	if (t_table > 0)
+		cout << " (" << t_bitwise / t_table << "x)";
+	cout << endl;
+	if (gates != gates2) {
+		cout << "Gate counts differ: " << gates2 << endl;
+		exit(1);
+	}
+}
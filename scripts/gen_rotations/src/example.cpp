@@ -75,6 +75,10 @@ int main(int argc, char *argv[])
 	
 	// Which can be loaded next time as follows
 	RotLib rlib2(name);
+	if (!rlib2.error.empty()) {
+		cout << rlib2.error << endl;
+		exit(1);
+	}
 	
 	cout << rlib2 << endl;
 	out << rlib2 << endl;
@@ -0,0 +1,163 @@
+// Run time rotation decomposition for dynamically generated QASM.
+//
+// The dyn-gen-qasm-with-loops pass (with -dyn-rotations) calls
+// qasm_print_rot_ct instead of qasm_print_rot for Rz gates, whose angle is
+// often only known when the program runs (phase estimation, VQE loops).
+// This runtime assembles the Clifford+T sequence for that angle from the
+// RotLib library in $ROTATIONLIB and prints it gate by gate through
+// qasm_print_qgate, so the output contains no rotations. Without a library
+// the rotation is printed unchanged with qasm_print_rot.
+//
+// Sequences of recently seen angles are memoized in a direct-mapped table,
+// so loops that repeat the same angles only assemble them once.
+//
+// Compile into bitcode together with RotLib and link with the instrumented
+// program, e.g.
+//   for f in rotation-runtime.cpp gen_rotations/src/RotLib.cpp gen_rotations/src/charbits.cpp; do
+//     clang++ -c -O1 -emit-llvm -I gen_rotations/include $f -o $(basename $f .cpp).bc
+//   done
+//   llvm-link rotation-runtime.bc RotLib.bc charbits.bc <qasm runtime>.bc <prog>.ll -S -o=<prog>_linked.ll
+//
+//        This file was created by Scaffold Compiler Working Group
+
+#include <stdlib.h>    /* getenv    */
+#include <stdio.h>     /* fprintf   */
+#include <string.h>    /* memcpy    */
+#include <stdint.h>    /* uint64_t  */
+#include <string>
+#include <vector>
+
+#include "RotLib.h"
+
+// gate ids, as numbered by DynGenQASMLoops
+#define _H 2
+#define _S 7
+#define _T 8
+#define _Sdag 9
+#define _Tdag 10
+#define _X 12
+#define _Y 13
+#define _Z 14
+#define _Rz 15
+
+#define _ROT_MEMO_BITS 10
+#define _ROT_MEMO_SIZE (1 << _ROT_MEMO_BITS)
+
+// printers provided by the QASM runtime the program is linked with
+extern "C" void qasm_print_qgate(int gateID, char *name, short idx);
+extern "C" void qasm_print_rot(int gateID, char *name, short idx, double angle);
+
+// DEBUG switch
+bool debugRotationRuntime = false;
+
+namespace {
+
+  struct rot_memo_t {
+    bool valid;
+    uint64_t key;      // bit pattern of the angle
+    std::string gates; // Clifford+T sequence, in RotLib (reverse) order
+  };
+
+  RotLib *rotLib = NULL;
+  bool rotLibOpened = false;
+  rot_memo_t rotMemo[_ROT_MEMO_SIZE];
+  std::vector<char> rotBuffer;
+
+  unsigned long long memoHits = 0;
+  unsigned long long memoMisses = 0;
+
+  RotLib *get_rotlib() {
+    if (!rotLibOpened) {
+      rotLibOpened = true;
+      const char *file = getenv("ROTATIONLIB");
+      if (file && *file) {
+        rotLib = new RotLib(file);
+        if (!rotLib->error.empty()) {
+          fprintf(stderr, "%s, printing rotations undecomposed.\n", rotLib->error.c_str());
+          delete rotLib;
+          rotLib = NULL;
+        }
+      } else
+        fprintf(stderr, "ROTATIONLIB not set, printing rotations undecomposed.\n");
+    }
+    return rotLib;
+  }
+
+  uint64_t angle_key(double angle) {
+    uint64_t key;
+    memcpy(&key, &angle, sizeof(key));
+    return key;
+  }
+
+  /* lookup_rot: find the sequence for angle, assembling it on a miss;
+     NULL if the library cannot assemble it */
+  const std::string *lookup_rot(RotLib *L, double angle) {
+    uint64_t key = angle_key(angle);
+    // multiplicative hash; the top bits depend on all bits of the key, so
+    // angles differing only in the exponent (x, 2x, ...) spread as well
+    uint64_t h = (key * 0x9E3779B97F4A7C15ULL) >> (64 - _ROT_MEMO_BITS);
+    rot_memo_t &memo = rotMemo[h];
+    if (memo.valid && memo.key == key) {
+      memoHits++;
+      return &memo.gates;
+    }
+    memoMisses++;
+
+    if (rotBuffer.empty())
+      rotBuffer.resize(4096);
+    int len = L->concatenate(&rotBuffer[0], rotBuffer.size(), angle);
+    if (len > (int)rotBuffer.size()) {
+      rotBuffer.resize(len);
+      len = L->concatenate(&rotBuffer[0], rotBuffer.size(), angle);
+    }
+    if (len < 0) {
+      fprintf(stderr, "Rotation library is corrupt, printing Rz(%.17g) undecomposed.\n", angle);
+      return NULL;
+    }
+    memo.valid = true;
+    memo.key = key;
+    memo.gates.assign(&rotBuffer[0], len);
+    if (debugRotationRuntime)
+      fprintf(stderr, "Rz(%.17g) = %s\n", angle, memo.gates.c_str());
+    return &memo.gates;
+  }
+
+} // End of anonymous namespace
+
+/* qasm_print_rot_ct: print Rz(angle) on qubit name[idx] as Clifford+T gates */
+extern "C" void qasm_print_rot_ct(int gateID, char *name, short idx, double angle) {
+  RotLib *L = get_rotlib();
+  if (gateID != _Rz || !L) {
+    qasm_print_rot(gateID, name, idx, angle);
+    return;
+  }
+  if (angle == 0.0)
+    return;
+
+  const std::string *seq = lookup_rot(L, angle);
+  if (!seq) {
+    qasm_print_rot(gateID, name, idx, angle);
+    return;
+  }
+  const std::string &gates = *seq;
+  // the sequence is given in the reverse order that ops must be applied
+  for (int i = gates.length() - 1; i >= 0; i--) {
+    switch (gates[i]) {
+      case 'H': qasm_print_qgate(_H, name, idx); break;
+      case 'S': qasm_print_qgate(_S, name, idx); break;
+      case 's': qasm_print_qgate(_Sdag, name, idx); break;
+      case 'T': qasm_print_qgate(_T, name, idx); break;
+      case 't': qasm_print_qgate(_Tdag, name, idx); break;
+      case 'X': qasm_print_qgate(_X, name, idx); break;
+      case 'Y': qasm_print_qgate(_Y, name, idx); break;
+      case 'Z': qasm_print_qgate(_Z, name, idx); break;
+      default: break; // W: global phase
+    }
+  }
+}
+
+/* qasm_rot_summary: report how well the memo table worked */
+extern "C" void qasm_rot_summary() {
+  fprintf(stderr, "Run time rotations: %llu assembled, %llu memoized\n",
+          memoMisses, memoHits);
+}